@@ -30,6 +30,9 @@
 #define DEFAULT_HUB_UID        "abc-987-123"
 #define DEFAULT_BACKEND         CHAMGE_BACKEND_AMQP
 #define DEFAULT_URI            "srt://127.0.0.1:8888"
+#define DEFAULT_DRAIN_TIMEOUT   30
+
+#define STATUS_DRAINING         3
 
 struct _HwangsaeAgent
 {
@@ -172,6 +175,36 @@ hwangsae_agent_edge_interface_handle_stop (Hwangsae1DBusEdgeInterface * object,
   return TRUE;
 }
 
+static void
+hwangsae_agent_relay_drained (HwangsaeRelay * relay, gpointer user_data)
+{
+  g_debug ("Relay drained, exiting");
+
+  g_application_quit (G_APPLICATION (user_data));
+}
+
+static void
+hwangsae_agent_drain (HwangsaeAgent * self, guint timeout)
+{
+  hwangsae1_dbus_manager_set_status (self->manager, STATUS_DRAINING);
+  hwangsae_relay_drain (self->relay, timeout);
+}
+
+gboolean
+hwangsae_agent_manager_handle_drain (Hwangsae1DBusManager * object,
+    GDBusMethodInvocation * invocation, guint arg_timeout, gpointer user_data)
+{
+  HwangsaeAgent *self = (HwangsaeAgent *) user_data;
+
+  g_debug ("hwangsae_agent_manager_handle_drain, timeout %u", arg_timeout);
+
+  hwangsae_agent_drain (self, arg_timeout);
+
+  hwangsae1_dbus_manager_complete_drain (object, invocation);
+
+  return TRUE;
+}
+
 static void
 hwangsae_agent_dispose (GObject * object)
 {
@@ -206,6 +239,15 @@ signal_handler (GApplication * app)
   return G_SOURCE_REMOVE;
 }
 
+/* Lets the clients move elsewhere instead of dropping them all at once. */
+static gboolean
+drain_signal_handler (GApplication * app)
+{
+  hwangsae_agent_drain (HWANGSAE_AGENT (app), DEFAULT_DRAIN_TIMEOUT);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 hwangsae_agent_init (HwangsaeAgent * self)
 {
@@ -214,6 +256,9 @@ hwangsae_agent_init (HwangsaeAgent * self)
 
   self->relay = hwangsae_relay_new ();
 
+  g_signal_connect (self->relay, "drained",
+      G_CALLBACK (hwangsae_agent_relay_drained), self);
+
   /* TODO : HUB UID should be get from configuration */
   self->chamge_hub = chamge_hub_new_full (DEFAULT_HUB_UID, DEFAULT_BACKEND);
 
@@ -230,6 +275,9 @@ hwangsae_agent_init (HwangsaeAgent * self)
 
   hwangsae1_dbus_manager_set_status (self->manager, 1);
 
+  g_signal_connect (self->manager, "handle-drain",
+      G_CALLBACK (hwangsae_agent_manager_handle_drain), self);
+
   self->edge_interface = hwangsae1_dbus_edge_interface_skeleton_new ();
 
   g_signal_connect (self->edge_interface, "handle-start",
@@ -249,6 +297,7 @@ main (int argc, char *argv[])
           "flags", G_APPLICATION_IS_SERVICE, NULL));
 
   g_unix_signal_add (SIGINT, (GSourceFunc) signal_handler, app);
+  g_unix_signal_add (SIGTERM, (GSourceFunc) drain_signal_handler, app);
 
   g_application_hold (app);
 
@@ -0,0 +1,1011 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "mpegts.h"
+
+#include <string.h>
+
+/* Layout of the latency probe payload:
+ *
+ *   0   4  magic "HWSP"
+ *   4   1  version
+ *   5   1  flags (PROBE_FLAG_*)
+ *   6   2  reserved
+ *   8   4  sequence number
+ *  12   8  edge wall-clock time (us)
+ *  20   8  relay wall-clock time (us)
+ *
+ * All multi-byte fields are big-endian. The rest of the packet is stuffed
+ * with 0xff. */
+
+#define PROBE_PAYLOAD_OFFSET    4
+#define PROBE_VERSION           1
+#define PROBE_FLAG_EDGE_TIME    (1 << 0)
+#define PROBE_FLAG_RELAY_TIME   (1 << 1)
+
+static const guint8 PROBE_MAGIC[] = { 'H', 'W', 'S', 'P' };
+
+static void
+_write_be32 (guint8 * dst, guint32 val)
+{
+  val = GUINT32_TO_BE (val);
+  memcpy (dst, &val, sizeof (val));
+}
+
+static void
+_write_be64 (guint8 * dst, gint64 val)
+{
+  guint64 v = GUINT64_TO_BE ((guint64) val);
+  memcpy (dst, &v, sizeof (v));
+}
+
+static guint32
+_read_be32 (const guint8 * src)
+{
+  guint32 val;
+
+  memcpy (&val, src, sizeof (val));
+  return GUINT32_FROM_BE (val);
+}
+
+static gint64
+_read_be64 (const guint8 * src)
+{
+  guint64 val;
+
+  memcpy (&val, src, sizeof (val));
+  return (gint64) GUINT64_FROM_BE (val);
+}
+
+void
+hwangsae_mpegts_probe_write (guint8 * packet, guint8 continuity_counter,
+    const HwangsaeProbeMarker * marker)
+{
+  guint8 *payload = packet + PROBE_PAYLOAD_OFFSET;
+  guint8 flags = 0;
+
+  memset (packet, 0xff, HWANGSAE_MPEGTS_PACKET_SIZE);
+
+  packet[0] = HWANGSAE_MPEGTS_SYNC_BYTE;
+  /* payload_unit_start_indicator set, no adaptation field */
+  packet[1] = 0x40 | ((HWANGSAE_MPEGTS_PROBE_PID >> 8) & 0x1f);
+  packet[2] = HWANGSAE_MPEGTS_PROBE_PID & 0xff;
+  packet[3] = 0x10 | (continuity_counter & 0x0f);
+
+  if (marker->edge_time >= 0) {
+    flags |= PROBE_FLAG_EDGE_TIME;
+  }
+  if (marker->relay_time >= 0) {
+    flags |= PROBE_FLAG_RELAY_TIME;
+  }
+
+  memcpy (payload, PROBE_MAGIC, sizeof (PROBE_MAGIC));
+  payload[4] = PROBE_VERSION;
+  payload[5] = flags;
+  payload[6] = payload[7] = 0;
+  _write_be32 (payload + 8, marker->seqnum);
+  _write_be64 (payload + 12, marker->edge_time);
+  _write_be64 (payload + 20, marker->relay_time);
+}
+
+static guint8 *
+_probe_payload (const guint8 * packet)
+{
+  const guint8 *payload = packet + PROBE_PAYLOAD_OFFSET;
+
+  if (!hwangsae_mpegts_packet_is_valid (packet) ||
+      hwangsae_mpegts_packet_pid (packet) != HWANGSAE_MPEGTS_PROBE_PID) {
+    return NULL;
+  }
+
+  /* Markers never carry an adaptation field. */
+  if ((packet[3] & 0x30) != 0x10) {
+    return NULL;
+  }
+
+  if (memcmp (payload, PROBE_MAGIC, sizeof (PROBE_MAGIC)) != 0 ||
+      payload[4] != PROBE_VERSION) {
+    return NULL;
+  }
+
+  return (guint8 *) payload;
+}
+
+gboolean
+hwangsae_mpegts_probe_read (const guint8 * packet, HwangsaeProbeMarker * marker)
+{
+  const guint8 *payload = _probe_payload (packet);
+
+  if (!payload) {
+    return FALSE;
+  }
+
+  marker->seqnum = _read_be32 (payload + 8);
+  marker->edge_time = (payload[5] & PROBE_FLAG_EDGE_TIME) ?
+      _read_be64 (payload + 12) : -1;
+  marker->relay_time = (payload[5] & PROBE_FLAG_RELAY_TIME) ?
+      _read_be64 (payload + 20) : -1;
+
+  return TRUE;
+}
+
+gboolean
+hwangsae_mpegts_probe_stamp_relay (guint8 * packet, gint64 relay_time)
+{
+  guint8 *payload = _probe_payload (packet);
+
+  if (!payload) {
+    return FALSE;
+  }
+
+  payload[5] |= PROBE_FLAG_RELAY_TIME;
+  _write_be64 (payload + 20, relay_time);
+
+  return TRUE;
+}
+
+#define PAT_PID                 0x0000
+#define STREAM_TYPE_H264        0x1b
+
+#define NAL_SLICE               1
+#define NAL_IDR_SLICE           5
+
+/* Returns the offset of the payload or 0 if the packet has none. */
+static gsize
+_payload_offset (const guint8 * packet)
+{
+  gsize offset = 4;
+
+  if (!(packet[3] & 0x10)) {
+    return 0;
+  }
+
+  if (packet[3] & 0x20) {
+    offset += 1 + packet[4];
+  }
+
+  return offset < HWANGSAE_MPEGTS_PACKET_SIZE ? offset : 0;
+}
+
+/* Returns the start of the PSI section with the given table ID, which is
+ * expected to fit into the packet. */
+static const guint8 *
+_find_section (const guint8 * packet, guint8 table_id, gsize * section_len)
+{
+  const guint8 *end = packet + HWANGSAE_MPEGTS_PACKET_SIZE;
+  const guint8 *section;
+  gsize offset = _payload_offset (packet);
+
+  if (offset == 0 || !hwangsae_mpegts_packet_has_unit_start (packet)) {
+    return NULL;
+  }
+
+  /* Skip the pointer field. */
+  section = packet + offset + 1 + packet[offset];
+  if (section + 3 > end || section[0] != table_id) {
+    return NULL;
+  }
+
+  *section_len = 3 + (((section[1] & 0x0f) << 8) | section[2]);
+  if (section + *section_len > end) {
+    return NULL;
+  }
+
+  return section;
+}
+
+static void
+_parse_pat (HwangsaeMpegtsScanner * scanner, const guint8 * packet)
+{
+  const guint8 *section;
+  gsize section_len;
+  gsize i;
+
+  section = _find_section (packet, 0x00, &section_len);
+  if (!section || section_len < 12) {
+    return;
+  }
+
+  /* Program entries lie between the header and the CRC. */
+  for (i = 8; i + 4 <= section_len - 4; i += 4) {
+    guint16 program_number = (section[i] << 8) | section[i + 1];
+
+    if (program_number != 0) {
+      scanner->pmt_pid = ((section[i + 2] & 0x1f) << 8) | section[i + 3];
+      return;
+    }
+  }
+}
+
+static void
+_parse_pmt (HwangsaeMpegtsScanner * scanner, const guint8 * packet)
+{
+  const guint8 *section;
+  gsize section_len;
+  gsize i;
+
+  section = _find_section (packet, 0x02, &section_len);
+  if (!section || section_len < 16) {
+    return;
+  }
+
+  i = 12 + (((section[10] & 0x0f) << 8) | section[11]);
+
+  while (i + 5 <= section_len - 4) {
+    guint8 stream_type = section[i];
+    guint16 pid = ((section[i + 1] & 0x1f) << 8) | section[i + 2];
+
+    if (stream_type == STREAM_TYPE_H264) {
+      scanner->video_pid = pid;
+      return;
+    }
+
+    i += 5 + (((section[i + 3] & 0x0f) << 8) | section[i + 4]);
+  }
+}
+
+/* Returns where the elementary stream starts in the first packet of a PES
+ * packet or NULL when it doesn't. */
+static const guint8 *
+_skip_pes_header (const guint8 * packet)
+{
+  const guint8 *es;
+  gsize offset = _payload_offset (packet);
+
+  if (offset == 0 || offset + 9 > HWANGSAE_MPEGTS_PACKET_SIZE) {
+    return NULL;
+  }
+
+  es = packet + offset;
+  if (es[0] != 0 || es[1] != 0 || es[2] != 1) {
+    return NULL;
+  }
+
+  es += 9 + es[8];
+
+  return es <= packet + HWANGSAE_MPEGTS_PACKET_SIZE ? es : NULL;
+}
+
+/* Looks for the first slice of the current access unit, whose start codes
+ * may span packets. */
+static HwangsaeFrameType
+_find_first_slice (HwangsaeMpegtsScanner * scanner, const guint8 * es,
+    const guint8 * end)
+{
+  for (; es != end; ++es) {
+    if (scanner->nal_start) {
+      guint8 nal_type = *es & 0x1f;
+
+      scanner->nal_start = FALSE;
+
+      if (nal_type == NAL_IDR_SLICE) {
+        return HWANGSAE_FRAME_IDR;
+      } else if (nal_type == NAL_SLICE) {
+        return (*es & 0x60) ? HWANGSAE_FRAME_REFERENCE :
+            HWANGSAE_FRAME_NON_REFERENCE;
+      }
+    }
+
+    if (*es == 0) {
+      ++scanner->zeros;
+    } else {
+      scanner->nal_start = *es == 1 && scanner->zeros >= 2;
+      scanner->zeros = 0;
+    }
+  }
+
+  return HWANGSAE_FRAME_UNKNOWN;
+}
+
+HwangsaeFrameType
+hwangsae_mpegts_scanner_push (HwangsaeMpegtsScanner * scanner, const guint8 * packet)
+{
+  const guint8 *end = packet + HWANGSAE_MPEGTS_PACKET_SIZE;
+  const guint8 *es = NULL;
+  guint16 pid;
+
+  if (!hwangsae_mpegts_packet_is_valid (packet)) {
+    return HWANGSAE_FRAME_UNKNOWN;
+  }
+
+  pid = hwangsae_mpegts_packet_pid (packet);
+
+  if (pid == PAT_PID) {
+    _parse_pat (scanner, packet);
+  } else if (scanner->pmt_pid != 0 && pid == scanner->pmt_pid) {
+    _parse_pmt (scanner, packet);
+  } else if (scanner->video_pid != 0 && pid == scanner->video_pid) {
+    if (hwangsae_mpegts_packet_has_unit_start (packet)) {
+      scanner->frame = HWANGSAE_FRAME_UNKNOWN;
+      scanner->zeros = 0;
+      scanner->nal_start = FALSE;
+      es = _skip_pes_header (packet);
+      scanner->searching = es != NULL;
+    } else if (scanner->searching && _payload_offset (packet) != 0) {
+      es = packet + _payload_offset (packet);
+    }
+
+    if (es) {
+      scanner->frame = _find_first_slice (scanner, es, end);
+      scanner->searching = scanner->frame == HWANGSAE_FRAME_UNKNOWN;
+    }
+
+    return scanner->frame;
+  }
+
+  return HWANGSAE_FRAME_UNKNOWN;
+}
+
+static gboolean
+_packet_has_pcr (const guint8 * packet)
+{
+  return (packet[3] & 0x20) && packet[4] != 0 && (packet[5] & 0x10);
+}
+
+/* Turns packet into one carrying only its adaptation field, stuffed up to
+ * the end of the packet. Its continuity counter must repeat the one of the
+ * previous packet with payload. */
+static void
+_write_adaptation_only (guint8 * out, const guint8 * packet, guint8 cc)
+{
+  gsize adaptation_len = MIN (packet[4], HWANGSAE_MPEGTS_PACKET_SIZE - 5);
+
+  out[0] = packet[0];
+  out[1] = packet[1] & ~0x40;
+  out[2] = packet[2];
+  out[3] = (packet[3] & 0xc0) | 0x20 | (cc & 0x0f);
+  out[4] = HWANGSAE_MPEGTS_PACKET_SIZE - 5;
+  memcpy (out + 5, packet + 5, adaptation_len);
+  memset (out + 5 + adaptation_len, 0xff,
+      HWANGSAE_MPEGTS_PACKET_SIZE - 5 - adaptation_len);
+}
+
+/* Copies the packets of data not set in drop_mask into out. Continuity
+ * counters of the given PID get shifted by cc_offset, which is updated for
+ * each dropped packet so that receivers don't see any discontinuity.
+ * Dropped packets of the PID carrying a PCR keep their adaptation field so
+ * that receivers don't lose their clock. */
+gsize
+hwangsae_mpegts_filter_packets (const guint8 * data, gsize len,
+    guint32 drop_mask, guint16 pid, guint8 * cc_offset, guint8 * out)
+{
+  gsize out_len = 0;
+  guint i;
+
+  for (i = 0; i * HWANGSAE_MPEGTS_PACKET_SIZE < len; ++i) {
+    const guint8 *packet = data + i * HWANGSAE_MPEGTS_PACKET_SIZE;
+    gboolean has_payload = (packet[3] & 0x10) != 0;
+    gboolean pid_match = hwangsae_mpegts_packet_pid (packet) == pid;
+
+    if (drop_mask & (1u << i)) {
+      if (pid_match && has_payload) {
+        --*cc_offset;
+      }
+      if (pid_match && _packet_has_pcr (packet)) {
+        _write_adaptation_only (out + out_len, packet,
+            packet[3] + *cc_offset);
+        out_len += HWANGSAE_MPEGTS_PACKET_SIZE;
+      }
+      continue;
+    }
+
+    memcpy (out + out_len, packet, HWANGSAE_MPEGTS_PACKET_SIZE);
+
+    if (pid_match && has_payload) {
+      out[out_len + 3] = (packet[3] & 0xf0) |
+          ((packet[3] + *cc_offset) & 0x0f);
+    }
+
+    out_len += HWANGSAE_MPEGTS_PACKET_SIZE;
+  }
+
+  return out_len;
+}
+
+#define NULL_PID                0x1fff
+/* PIDs below are reserved for PSI and SI tables */
+#define FIRST_ES_PID            0x0020
+#define FIRST_AGGREGATE_PID     0x0100
+
+/* Aggregate PATs go out at most this often, in place of input PATs */
+#define AGGREGATE_PAT_INTERVAL_US       (100 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct
+{
+  gboolean present;
+  /* PID of the input's PMT or 0 until its PAT came */
+  guint16 pmt_pid;
+  /* Input PID -> output PID or 0 when not yet assigned */
+  guint16 *pid_map;
+} AggregatedProgram;
+
+struct _HwangsaeMpegtsAggregator
+{
+  /* Inputs usually get remuxed from different threads */
+  GMutex lock;
+
+  AggregatedProgram programs[HWANGSAE_MPEGTS_MAX_PROGRAMS];
+  guint n_programs;
+  guint16 next_pid;
+
+  guint8 pat_cc;
+  guint8 pat_version;
+  gint64 last_pat_time;
+  /* Set when the programs changed, the next input PAT then gets replaced
+   * right away */
+  gboolean pat_changed;
+};
+
+static guint32
+_crc32_mpeg (const guint8 * data, gsize len)
+{
+  guint32 crc = 0xffffffff;
+
+  while (len--) {
+    guint i;
+
+    crc ^= (guint32) * data++ << 24;
+    for (i = 0; i != 8; ++i) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+static void
+_write_section_crc (guint8 * section, gsize section_len)
+{
+  _write_be32 (section + section_len - 4,
+      _crc32_mpeg (section, section_len - 4));
+}
+
+static void
+_write_pid (guint8 * dst, guint16 pid)
+{
+  dst[0] = (dst[0] & 0xe0) | (pid >> 8);
+  dst[1] = pid & 0xff;
+}
+
+HwangsaeMpegtsAggregator *
+hwangsae_mpegts_aggregator_new (guint n_programs)
+{
+  HwangsaeMpegtsAggregator *aggregator;
+  guint i;
+
+  g_return_val_if_fail (n_programs <= HWANGSAE_MPEGTS_MAX_PROGRAMS, NULL);
+
+  aggregator = g_new0 (HwangsaeMpegtsAggregator, 1);
+  g_mutex_init (&aggregator->lock);
+  aggregator->n_programs = n_programs;
+  aggregator->next_pid = FIRST_AGGREGATE_PID;
+  aggregator->pat_changed = TRUE;
+
+  for (i = 0; i != n_programs; ++i) {
+    aggregator->programs[i].present = TRUE;
+    aggregator->programs[i].pid_map = g_new0 (guint16, NULL_PID + 1);
+  }
+
+  return aggregator;
+}
+
+void
+hwangsae_mpegts_aggregator_free (HwangsaeMpegtsAggregator * aggregator)
+{
+  guint i;
+
+  for (i = 0; i != aggregator->n_programs; ++i) {
+    g_free (aggregator->programs[i].pid_map);
+  }
+
+  g_mutex_clear (&aggregator->lock);
+  g_free (aggregator);
+}
+
+/* Takes the program out of the PAT, which goes out with the next input
+ * packet. */
+void
+hwangsae_mpegts_aggregator_remove_program (HwangsaeMpegtsAggregator *
+    aggregator, guint program)
+{
+  g_return_if_fail (program < aggregator->n_programs);
+
+  g_mutex_lock (&aggregator->lock);
+  aggregator->programs[program].present = FALSE;
+  ++aggregator->pat_version;
+  aggregator->pat_changed = TRUE;
+  g_mutex_unlock (&aggregator->lock);
+}
+
+/* Returns the output PID of the input's PID or 0 once the output ran out of
+ * PIDs. */
+static guint16
+_map_pid (HwangsaeMpegtsAggregator * aggregator, AggregatedProgram * program,
+    guint16 pid)
+{
+  if (program->pid_map[pid] == 0 &&
+      aggregator->next_pid < HWANGSAE_MPEGTS_PROBE_PID) {
+    program->pid_map[pid] = aggregator->next_pid++;
+  }
+
+  return program->pid_map[pid];
+}
+
+/* Writes a single-packet PAT listing n_entries pairs of program number and
+ * PMT PID. */
+static void
+_write_pat (guint8 * packet, guint8 cc, guint16 transport_stream_id,
+    guint8 version, const guint16 * entries, guint n_entries)
+{
+  guint8 *section = packet + 5;
+  gsize section_len = 12 + 4 * n_entries;
+  guint i;
+
+  memset (packet, 0xff, HWANGSAE_MPEGTS_PACKET_SIZE);
+
+  packet[0] = HWANGSAE_MPEGTS_SYNC_BYTE;
+  packet[1] = 0x40;
+  packet[2] = PAT_PID;
+  packet[3] = 0x10 | (cc & 0x0f);
+  /* pointer_field */
+  packet[4] = 0;
+
+  section[0] = 0x00;
+  section[1] = 0xb0 | ((section_len - 3) >> 8);
+  section[2] = (section_len - 3) & 0xff;
+  section[3] = transport_stream_id >> 8;
+  section[4] = transport_stream_id & 0xff;
+  section[5] = 0xc1 | ((version & 0x1f) << 1);
+  section[6] = 0x00;
+  section[7] = 0x00;
+
+  for (i = 0; i != n_entries; ++i) {
+    guint8 *entry = section + 8 + 4 * i;
+
+    entry[0] = entries[2 * i] >> 8;
+    entry[1] = entries[2 * i] & 0xff;
+    entry[2] = 0xe0;
+    _write_pid (entry + 2, entries[2 * i + 1]);
+  }
+
+  _write_section_crc (section, section_len);
+}
+
+static void
+_write_aggregate_pat (HwangsaeMpegtsAggregator * aggregator, guint8 * packet)
+{
+  guint16 entries[2 * HWANGSAE_MPEGTS_MAX_PROGRAMS];
+  guint n_entries = 0;
+  guint i;
+
+  for (i = 0; i != aggregator->n_programs; ++i) {
+    AggregatedProgram *program = &aggregator->programs[i];
+    guint16 pmt_pid;
+
+    if (!program->present || program->pmt_pid == 0 ||
+        (pmt_pid = _map_pid (aggregator, program, program->pmt_pid)) == 0) {
+      continue;
+    }
+
+    entries[2 * n_entries] = i + 1;
+    entries[2 * n_entries + 1] = pmt_pid;
+    ++n_entries;
+  }
+
+  _write_pat (packet, aggregator->pat_cc++, 1, aggregator->pat_version,
+      entries, n_entries);
+}
+
+/* Moves the PCR and elementary stream PIDs of the PMT section in packet to
+ * the output's and numbers the program. */
+static gboolean
+_rewrite_pmt (HwangsaeMpegtsAggregator * aggregator, guint index,
+    guint8 * packet)
+{
+  AggregatedProgram *program = &aggregator->programs[index];
+  guint8 *section;
+  gsize section_len;
+  guint16 pid;
+  gsize i;
+
+  section = (guint8 *) _find_section (packet, 0x02, &section_len);
+  if (!section || section_len < 16) {
+    return FALSE;
+  }
+
+  section[3] = (index + 1) >> 8;
+  section[4] = (index + 1) & 0xff;
+
+  pid = ((section[8] & 0x1f) << 8) | section[9];
+  if (pid != NULL_PID) {
+    _write_pid (section + 8, _map_pid (aggregator, program, pid));
+  }
+
+  i = 12 + (((section[10] & 0x0f) << 8) | section[11]);
+
+  while (i + 5 <= section_len - 4) {
+    pid = ((section[i + 1] & 0x1f) << 8) | section[i + 2];
+    _write_pid (section + i + 1, _map_pid (aggregator, program, pid));
+
+    i += 5 + (((section[i + 3] & 0x0f) << 8) | section[i + 4]);
+  }
+
+  _write_section_crc (section, section_len);
+
+  return TRUE;
+}
+
+/* Copies the packets of one input into out with their PIDs moved to the
+ * program's and returns the bytes written, never more than len. The
+ * input's PAT packets get replaced by the aggregate PAT or dropped when it
+ * went out recently, its SI tables, null packets and probe markers get
+ * dropped as they'd clash with other programs'. PMTs must fit into one
+ * packet. */
+gsize
+hwangsae_mpegts_aggregator_remux (HwangsaeMpegtsAggregator * aggregator,
+    guint index, const guint8 * data, gsize len, gint64 now, guint8 * out)
+{
+  AggregatedProgram *program;
+  gsize out_len = 0;
+  gsize offset;
+
+  g_return_val_if_fail (index < aggregator->n_programs, 0);
+
+  program = &aggregator->programs[index];
+
+  g_mutex_lock (&aggregator->lock);
+
+  for (offset = 0; offset + HWANGSAE_MPEGTS_PACKET_SIZE <= len;
+      offset += HWANGSAE_MPEGTS_PACKET_SIZE) {
+    const guint8 *packet = data + offset;
+    guint8 *out_packet = out + out_len;
+    guint16 pid;
+    guint16 out_pid;
+
+    if (!hwangsae_mpegts_packet_is_valid (packet)) {
+      continue;
+    }
+
+    pid = hwangsae_mpegts_packet_pid (packet);
+
+    if (pid == PAT_PID) {
+      HwangsaeMpegtsScanner scanner = { 0 };
+
+      _parse_pat (&scanner, packet);
+      if (scanner.pmt_pid != 0 && scanner.pmt_pid != program->pmt_pid) {
+        program->pmt_pid = scanner.pmt_pid;
+        ++aggregator->pat_version;
+        aggregator->pat_changed = TRUE;
+      }
+
+      if (aggregator->pat_changed ||
+          now - aggregator->last_pat_time >= AGGREGATE_PAT_INTERVAL_US) {
+        _write_aggregate_pat (aggregator, out_packet);
+        aggregator->last_pat_time = now;
+        aggregator->pat_changed = FALSE;
+        out_len += HWANGSAE_MPEGTS_PACKET_SIZE;
+      }
+      continue;
+    }
+
+    if (pid < FIRST_ES_PID || pid == NULL_PID ||
+        pid == HWANGSAE_MPEGTS_PROBE_PID) {
+      continue;
+    }
+
+    out_pid = _map_pid (aggregator, program, pid);
+    if (out_pid == 0) {
+      continue;
+    }
+
+    memcpy (out_packet, packet, HWANGSAE_MPEGTS_PACKET_SIZE);
+    _write_pid (out_packet + 1, out_pid);
+
+    if (pid == program->pmt_pid && !_rewrite_pmt (aggregator, index,
+            out_packet)) {
+      continue;
+    }
+
+    out_len += HWANGSAE_MPEGTS_PACKET_SIZE;
+  }
+
+  g_mutex_unlock (&aggregator->lock);
+
+  return out_len;
+}
+
+/* PCR and elementary stream PIDs followed per split program */
+#define SPLIT_MAX_PROGRAM_PIDS  32
+
+typedef struct
+{
+  guint16 number;
+  guint16 pmt_pid;
+  guint16 pids[SPLIT_MAX_PROGRAM_PIDS];
+  guint n_pids;
+
+  /* PAT listing just this program, continuity counters get set on output */
+  guint8 pat[HWANGSAE_MPEGTS_PACKET_SIZE];
+
+  /* The program's packets of the last scanned buffer, gathered once it's
+   * asked for */
+  guint8 *out;
+  gsize out_len;
+  guint generation;
+} SplitProgram;
+
+struct _HwangsaeMpegtsSplitter
+{
+  SplitProgram programs[HWANGSAE_MPEGTS_MAX_PROGRAMS];
+  guint n_programs;
+  guint8 pat_version;
+  guint8 pat_cc;
+
+  /* Bit i set when the PID belongs to programs[i] */
+  guint32 pid_programs[NULL_PID + 1];
+
+  /* Last scanned buffer and its PAT packets, each of which gets replaced
+   * by the program's own */
+  const guint8 *data;
+  gsize len;
+  guint32 pat_mask;
+  guint8 first_pat_cc;
+  guint generation;
+};
+
+HwangsaeMpegtsSplitter *
+hwangsae_mpegts_splitter_new (void)
+{
+  return g_new0 (HwangsaeMpegtsSplitter, 1);
+}
+
+void
+hwangsae_mpegts_splitter_free (HwangsaeMpegtsSplitter * splitter)
+{
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (splitter->programs); ++i) {
+    g_free (splitter->programs[i].out);
+  }
+
+  g_free (splitter);
+}
+
+/* Starts following the programs over when the PAT lists different ones. */
+static void
+_split_parse_pat (HwangsaeMpegtsSplitter * splitter, const guint8 * packet)
+{
+  guint16 entries[2 * HWANGSAE_MPEGTS_MAX_PROGRAMS];
+  guint n_entries = 0;
+  guint16 transport_stream_id;
+  const guint8 *section;
+  gsize section_len;
+  gboolean changed;
+  gsize i;
+
+  section = _find_section (packet, 0x00, &section_len);
+  if (!section || section_len < 12) {
+    return;
+  }
+
+  for (i = 8; i + 4 <= section_len - 4 &&
+      n_entries != HWANGSAE_MPEGTS_MAX_PROGRAMS; i += 4) {
+    guint16 program_number = (section[i] << 8) | section[i + 1];
+
+    /* Program 0 points to the network information table. */
+    if (program_number != 0) {
+      entries[2 * n_entries] = program_number;
+      entries[2 * n_entries + 1] = ((section[i + 2] & 0x1f) << 8) |
+          section[i + 3];
+      ++n_entries;
+    }
+  }
+
+  changed = n_entries != splitter->n_programs;
+  for (i = 0; i != n_entries && !changed; ++i) {
+    changed = entries[2 * i] != splitter->programs[i].number ||
+        entries[2 * i + 1] != splitter->programs[i].pmt_pid;
+  }
+
+  if (!changed) {
+    return;
+  }
+
+  transport_stream_id = (section[3] << 8) | section[4];
+
+  memset (splitter->pid_programs, 0, sizeof (splitter->pid_programs));
+  splitter->n_programs = n_entries;
+  ++splitter->pat_version;
+
+  for (i = 0; i != n_entries; ++i) {
+    SplitProgram *program = &splitter->programs[i];
+
+    program->number = entries[2 * i];
+    program->pmt_pid = entries[2 * i + 1];
+    program->n_pids = 0;
+    program->generation = 0;
+
+    splitter->pid_programs[program->pmt_pid] |= 1u << i;
+
+    _write_pat (program->pat, 0, transport_stream_id, splitter->pat_version,
+        entries + 2 * i, 1);
+  }
+}
+
+static void
+_split_add_pid (HwangsaeMpegtsSplitter * splitter, guint index, guint16 pid)
+{
+  SplitProgram *program = &splitter->programs[index];
+
+  if (pid != NULL_PID && program->n_pids != SPLIT_MAX_PROGRAM_PIDS) {
+    program->pids[program->n_pids++] = pid;
+    splitter->pid_programs[pid] |= 1u << index;
+  }
+}
+
+static void
+_split_parse_pmt (HwangsaeMpegtsSplitter * splitter, guint index,
+    const guint8 * packet)
+{
+  SplitProgram *program = &splitter->programs[index];
+  const guint8 *section;
+  gsize section_len;
+  guint j;
+  gsize i;
+
+  section = _find_section (packet, 0x02, &section_len);
+  if (!section || section_len < 16 ||
+      ((section[3] << 8) | section[4]) != program->number) {
+    return;
+  }
+
+  for (j = 0; j != program->n_pids; ++j) {
+    splitter->pid_programs[program->pids[j]] &= ~(1u << index);
+  }
+  program->n_pids = 0;
+  splitter->pid_programs[program->pmt_pid] |= 1u << index;
+
+  _split_add_pid (splitter, index, ((section[8] & 0x1f) << 8) | section[9]);
+
+  i = 12 + (((section[10] & 0x0f) << 8) | section[11]);
+
+  while (i + 5 <= section_len - 4) {
+    _split_add_pid (splitter, index,
+        ((section[i + 1] & 0x1f) << 8) | section[i + 2]);
+
+    i += 5 + (((section[i + 3] & 0x0f) << 8) | section[i + 4]);
+  }
+}
+
+/* Follows the PAT and PMTs in the buffer and notes which program each
+ * packet belongs to. The buffer must stay around until its programs have
+ * been fetched with hwangsae_mpegts_splitter_get_program(). */
+gboolean
+hwangsae_mpegts_splitter_scan (HwangsaeMpegtsSplitter * splitter,
+    const guint8 * data, gsize len)
+{
+  guint i;
+
+  splitter->data = NULL;
+
+  if (len % HWANGSAE_MPEGTS_PACKET_SIZE != 0 ||
+      len / HWANGSAE_MPEGTS_PACKET_SIZE > 32) {
+    return FALSE;
+  }
+
+  splitter->data = data;
+  splitter->len = len;
+  splitter->pat_mask = 0;
+  splitter->first_pat_cc = splitter->pat_cc;
+  ++splitter->generation;
+
+  for (i = 0; i != len / HWANGSAE_MPEGTS_PACKET_SIZE; ++i) {
+    const guint8 *packet = data + i * HWANGSAE_MPEGTS_PACKET_SIZE;
+    guint16 pid;
+    guint j;
+
+    if (!hwangsae_mpegts_packet_is_valid (packet)) {
+      continue;
+    }
+
+    pid = hwangsae_mpegts_packet_pid (packet);
+
+    if (pid == PAT_PID) {
+      _split_parse_pat (splitter, packet);
+      splitter->pat_mask |= 1u << i;
+      ++splitter->pat_cc;
+      continue;
+    }
+
+    for (j = 0; j != splitter->n_programs; ++j) {
+      if (splitter->programs[j].pmt_pid == pid) {
+        _split_parse_pmt (splitter, j, packet);
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+/* Returns the packets of the program in the last scanned buffer, with its
+ * own PAT in place of the stream's, or NULL when there are none. The
+ * packets get gathered once per buffer, however many callers ask. */
+const guint8 *
+hwangsae_mpegts_splitter_get_program (HwangsaeMpegtsSplitter * splitter,
+    guint16 program_number, gsize * len)
+{
+  SplitProgram *program = NULL;
+  guint32 program_bit = 0;
+  guint8 pat_cc;
+  guint i;
+
+  if (!splitter->data) {
+    return NULL;
+  }
+
+  for (i = 0; i != splitter->n_programs && !program; ++i) {
+    if (splitter->programs[i].number == program_number) {
+      program = &splitter->programs[i];
+      program_bit = 1u << i;
+    }
+  }
+
+  if (!program) {
+    return NULL;
+  }
+
+  if (program->generation != splitter->generation) {
+    if (!program->out) {
+      program->out = g_malloc (HWANGSAE_MPEGTS_PACKET_SIZE * 32);
+    }
+
+    program->out_len = 0;
+    program->generation = splitter->generation;
+    pat_cc = splitter->first_pat_cc;
+
+    for (i = 0; i * HWANGSAE_MPEGTS_PACKET_SIZE < splitter->len; ++i) {
+      const guint8 *packet = splitter->data + i * HWANGSAE_MPEGTS_PACKET_SIZE;
+      guint8 *out_packet = program->out + program->out_len;
+      guint16 pid;
+
+      if (splitter->pat_mask & (1u << i)) {
+        memcpy (out_packet, program->pat, HWANGSAE_MPEGTS_PACKET_SIZE);
+        out_packet[3] = 0x10 | (pat_cc++ & 0x0f);
+        program->out_len += HWANGSAE_MPEGTS_PACKET_SIZE;
+        continue;
+      }
+
+      if (!hwangsae_mpegts_packet_is_valid (packet)) {
+        continue;
+      }
+
+      /* Latency probe markers concern all programs. */
+      pid = hwangsae_mpegts_packet_pid (packet);
+      if (pid != HWANGSAE_MPEGTS_PROBE_PID &&
+          !(splitter->pid_programs[pid] & program_bit)) {
+        continue;
+      }
+
+      memcpy (out_packet, packet, HWANGSAE_MPEGTS_PACKET_SIZE);
+      program->out_len += HWANGSAE_MPEGTS_PACKET_SIZE;
+    }
+  }
+
+  *len = program->out_len;
+
+  return program->out_len != 0 ? program->out : NULL;
+}
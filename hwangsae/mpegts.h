@@ -0,0 +1,152 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __HWANGSAE_MPEGTS_H__
+#define __HWANGSAE_MPEGTS_H__
+
+#if !defined(HWANGSAE_COMPILATION)
+#error "This is a private header of the Hwangsae library."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define HWANGSAE_MPEGTS_PACKET_SIZE     188
+#define HWANGSAE_MPEGTS_SYNC_BYTE       0x47
+
+/* PID of the private packets carrying latency probe markers. */
+#define HWANGSAE_MPEGTS_PROBE_PID       0x1ffa
+
+typedef struct
+{
+  guint32 seqnum;
+  /* Wall-clock times in microseconds since the Epoch or -1 when unset. */
+  gint64 edge_time;
+  gint64 relay_time;
+} HwangsaeProbeMarker;
+
+typedef enum
+{
+  HWANGSAE_FRAME_UNKNOWN,
+  HWANGSAE_FRAME_IDR,
+  HWANGSAE_FRAME_REFERENCE,
+  HWANGSAE_FRAME_NON_REFERENCE,
+} HwangsaeFrameType;
+
+/* Follows the PAT and PMT of a single-program transport stream to find its
+ * H.264 video and tells which kind of frame each video packet carries.
+ * Relies on each PES packet holding one access unit, as muxers produce it.
+ * Packets before the first slice of an access unit, e.g. ones carrying only
+ * SPS, PPS and SEI, are of an unknown frame while searching is set. */
+typedef struct
+{
+  guint16 pmt_pid;
+  guint16 video_pid;
+  HwangsaeFrameType frame;
+  gboolean searching;
+  /* Start code prefix bytes seen at the end of the last packet */
+  guint zeros;
+  gboolean nal_start;
+} HwangsaeMpegtsScanner;
+
+#define HWANGSAE_MPEGTS_MAX_PROGRAMS    32
+
+/* Remuxes several single-program transport streams into one multi-program
+ * stream without touching their payload. Each input becomes the program
+ * numbered after its index plus one, with its PIDs moved to ones no other
+ * input uses and a PAT listing all programs still present. */
+typedef struct _HwangsaeMpegtsAggregator HwangsaeMpegtsAggregator;
+
+/* Splits a multi-program transport stream into single-program streams,
+ * each with a PAT listing only the program and the PMT of the input. */
+typedef struct _HwangsaeMpegtsSplitter HwangsaeMpegtsSplitter;
+
+static inline guint16
+hwangsae_mpegts_packet_pid (const guint8 * packet)
+{
+  return ((packet[1] & 0x1f) << 8) | packet[2];
+}
+
+static inline gboolean
+hwangsae_mpegts_packet_is_valid (const guint8 * packet)
+{
+  return packet[0] == HWANGSAE_MPEGTS_SYNC_BYTE;
+}
+
+static inline gboolean
+hwangsae_mpegts_packet_has_unit_start (const guint8 * packet)
+{
+  return (packet[1] & 0x40) != 0;
+}
+
+void            hwangsae_mpegts_probe_write     (guint8 * packet,
+                                                 guint8 continuity_counter,
+                                                 const HwangsaeProbeMarker * marker);
+
+gboolean        hwangsae_mpegts_probe_read      (const guint8 * packet,
+                                                 HwangsaeProbeMarker * marker);
+
+gboolean        hwangsae_mpegts_probe_stamp_relay
+                                                (guint8 * packet,
+                                                 gint64 relay_time);
+
+HwangsaeFrameType
+                hwangsae_mpegts_scanner_push    (HwangsaeMpegtsScanner * scanner,
+                                                 const guint8 * packet);
+
+gsize           hwangsae_mpegts_filter_packets  (const guint8 * data,
+                                                 gsize len,
+                                                 guint32 drop_mask,
+                                                 guint16 pid,
+                                                 guint8 * cc_offset,
+                                                 guint8 * out);
+
+HwangsaeMpegtsAggregator *
+                hwangsae_mpegts_aggregator_new  (guint n_programs);
+
+void            hwangsae_mpegts_aggregator_free (HwangsaeMpegtsAggregator * aggregator);
+
+void            hwangsae_mpegts_aggregator_remove_program
+                                                (HwangsaeMpegtsAggregator * aggregator,
+                                                 guint program);
+
+gsize           hwangsae_mpegts_aggregator_remux
+                                                (HwangsaeMpegtsAggregator * aggregator,
+                                                 guint index,
+                                                 const guint8 * data,
+                                                 gsize len,
+                                                 gint64 now,
+                                                 guint8 * out);
+
+HwangsaeMpegtsSplitter *
+                hwangsae_mpegts_splitter_new    (void);
+
+void            hwangsae_mpegts_splitter_free   (HwangsaeMpegtsSplitter * splitter);
+
+gboolean        hwangsae_mpegts_splitter_scan   (HwangsaeMpegtsSplitter * splitter,
+                                                 const guint8 * data,
+                                                 gsize len);
+
+const guint8 *  hwangsae_mpegts_splitter_get_program
+                                                (HwangsaeMpegtsSplitter * splitter,
+                                                 guint16 program_number,
+                                                 gsize * len);
+
+G_END_DECLS
+
+#endif // __HWANGSAE_MPEGTS_H__
@@ -16,24 +16,339 @@
  *
  */
 
+#define _GNU_SOURCE
+
+#include "config.h"
+
 #include "relay.h"
+#include "mpegts.h"
+#include "stats-page.h"
+#include "transcoder.h"
+#include "udp-output.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <ifaddrs.h>
 #include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
 #include <srt/srt.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 5, 0)
+#define HAVE_SRT_GROUPS 1
+#endif
+
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 2)
+#define HAVE_SRT_REJECT_REASON 1
+#endif
 
 const guint32 SRT_BACKLOG_LEN = 100;
 const gint MAX_EPOLL_SRT_SOCKETS = 4000;
 const int64_t MAX_EPOLL_WAIT_TIMEOUT_MS = 100;
+/* How long encoded renditions may wait when the input pauses */
+const int64_t RENDITION_POLL_TIMEOUT_MS = 10;
 const gint SRT_POLL_EVENTS = SRT_EPOLL_IN | SRT_EPOLL_ERR;
+const gint64 PROBE_INTERVAL_US = 100 * G_TIME_SPAN_MILLISECOND;
+const gint64 PROBE_EDGE_TIMEOUT_US = G_TIME_SPAN_SECOND;
+const gsize MAX_GROUP_LINKS = 8;
+const gint64 RTT_SAMPLE_INTERVAL_US = G_TIME_SPAN_SECOND;
+const gint64 RTT_CACHE_TTL_US = 10 * G_TIME_SPAN_MINUTE;
+const gint64 IDLE_WHEEL_TICK_US = G_TIME_SPAN_SECOND;
+const gint64 THINNING_CHECK_INTERVAL_US = 20 * G_TIME_SPAN_MILLISECOND;
+const gint64 MEMORY_CHECK_INTERVAL_US = 100 * G_TIME_SPAN_MILLISECOND;
+const gint64 UTILIZATION_WINDOW_US = G_TIME_SPAN_SECOND;
+const gint64 STATS_PAGE_INTERVAL_US = 100 * G_TIME_SPAN_MILLISECOND;
+/* How long an idle sender sleeps before it looks at its streams again */
+const gint64 SENDER_IDLE_WAIT_US = 100 * G_TIME_SPAN_MILLISECOND;
+/* How long a client let through by the listener callback counts towards
+ * its port's load while srt_accept() hasn't returned it */
+const gint64 HANDSHAKE_TIMEOUT_US = 5 * G_TIME_SPAN_SECOND;
+
+#define IDLE_WHEEL_SLOTS 64
+#define SEND_RING_SLOTS 256
+
+/* Polls the listeners and sinks of one bind address from its own thread,
+ * which may be pinned to the CPUs close to the address's NIC. */
+typedef struct _Worker
+{
+  HwangsaeRelay *relay;
+  guint index;
+  gchar *address;
+  /* List of CPUs like "0-3,8" or NULL */
+  gchar *cpus;
+  int poll_id;
+  GThread *thread;
+  /* Kernel ID of the thread or 0 until it starts */
+  gint tid;
+  /* CPU the thread last ran on or -1 */
+  gint cpu;
+  /* Worker of the same address that owns its listeners, maybe itself */
+  struct _Worker *primary;
+  guint n_sinks;
+  /* Microseconds spent forwarding, in total and since the last rebalance */
+  guint64 busy_time;
+  guint64 load;
+
+  /* Percentage of the last UTILIZATION_WINDOW_US the thread spent outside
+   * of epoll wait */
+  gint utilization;
+  gint64 window_start_time;
+  gint64 window_wait_time;
+  /* Smoothed microseconds from reading a packet to having sent it to all
+   * subscribers, and when it was last sampled. Halves every window without
+   * a sample so that a worker gone idle stops counting as saturated. */
+  gint fanout_lag;
+  gint64 fanout_lag_time;
+} Worker;
+
+/* Each port gets served by its own libsrt multiplexer, i.e. its own receive
+ * and send threads. */
+typedef struct
+{
+  HwangsaeRelay *relay;
+  Worker *worker;
+  SRTSOCKET socket;
+  guint port;
+  /* Open connections accepted through this listener */
+  guint n_connections;
+  /* Handshakes in progress, mapping sockets to the time they expire */
+  GHashTable *handshakes;
+} Listener;
+
+typedef enum
+{
+  THINNING_NONE,
+  /* Drops H.264 frames nothing else refers to */
+  THINNING_NON_REFERENCE,
+  /* Keeps only IDR frames, the picture updates once per GOP */
+  THINNING_KEYFRAMES,
+} ThinningLevel;
+
+/* Subscribers declare their class with c= in the Stream ID. Higher classes
+ * get served first and suffer last when the relay is overloaded. */
+typedef enum
+{
+  SUBSCRIBER_CLASS_PUBLIC,
+  SUBSCRIBER_CLASS_OPERATOR,
+  /* Never thinned nor shed */
+  SUBSCRIBER_CLASS_RECORDER,
+} SubscriberClass;
+
+static const gchar *SUBSCRIBER_CLASS_NAMES[] = {
+  "public", "operator", "recorder"
+};
+
+/* Steps of load shedding the relay takes, in this order, when its memory
+ * use exceeds the budget. */
+typedef enum
+{
+  MEMORY_PRESSURE_NONE,
+  /* Transcoders stop taking input until their queues drain */
+  MEMORY_PRESSURE_TRIM,
+  /* Subscribers with the largest send backlogs get dropped */
+  MEMORY_PRESSURE_SHED,
+  /* New publishers and subscribers get refused */
+  MEMORY_PRESSURE_REFUSE,
+} MemoryPressure;
+
+/* Connection of a subscriber that asked for several streams at once with
+ * r=stream1+stream2+... Each stream gets a member SourceConnection that
+ * remuxes its packets into the connection's multi-program stream. */
+typedef struct
+{
+  SRTSOCKET socket;
+  Listener *listener;
+  HwangsaeMpegtsAggregator *aggregator;
+  /* The first member accounts for the connection's send backlog */
+  GSList *members;
+} Aggregate;
+
+typedef struct
+{
+  SRTSOCKET socket;
+  gchar *peer;
+  Listener *listener;
+  /* Rendition of the transcoding ladder or NULL for the original stream */
+  gchar *rendition;
+  SubscriberClass subscriber_class;
+
+  ThinningLevel thinning_level;
+  /* Level the send buffer calls for, it replaces thinning_level at the next
+   * access unit, or at the next IDR frame when leaving THINNING_KEYFRAMES */
+  ThinningLevel next_thinning_level;
+  gint64 last_thinning_check;
+  guint64 packets_thinned;
+  /* Shift of the video PID's continuity counters hiding dropped packets */
+  guint8 video_cc_offset;
+
+  /* Bytes in the send buffer at the last memory check */
+  guint64 backlog_bytes;
+
+  /* Set by a sender thread when the connection broke, housekeeping then
+   * removes the source */
+  gint lost;
+
+  /* Set for members of an aggregate, together with their stream and their
+   * program's index */
+  Aggregate *aggregate;
+  struct _SinkConnection *sink;
+  guint program;
+
+  /* Program of a multi-program stream picked with r=stream/progN or 0 for
+   * the whole stream */
+  guint16 program_number;
+} SourceConnection;
+
+/* Counters are updated with atomic operations so that they can be read
+ * without holding the relay lock. */
+typedef struct
+{
+  gchar *name;
+  gint streams;
+  gint subscribers;
+  guint64 bytes_in;
+  guint64 bytes_out;
+} UserAccount;
+
+#define USER_ACCOUNT_ADD_BYTES(counter, n) \
+  __atomic_add_fetch (&(counter), (n), __ATOMIC_RELAXED)
 
 typedef struct
 {
+  gdouble rtt;
+  gint64 update_time;
+} PeerRtt;
+
+typedef struct _SinkConnection
+{
+  /* Held by the worker while it receives from the stream. Changes to what
+   * it fans the stream out to take it under the relay lock, see
+   * _sink_lock(). */
+  GMutex lock;
+
+  /* Group ID when the publisher is bonding several links */
   SRTSOCKET socket;
+  gboolean bonded;
+  gchar *stream;
+  UserAccount *user;
+  Listener *listener;
+  Worker *worker;
   GSList *sources;
+  guint n_sources;
+
+  HwangsaeUdpOutput *udp_output;
+  /* Started once the first subscriber asks for a rendition and stopped
+   * when the last one leaves */
+  HwangsaeTranscoder *transcoder;
+  guint n_rendition_sources;
+  /* Set while the transcoder is being started */
+  struct _TranscoderJob *transcoder_job;
+
+  HwangsaeMpegtsScanner scanner;
+  /* Created for the first subscriber of a single program */
+  HwangsaeMpegtsSplitter *splitter;
+
+  /* Updated with atomic operations by the worker */
+  gint64 last_activity;
+  /* Position in the idle timer wheel */
+  GList *wheel_link;
+  guint wheel_slot;
+
+  guint8 probe_cc;
+  guint32 probe_seqnum;
+  gint64 last_probe_time;
+  gint64 last_edge_probe_time;
+
+  /* Microseconds spent forwarding the stream, in total and at the last
+   * rebalance, the total is updated with atomic operations */
+  guint64 forward_time;
+  guint64 balanced_forward_time;
+
+  /* Bytes queued for the stream at the last memory check */
+  guint64 memory_usage;
+  gboolean over_memory_limit;
+
+  /* Packets waiting for the sender thread or NULL when the worker sends */
+  struct _SendRing *ring;
+
+  /* Updated with atomic operations, sender threads count bytes_out */
+  guint64 bytes_in;
+  guint64 bytes_out;
 } SinkConnection;
 
+/* Transcoders get built and torn down in a thread of their own, changing
+ * their pipelines' state takes too long for the relay's threads. A job
+ * with a ladder starts a transcoder for its stream, one without frees the
+ * transcoder it got handed. */
+typedef struct _TranscoderJob
+{
+  /* Cleared under the relay lock once the stream no longer wants the
+   * transcoder */
+  SinkConnection *sink;
+  gchar *stream;
+  gchar *ladder;
+  HwangsaeTranscoder *transcoder;
+} TranscoderJob;
+
+/* Fans the streams assigned to it out to their subscribers, so that the
+ * workers only have to receive. */
+typedef struct
+{
+  HwangsaeRelay *relay;
+  guint index;
+  GThread *thread;
+  gint running;
+
+  /* Guards rings and lets the thread sleep while all of them are empty */
+  GMutex lock;
+  GCond cond;
+  GPtrArray *rings;
+  gint sleeping;
+
+  /* Smoothed microseconds from reading a packet to having sent it to all
+   * subscribers */
+  gint fanout_lag;
+} Sender;
+
+typedef struct
+{
+  gint64 recv_time;
+  gint len;
+  /* As large as the workers' receive buffer */
+  gchar data[1400];
+} SendSlot;
+
+/* Single-producer single-consumer queue of a stream's packets. The
+ * stream's worker advances head, its sender advances tail, neither waits
+ * for the other. */
+typedef struct _SendRing
+{
+  gint ref_count;
+  Sender *sender;
+
+  /* Held during fan-out and while the stream's subscribers change */
+  GMutex lock;
+  /* NULL once the stream is gone */
+  SinkConnection *sink;
+
+  gint head;
+  gint tail;
+  /* Times the worker found the ring full and left data in the socket */
+  guint64 stalls;
+  /* Set while the stream's socket is out of its worker's epoll because the
+   * ring is full, whoever clears it puts the socket back */
+  gint paused;
+
+  SendSlot slots[SEND_RING_SLOTS];
+} SendRing;
+
 struct _HwangsaeRelay
 {
   GObject parent;
@@ -44,17 +359,126 @@ struct _HwangsaeRelay
 
   guint sink_port;
   guint source_port;
+  guint sink_port_count;
+  guint source_port_count;
+  GStrv bind_addresses;
+  gchar *worker_cpus;
+  gint worker_nice;
+  guint worker_rt_priority;
+  guint workers_per_address;
+  guint rebalance_interval;
+  gint64 next_rebalance_time;
+  guint64 streams_moved;
 
   gchar *sink_uri;
 
-  SRTSOCKET sink_listen_sock;
-  SRTSOCKET source_listen_sock;
+  GPtrArray *workers;
+  GPtrArray *sink_listeners;
+  GPtrArray *source_listeners;
 
-  SinkConnection *sink;
-  int poll_id;
+  /* stream -> SinkConnection */
+  GHashTable *sinks;
+  /* SRTSOCKET -> SinkConnection */
+  GHashTable *sink_sockets;
+
+  GVariant *stream_passphrases;
+  /* stream -> passphrase */
+  GHashTable *passphrases;
+  gint pbkeylen;
+
+  GVariant *class_tokens;
+  /* subscriber class name -> token */
+  GHashTable *privileged_tokens;
+
+  /* username -> UserAccount */
+  GHashTable *users;
+  guint max_streams_per_user;
+  guint max_subscribers_per_user;
+
+  guint max_subscribers;
+  guint max_subscribers_per_stream;
+  guint n_sources;
+  GStrv alternate_relays;
+  guint next_alternate_relay;
+
+  /* Max packets to read from a sink before serving the next one */
+  guint recv_budget;
+
+  /* Packets in a source's send buffer at which frames start to get dropped */
+  guint thinning_threshold;
+
+  /* Limits of the data queued in the whole relay and per stream, in KiB */
+  guint memory_budget;
+  guint stream_memory_limit;
+  MemoryPressure memory_pressure;
+  guint64 memory_usage;
+  gint64 next_memory_check_time;
+  guint64 subscribers_shed;
+  guint64 connections_refused;
+
+  /* Load of a worker above which it takes no more subscribers */
+  guint max_utilization;
+  guint max_fanout_lag;
+
+  /* Set by hwangsae_relay_drain(), the relay then takes no new connections
+   * and reports when its subscribers are gone or drain_deadline passed */
+  gboolean draining;
+  gboolean drained;
+  gint64 drain_start;
+  gint64 drain_deadline;
+  /* Publishers and subscribers connected when draining started */
+  guint drain_connections;
+  GMainContext *drain_context;
+
+  /* Threads sending to subscribers, NULL when the workers send */
+  guint sender_threads;
+  GPtrArray *senders;
+  /* Broken subscriber connections the senders left to housekeeping */
+  gint lost_sources;
+
+  gchar *stats_file;
+  HwangsaeStatsPage *stats_page;
+  gint64 next_stats_page_time;
+
+  /* Timer wheel of sinks to check for inactivity. Each slot covers
+   * IDLE_WHEEL_TICK_US and holds the sinks whose deadline falls into it. */
+  guint idle_timeout;
+  GList *idle_wheel[IDLE_WHEEL_SLOTS];
+  gint64 idle_wheel_tick;
+  guint64 idle_sinks_reaped;
+
+  gboolean adaptive_latency;
+  gdouble latency_rtt_multiplier;
+  guint latency_min;
+  guint latency_max;
+  /* peer address -> PeerRtt */
+  GHashTable *peer_rtts;
+  gint64 last_rtt_sample_time;
+
+  GVariant *stream_packet_filters;
+  /* stream -> SRTO_PACKETFILTER configuration */
+  GHashTable *packet_filters;
+
+  GVariant *stream_udp_outputs;
+  /* stream -> comma-separated list of UDP destinations */
+  GHashTable *udp_outputs;
+  guint multicast_ttl;
+  gchar *multicast_interface;
+
+  GVariant *stream_renditions;
+  /* stream -> rendition ladder */
+  GHashTable *renditions;
+  guint n_transcoders;
+  GThreadPool *transcoder_pool;
 
-  GThread *relay_thread;
   gboolean run_relay_thread;
+
+  gboolean latency_probe;
+  guint64 residence_samples;
+  guint64 residence_sum;
+  guint64 residence_max;
+  guint64 probes_injected;
+  guint64 probes_stamped;
 };
 
 static guint hwangsae_relay_init_refcnt = 0;
@@ -70,9 +494,52 @@ enum
 {
   PROP_SINK_PORT = 1,
   PROP_SOURCE_PORT,
+  PROP_SINK_PORT_COUNT,
+  PROP_SOURCE_PORT_COUNT,
+  PROP_BIND_ADDRESSES,
+  PROP_WORKER_CPUS,
+  PROP_WORKER_NICE,
+  PROP_WORKER_RT_PRIORITY,
+  PROP_WORKERS_PER_ADDRESS,
+  PROP_REBALANCE_INTERVAL,
+  PROP_LATENCY_PROBE,
+  PROP_STREAM_PASSPHRASES,
+  PROP_PBKEYLEN,
+  PROP_STREAM_PACKET_FILTERS,
+  PROP_STREAM_UDP_OUTPUTS,
+  PROP_MULTICAST_TTL,
+  PROP_MULTICAST_INTERFACE,
+  PROP_STREAM_RENDITIONS,
+  PROP_ADAPTIVE_LATENCY,
+  PROP_LATENCY_RTT_MULTIPLIER,
+  PROP_LATENCY_MIN,
+  PROP_LATENCY_MAX,
+  PROP_MAX_STREAMS_PER_USER,
+  PROP_MAX_SUBSCRIBERS_PER_USER,
+  PROP_MAX_SUBSCRIBERS,
+  PROP_MAX_SUBSCRIBERS_PER_STREAM,
+  PROP_ALTERNATE_RELAYS,
+  PROP_IDLE_TIMEOUT,
+  PROP_RECV_BUDGET,
+  PROP_THINNING_THRESHOLD,
+  PROP_MEMORY_BUDGET,
+  PROP_STREAM_MEMORY_LIMIT,
+  PROP_MAX_UTILIZATION,
+  PROP_MAX_FANOUT_LAG,
+  PROP_SENDER_THREADS,
+  PROP_STATS_FILE,
+  PROP_CLASS_TOKENS,
   PROP_LAST
 };
 
+enum
+{
+  DRAINED_SIGNAL,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
 typedef struct
 {
   const gchar *name;
@@ -89,340 +556,4012 @@ static SrtParam srt_params[] = {
   {NULL, -1, -1},
 };
 
-static void
-hwangsae_relay_remove_source (HwangsaeRelay * self, SRTSOCKET sink_socket,
-    SRTSOCKET source_socket)
+static SendRing *
+_send_ring_ref (SendRing * ring)
 {
-  g_assert (self->sink && sink_socket == self->sink->socket);
+  g_atomic_int_inc (&ring->ref_count);
 
-  g_debug ("Closing source connection %d", source_socket);
-
-  self->sink->sources = g_slist_remove (self->sink->sources,
-      GINT_TO_POINTER (source_socket));
-  srt_close (source_socket);
+  return ring;
 }
 
 static void
-hwangsae_relay_remove_sink (HwangsaeRelay * self, SRTSOCKET sink_socket)
+_send_ring_unref (SendRing * ring)
+{
+  if (g_atomic_int_dec_and_test (&ring->ref_count)) {
+    g_mutex_clear (&ring->lock);
+    g_free (ring);
+  }
+}
+
+/* One reference belongs to the sink, the other to the sender. */
+static SendRing *
+_send_ring_new (SinkConnection * sink, Sender * sender)
 {
-  g_assert (self->sink && sink_socket == self->sink->socket);
+  SendRing *ring = g_new0 (SendRing, 1);
 
-  g_debug ("Closing sink connection %d", sink_socket);
+  ring->ref_count = 2;
+  ring->sender = sender;
+  ring->sink = sink;
+  g_mutex_init (&ring->lock);
 
-  while (self->sink->sources) {
-    hwangsae_relay_remove_source (self, self->sink->socket,
-        GPOINTER_TO_INT (self->sink->sources->data));
-  }
+  g_mutex_lock (&sender->lock);
+  g_ptr_array_add (sender->rings, ring);
+  g_mutex_unlock (&sender->lock);
 
-  srt_close (self->sink->socket);
-  g_clear_pointer (&self->sink, g_free);
+  return ring;
 }
 
 static void
-hwangsae_relay_finalize (GObject * object)
+_send_ring_detach (SendRing * ring)
 {
-  HwangsaeRelay *self = HWANGSAE_RELAY (object);
-
-  self->run_relay_thread = FALSE;
-  g_clear_pointer (&self->relay_thread, g_thread_join);
+  Sender *sender = ring->sender;
 
-  g_mutex_clear (&self->lock);
-
-  g_clear_pointer (&self->sink_uri, g_free);
+  g_mutex_lock (&ring->lock);
+  ring->sink = NULL;
+  g_mutex_unlock (&ring->lock);
 
-  srt_close (self->sink_listen_sock);
-  srt_close (self->source_listen_sock);
+  g_mutex_lock (&sender->lock);
+  g_ptr_array_remove_fast (sender->rings, ring);
+  g_mutex_unlock (&sender->lock);
 
-  if (self->sink) {
-    hwangsae_relay_remove_sink (self, self->sink->socket);
-  }
+  _send_ring_unref (ring);
+}
 
-  g_clear_handle_id (&self->poll_id, srt_epoll_release);
-  g_clear_object (&self->settings);
+static guint
+_send_ring_count (SendRing * ring)
+{
+  return (guint) g_atomic_int_get (&ring->head) -
+      (guint) g_atomic_int_get (&ring->tail);
+}
 
-  if (g_atomic_int_dec_and_test (&hwangsae_relay_init_refcnt)) {
-    g_debug ("Cleaning up SRT");
-    srt_cleanup ();
+/* Returns the slot for the next packet or NULL when the ring is full. */
+static SendSlot *
+_send_ring_reserve (SendRing * ring)
+{
+  if (_send_ring_count (ring) == SEND_RING_SLOTS) {
+    return NULL;
   }
 
-  G_OBJECT_CLASS (hwangsae_relay_parent_class)->finalize (object);
+  return &ring->slots[(guint) ring->head % SEND_RING_SLOTS];
 }
 
 static void
-hwangsae_relay_set_property (GObject * object, guint prop_id,
-    const GValue * value, GParamSpec * pspec)
+_send_ring_commit (SendRing * ring)
 {
-  HwangsaeRelay *self = HWANGSAE_RELAY (object);
+  Sender *sender = ring->sender;
 
-  switch (prop_id) {
-    case PROP_SINK_PORT:
-      self->sink_port = g_value_get_uint (value);
-      break;
-    case PROP_SOURCE_PORT:
-      self->source_port = g_value_get_uint (value);
-      break;
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  g_atomic_int_inc (&ring->head);
+
+  /* The sender sets sleeping before it checks the rings a last time, so
+   * either it sees the new packet or we see it's going to sleep. */
+  if (g_atomic_int_get (&sender->sleeping)) {
+    g_mutex_lock (&sender->lock);
+    g_cond_signal (&sender->cond);
+    g_mutex_unlock (&sender->lock);
   }
 }
 
 static void
-hwangsae_relay_get_property (GObject * object, guint prop_id,
-    GValue * value, GParamSpec * pspec)
+_send_ring_resume (SendRing * ring, SinkConnection * sink)
 {
-  HwangsaeRelay *self = HWANGSAE_RELAY (object);
-  switch (prop_id) {
-    case PROP_SINK_PORT:
-      g_value_set_uint (value, self->sink_port);
-      break;
-    case PROP_SOURCE_PORT:
-      g_value_set_uint (value, self->source_port);
-      break;
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  if (g_atomic_int_compare_and_exchange (&ring->paused, TRUE, FALSE)) {
+    srt_epoll_add_usock (sink->worker->poll_id, sink->socket,
+        &SRT_POLL_EVENTS);
   }
 }
 
+/* Stops polling the stream's socket until the sender makes room in the
+ * ring, its level-triggered epoll would otherwise keep reporting the data
+ * the worker can't take. */
 static void
-_apply_socket_options (SRTSOCKET sock)
+_send_ring_pause (SendRing * ring, SinkConnection * sink)
 {
-  SrtParam *params = srt_params;
+  srt_epoll_remove_usock (sink->worker->poll_id, sink->socket);
+  g_atomic_int_set (&ring->paused, TRUE);
 
-  for (; params->name != NULL; params++) {
-    if (srt_setsockflag (sock, params->param, &params->val, sizeof (gint))) {
-      g_error ("%s", srt_getlasterror_str ());
-    }
+  /* The sender may have drained the ring before it could see the flag. */
+  if (_send_ring_count (ring) != SEND_RING_SLOTS) {
+    _send_ring_resume (ring, sink);
   }
 }
 
-static SRTSOCKET
-_srt_open_listen_sock (guint port)
+static gboolean
+_send_ring_push (SendRing * ring, const guint8 * data, gint len,
+    gint64 recv_time)
 {
-  g_autoptr (GSocketAddress) sockaddr = NULL;
-  g_autoptr (GError) error = NULL;
+  SendSlot *slot = _send_ring_reserve (ring);
 
-  SRTSOCKET listen_sock;
-  gsize sockaddr_len;
-  gpointer sa;
-
-  g_debug ("Opening SRT listener (port: %" G_GUINT32_FORMAT ")", port);
+  if (!slot) {
+    return FALSE;
+  }
 
-  /* FIXME: use user-defined bind address */
-  sockaddr = g_inet_socket_address_new_from_string ("0.0.0.0", port);
-  sockaddr_len = g_socket_address_get_native_size (sockaddr);
+  memcpy (slot->data, data, len);
+  slot->len = len;
+  slot->recv_time = recv_time;
+  _send_ring_commit (ring);
 
-  sa = g_alloca (sockaddr_len);
+  return TRUE;
+}
 
-  if (!g_socket_address_to_native (sockaddr, sa, sockaddr_len, &error)) {
-    goto failed;
-  }
+/* The connection stays open until the aggregate loses its last member. */
+static void
+_remove_aggregate_member (HwangsaeRelay * self, SourceConnection * source)
+{
+  Aggregate *aggregate = source->aggregate;
 
-  listen_sock = srt_socket (AF_INET, SOCK_DGRAM, 0);
-  _apply_socket_options (listen_sock);
+  hwangsae_mpegts_aggregator_remove_program (aggregate->aggregator,
+      source->program);
+  aggregate->members = g_slist_remove (aggregate->members, source);
 
-  if (srt_bind (listen_sock, sa, sockaddr_len) == SRT_ERROR) {
-    goto srt_failed;
+  if (aggregate->members) {
+    return;
   }
 
-  if (srt_listen (listen_sock, SRT_BACKLOG_LEN) == SRT_ERROR) {
-    goto srt_failed;
-  }
+  g_debug ("Closing aggregate connection %d", aggregate->socket);
 
-  return listen_sock;
+  srt_close (aggregate->socket);
 
-srt_failed:
-  g_error ("%s", srt_getlasterror_str ());
+  --self->n_sources;
+  --aggregate->listener->n_connections;
 
-  if (listen_sock != SRT_INVALID_SOCK) {
-    srt_close (listen_sock);
-  }
+  hwangsae_mpegts_aggregator_free (aggregate->aggregator);
+  g_free (aggregate);
+}
 
-failed:
-  if (error != NULL) {
-    g_error ("%s", error->message);
+/* Taken under the relay lock to change a stream's subscribers, transcoder
+ * or worker. Waits for its worker to finish the current receive batch and
+ * for its sender thread, if any, to finish fanning out. */
+static void
+_sink_lock (SinkConnection * sink)
+{
+  g_mutex_lock (&sink->lock);
+  if (sink->ring) {
+    g_mutex_lock (&sink->ring->lock);
   }
-
-  return SRT_INVALID_SOCK;
 }
 
 static void
-hwangsae_relay_class_init (HwangsaeRelayClass * klass)
+_sink_unlock (SinkConnection * sink)
 {
-  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
-
-  gobject_class->set_property = hwangsae_relay_set_property;
-  gobject_class->get_property = hwangsae_relay_get_property;
-  gobject_class->finalize = hwangsae_relay_finalize;
-
-  g_object_class_install_property (gobject_class, PROP_SINK_PORT,
-      g_param_spec_uint ("sink-port", "SRT Binding port (from) ",
-          "SRT Binding port (from)", 0, G_MAXUINT, 8888,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  if (sink->ring) {
+    g_mutex_unlock (&sink->ring->lock);
+  }
+  g_mutex_unlock (&sink->lock);
+}
 
-  g_object_class_install_property (gobject_class, PROP_SOURCE_PORT,
-      g_param_spec_uint ("source-port", "SRT Binding port (to) ",
-          "SRT Binding port (to)", 0, G_MAXUINT, 9999,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+/* Leaves the subscriber to housekeeping to be removed. */
+static void
+_mark_source_lost (HwangsaeRelay * self, SourceConnection * source)
+{
+  if (!g_atomic_int_get (&source->lost)) {
+    g_atomic_int_set (&source->lost, TRUE);
+    g_atomic_int_inc (&self->lost_sources);
+  }
 }
 
 static void
-_parse_stream_id (const gchar * stream_id, gchar ** username, gchar ** resource)
+_publish_transcoder (HwangsaeRelay * self, TranscoderJob * job)
 {
-  const gchar STREAM_ID_PREFIX[] = "#!::";
-  gchar **keys;
-  gchar **it;
+  SinkConnection *sink;
+  GSList *it;
 
-  if (!g_str_has_prefix (stream_id, STREAM_ID_PREFIX)) {
-    return;
-  }
+  LOCK_RELAY;
 
-  if (username) {
-    *username = NULL;
-  }
-  if (resource) {
-    *resource = NULL;
+  sink = job->sink;
+  if (!sink) {
+    return;
   }
 
-  keys = g_strsplit (stream_id + sizeof (STREAM_ID_PREFIX) - 1, ",", -1);
-  for (it = keys; *it; ++it) {
-    gchar **keyval;
+  sink->transcoder_job = NULL;
 
-    keyval = g_strsplit (*it, "=", 2);
+  if (!job->transcoder) {
+    for (it = sink->sources; it; it = it->next) {
+      SourceConnection *source = it->data;
 
-    if (keyval && keyval[0] && keyval[1]) {
-      if (g_str_equal (keyval[0], "u") && username) {
-        g_clear_pointer (username, g_free);
-        *username = g_strdup (keyval[1]);
-      } else if (g_str_equal (keyval[0], "r") && resource) {
-        g_clear_pointer (resource, g_free);
-        *resource = g_strdup (keyval[1]);
+      if (source->rendition) {
+        _mark_source_lost (self, source);
       }
     }
-
-    g_strfreev (keyval);
+    return;
   }
 
-  g_strfreev (keys);
+  _sink_lock (sink);
+  sink->transcoder = g_steal_pointer (&job->transcoder);
+  _sink_unlock (sink);
+
+  ++self->n_transcoders;
+
+  g_debug ("Started transcoding stream %s", sink->stream);
 }
 
-static gint
-hwangsae_relay_accept_sink (HwangsaeRelay * self, SRTSOCKET sock,
-    gint hs_version, const struct sockaddr *peeraddr, const gchar * stream_id)
+static void
+_transcoder_job_run (gpointer data, gpointer user_data)
 {
-  g_autofree gchar *username = NULL;
+  TranscoderJob *job = data;
+  HwangsaeRelay *self = user_data;
+  g_autoptr (GError) error = NULL;
 
-  LOCK_RELAY;
+  if (job->ladder) {
+    job->transcoder = hwangsae_transcoder_new (job->ladder, &error);
+    if (!job->transcoder) {
+      g_warning ("Couldn't start transcoding stream %s: %s", job->stream,
+          error->message);
+    }
 
-  if (self->sink) {
-    // We already have a sink connected.
-    return -1;
+    _publish_transcoder (self, job);
   }
 
-  _parse_stream_id (stream_id, &username, NULL);
-  if (!username) {
-    // Sink socket must have username in its Stream ID.
-    return -1;
+  /* Either stopping or no longer wanted */
+  if (job->transcoder) {
+    hwangsae_transcoder_free (job->transcoder);
+    g_debug ("Stopped transcoding stream %s", job->stream);
   }
 
-  g_debug ("Accepting sink %d username: %s", sock, username);
-
-  self->sink = g_new0 (SinkConnection, 1);
-  self->sink->socket = sock;
-  srt_epoll_add_usock (self->poll_id, sock, &SRT_POLL_EVENTS);
-
-  return 0;
+  g_free (job->stream);
+  g_free (job->ladder);
+  g_free (job);
 }
 
-static gint
-hwangsae_relay_accept_source (HwangsaeRelay * self, SRTSOCKET sock,
-    gint hs_version, const struct sockaddr *peeraddr, const gchar * stream_id)
+static void
+_stop_transcoder (HwangsaeRelay * self, SinkConnection * sink)
 {
-  LOCK_RELAY;
+  TranscoderJob *job;
 
-  if (!self->sink) {
-    // We have no sink.
-    return -1;
+  /* A transcoder still starting gets stopped by its job. */
+  if (sink->transcoder_job) {
+    sink->transcoder_job->sink = NULL;
+    sink->transcoder_job = NULL;
+    return;
   }
 
-  g_debug ("Accepting source %d", sock);
+  job = g_new0 (TranscoderJob, 1);
+  job->stream = g_strdup (sink->stream);
 
-  self->sink->sources = g_slist_append (self->sink->sources,
-      GINT_TO_POINTER (sock));
+  _sink_lock (sink);
+  job->transcoder = g_steal_pointer (&sink->transcoder);
+  _sink_unlock (sink);
+
+  if (!job->transcoder) {
+    g_free (job->stream);
+    g_free (job);
+    return;
+  }
+
+  --self->n_transcoders;
+
+  if (self->transcoder_pool) {
+    g_thread_pool_push (self->transcoder_pool, job, NULL);
+  } else {
+    _transcoder_job_run (job, self);
+  }
+}
+
+static void
+hwangsae_relay_remove_source (HwangsaeRelay * self, SinkConnection * sink,
+    SourceConnection * source)
+{
+  if (source->aggregate) {
+    g_debug ("Removing %s from aggregate connection %d", sink->stream,
+        source->socket);
+  } else {
+    g_debug ("Closing source connection %d", source->socket);
+  }
+
+  _sink_lock (sink);
+  sink->sources = g_slist_remove (sink->sources, source);
+  _sink_unlock (sink);
+
+  g_atomic_int_add (&sink->user->subscribers, -1);
+  --sink->n_sources;
+
+  if (source->rendition && --sink->n_rendition_sources == 0) {
+    _stop_transcoder (self, sink);
+  }
+
+  if (source->aggregate) {
+    _remove_aggregate_member (self, source);
+  } else {
+    srt_close (source->socket);
+
+    --self->n_sources;
+    --source->listener->n_connections;
+  }
+
+  g_free (source->peer);
+  g_free (source->rendition);
+  g_free (source);
+}
+
+/* Closes the subscriber's connection, which for aggregates means removing
+ * the members from all their streams. */
+static void
+_remove_subscriber (HwangsaeRelay * self, SinkConnection * sink,
+    SourceConnection * source)
+{
+  GSList *members;
+  GSList *it;
+
+  if (!source->aggregate) {
+    hwangsae_relay_remove_source (self, sink, source);
+    return;
+  }
+
+  members = g_slist_copy (source->aggregate->members);
+  for (it = members; it; it = it->next) {
+    SourceConnection *member = it->data;
+
+    hwangsae_relay_remove_source (self, member->sink, member);
+  }
+  g_slist_free (members);
+}
+
+static void
+_idle_wheel_schedule (HwangsaeRelay * self, SinkConnection * sink, gint64 now)
+{
+  gint64 last_activity = __atomic_load_n (&sink->last_activity,
+      __ATOMIC_RELAXED);
+  gint64 deadline_tick;
+
+  deadline_tick = (last_activity +
+      self->idle_timeout * G_TIME_SPAN_SECOND) / IDLE_WHEEL_TICK_US + 1;
+
+  /* Deadlines beyond the wheel's span get rechecked when it turns around. */
+  deadline_tick = CLAMP (deadline_tick, now / IDLE_WHEEL_TICK_US + 1,
+      now / IDLE_WHEEL_TICK_US + IDLE_WHEEL_SLOTS - 1);
+
+  sink->wheel_slot = deadline_tick % IDLE_WHEEL_SLOTS;
+  self->idle_wheel[sink->wheel_slot] =
+      g_list_prepend (self->idle_wheel[sink->wheel_slot], sink);
+  sink->wheel_link = self->idle_wheel[sink->wheel_slot];
+}
+
+static void
+_idle_wheel_cancel (HwangsaeRelay * self, SinkConnection * sink)
+{
+  if (sink->wheel_link) {
+    self->idle_wheel[sink->wheel_slot] =
+        g_list_delete_link (self->idle_wheel[sink->wheel_slot],
+        sink->wheel_link);
+    sink->wheel_link = NULL;
+  }
+}
+
+static void
+hwangsae_relay_remove_sink (HwangsaeRelay * self, SinkConnection * sink)
+{
+  g_debug ("Closing sink connection %d", sink->socket);
+
+  /* A worker still receiving from the sink finishes first. No other can
+   * start while we hold the relay lock. */
+  g_mutex_lock (&sink->lock);
+  g_mutex_unlock (&sink->lock);
+
+  _idle_wheel_cancel (self, sink);
+
+  while (sink->sources) {
+    hwangsae_relay_remove_source (self, sink, sink->sources->data);
+  }
+
+  if (sink->ring) {
+    _send_ring_detach (sink->ring);
+    sink->ring = NULL;
+  }
+
+  srt_close (sink->socket);
+
+  g_atomic_int_add (&sink->user->streams, -1);
+  --sink->listener->n_connections;
+  --sink->worker->n_sinks;
+
+  g_hash_table_remove (self->sink_sockets, GINT_TO_POINTER (sink->socket));
+  /* Frees the sink. */
+  g_hash_table_remove (self->sinks, sink->stream);
+}
+
+static void
+_sink_connection_free (SinkConnection * sink)
+{
+  g_mutex_clear (&sink->lock);
+  g_clear_pointer (&sink->udp_output, hwangsae_udp_output_free);
+  g_clear_pointer (&sink->transcoder, hwangsae_transcoder_free);
+  g_clear_pointer (&sink->splitter, hwangsae_mpegts_splitter_free);
+  g_free (sink->stream);
+  g_free (sink);
+}
+
+static void
+_user_account_free (UserAccount * user)
+{
+  g_free (user->name);
+  g_free (user);
+}
+
+static UserAccount *
+_get_user_account (HwangsaeRelay * self, const gchar * username)
+{
+  UserAccount *user = g_hash_table_lookup (self->users, username);
+
+  if (!user) {
+    user = g_new0 (UserAccount, 1);
+    user->name = g_strdup (username);
+    g_hash_table_insert (self->users, user->name, user);
+  }
+
+  return user;
+}
+
+static void
+_stop_workers (HwangsaeRelay * self)
+{
+  guint i;
+
+  for (i = 0; i != self->workers->len; ++i) {
+    Worker *worker = g_ptr_array_index (self->workers, i);
+
+    g_clear_pointer (&worker->thread, g_thread_join);
+  }
+}
+
+static void
+_stop_senders (HwangsaeRelay * self)
+{
+  guint i;
+
+  if (!self->senders) {
+    return;
+  }
+
+  for (i = 0; i != self->senders->len; ++i) {
+    Sender *sender = g_ptr_array_index (self->senders, i);
+
+    g_atomic_int_set (&sender->running, FALSE);
+
+    g_mutex_lock (&sender->lock);
+    g_cond_signal (&sender->cond);
+    g_mutex_unlock (&sender->lock);
+
+    g_clear_pointer (&sender->thread, g_thread_join);
+  }
+}
+
+static void
+_close_listeners (GPtrArray * listeners)
+{
+  guint i;
+
+  for (i = 0; i != listeners->len; ++i) {
+    Listener *listener = g_ptr_array_index (listeners, i);
+
+    srt_close (listener->socket);
+    listener->socket = SRT_INVALID_SOCK;
+  }
+}
+
+static void
+hwangsae_relay_finalize (GObject * object)
+{
+  HwangsaeRelay *self = HWANGSAE_RELAY (object);
+
+  self->run_relay_thread = FALSE;
+  _stop_workers (self);
+  _stop_senders (self);
+
+  /* Transcoders still starting end up in their streams. */
+  g_thread_pool_free (g_steal_pointer (&self->transcoder_pool), FALSE, TRUE);
+
+  g_mutex_clear (&self->lock);
+
+  g_clear_pointer (&self->sink_uri, g_free);
+
+  _close_listeners (self->sink_listeners);
+  _close_listeners (self->source_listeners);
+
+  while (g_hash_table_size (self->sinks) != 0) {
+    GHashTableIter iter;
+    SinkConnection *sink;
+
+    g_hash_table_iter_init (&iter, self->sinks);
+    g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink);
+    hwangsae_relay_remove_sink (self, sink);
+  }
+
+  g_clear_pointer (&self->sinks, g_hash_table_unref);
+  g_clear_pointer (&self->sink_listeners, g_ptr_array_unref);
+  g_clear_pointer (&self->source_listeners, g_ptr_array_unref);
+  g_clear_pointer (&self->workers, g_ptr_array_unref);
+  g_clear_pointer (&self->senders, g_ptr_array_unref);
+  g_clear_pointer (&self->bind_addresses, g_strfreev);
+  g_clear_pointer (&self->worker_cpus, g_free);
+  g_clear_pointer (&self->users, g_hash_table_unref);
+  g_clear_pointer (&self->alternate_relays, g_strfreev);
+  g_clear_pointer (&self->drain_context, g_main_context_unref);
+
+  if (self->stats_page) {
+    munmap (self->stats_page, sizeof (HwangsaeStatsPage));
+    g_unlink (self->stats_file);
+    self->stats_page = NULL;
+  }
+  g_clear_pointer (&self->stats_file, g_free);
+  g_clear_pointer (&self->sink_sockets, g_hash_table_unref);
+  g_clear_pointer (&self->passphrases, g_hash_table_unref);
+  g_clear_pointer (&self->stream_passphrases, g_variant_unref);
+  g_clear_pointer (&self->privileged_tokens, g_hash_table_unref);
+  g_clear_pointer (&self->class_tokens, g_variant_unref);
+  g_clear_pointer (&self->packet_filters, g_hash_table_unref);
+  g_clear_pointer (&self->stream_packet_filters, g_variant_unref);
+  g_clear_pointer (&self->udp_outputs, g_hash_table_unref);
+  g_clear_pointer (&self->stream_udp_outputs, g_variant_unref);
+  g_clear_pointer (&self->multicast_interface, g_free);
+  g_clear_pointer (&self->renditions, g_hash_table_unref);
+  g_clear_pointer (&self->stream_renditions, g_variant_unref);
+  g_clear_pointer (&self->peer_rtts, g_hash_table_unref);
+
+  g_clear_object (&self->settings);
+
+  if (g_atomic_int_dec_and_test (&hwangsae_relay_init_refcnt)) {
+    g_debug ("Cleaning up SRT");
+    srt_cleanup ();
+  }
+
+  G_OBJECT_CLASS (hwangsae_relay_parent_class)->finalize (object);
+}
+
+static void
+_fill_stream_table (GHashTable * table, GVariant * dict)
+{
+  GVariantIter iter;
+  const gchar *stream;
+  const gchar *value;
+
+  g_hash_table_remove_all (table);
+
+  if (!dict) {
+    return;
+  }
+
+  g_variant_iter_init (&iter, dict);
+  while (g_variant_iter_next (&iter, "{&s&s}", &stream, &value)) {
+    g_hash_table_insert (table, g_strdup (stream), g_strdup (value));
+  }
+}
+
+static void
+_set_stream_passphrases (HwangsaeRelay * self, GVariant * passphrases)
+{
+  GHashTableIter iter;
+  const gchar *stream;
+  const gchar *passphrase;
+
+  LOCK_RELAY;
+
+  g_clear_pointer (&self->stream_passphrases, g_variant_unref);
+  if (passphrases) {
+    self->stream_passphrases = g_variant_ref_sink (passphrases);
+  }
+
+  _fill_stream_table (self->passphrases, passphrases);
+
+  g_hash_table_iter_init (&iter, self->passphrases);
+  while (g_hash_table_iter_next (&iter, (gpointer *) & stream,
+          (gpointer *) & passphrase)) {
+    gsize len = strlen (passphrase);
+
+    if (len < 10 || len > 79) {
+      /* Keep the entry so that connections to the stream get refused
+       * rather than silently left unencrypted. */
+      g_warning ("Passphrase of stream %s must be 10 to 79 characters long",
+          stream);
+    }
+  }
+}
+
+static void
+_set_class_tokens (HwangsaeRelay * self, GVariant * tokens)
+{
+  LOCK_RELAY;
+
+  g_clear_pointer (&self->class_tokens, g_variant_unref);
+  if (tokens) {
+    self->class_tokens = g_variant_ref_sink (tokens);
+  }
+
+  _fill_stream_table (self->privileged_tokens, tokens);
+}
+
+static void
+_set_alternate_relays (HwangsaeRelay * self, const GStrv relays)
+{
+  LOCK_RELAY;
+
+  g_strfreev (self->alternate_relays);
+  self->alternate_relays = g_strdupv (relays);
+  self->next_alternate_relay = 0;
+}
+
+static void
+_set_stream_packet_filters (HwangsaeRelay * self, GVariant * filters)
+{
+  LOCK_RELAY;
+
+  g_clear_pointer (&self->stream_packet_filters, g_variant_unref);
+  if (filters) {
+    self->stream_packet_filters = g_variant_ref_sink (filters);
+  }
+
+  _fill_stream_table (self->packet_filters, filters);
+}
+
+static void
+_set_stream_udp_outputs (HwangsaeRelay * self, GVariant * outputs)
+{
+  LOCK_RELAY;
+
+  g_clear_pointer (&self->stream_udp_outputs, g_variant_unref);
+  if (outputs) {
+    self->stream_udp_outputs = g_variant_ref_sink (outputs);
+  }
+
+  _fill_stream_table (self->udp_outputs, outputs);
+}
+
+static void
+_set_stream_renditions (HwangsaeRelay * self, GVariant * renditions)
+{
+  LOCK_RELAY;
+
+  g_clear_pointer (&self->stream_renditions, g_variant_unref);
+  if (renditions) {
+    self->stream_renditions = g_variant_ref_sink (renditions);
+  }
+
+  _fill_stream_table (self->renditions, renditions);
+}
+
+static void
+hwangsae_relay_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  HwangsaeRelay *self = HWANGSAE_RELAY (object);
+
+  switch (prop_id) {
+    case PROP_SINK_PORT:
+      self->sink_port = g_value_get_uint (value);
+      break;
+    case PROP_SOURCE_PORT:
+      self->source_port = g_value_get_uint (value);
+      break;
+    case PROP_SINK_PORT_COUNT:
+      self->sink_port_count = g_value_get_uint (value);
+      break;
+    case PROP_SOURCE_PORT_COUNT:
+      self->source_port_count = g_value_get_uint (value);
+      break;
+    case PROP_BIND_ADDRESSES:
+      g_strfreev (self->bind_addresses);
+      self->bind_addresses = g_value_dup_boxed (value);
+      break;
+    case PROP_WORKER_CPUS:
+      g_free (self->worker_cpus);
+      self->worker_cpus = g_value_dup_string (value);
+      break;
+    case PROP_WORKER_NICE:
+      self->worker_nice = g_value_get_int (value);
+      break;
+    case PROP_WORKER_RT_PRIORITY:
+      self->worker_rt_priority = g_value_get_uint (value);
+      break;
+    case PROP_WORKERS_PER_ADDRESS:
+      self->workers_per_address = g_value_get_uint (value);
+      break;
+    case PROP_REBALANCE_INTERVAL:
+      self->rebalance_interval = g_value_get_uint (value);
+      break;
+    case PROP_LATENCY_PROBE:
+      self->latency_probe = g_value_get_boolean (value);
+      break;
+    case PROP_STREAM_PASSPHRASES:
+      _set_stream_passphrases (self, g_value_get_variant (value));
+      break;
+    case PROP_PBKEYLEN:
+      self->pbkeylen = g_value_get_int (value);
+      break;
+    case PROP_STREAM_PACKET_FILTERS:
+      _set_stream_packet_filters (self, g_value_get_variant (value));
+      break;
+    case PROP_STREAM_UDP_OUTPUTS:
+      _set_stream_udp_outputs (self, g_value_get_variant (value));
+      break;
+    case PROP_STREAM_RENDITIONS:
+      _set_stream_renditions (self, g_value_get_variant (value));
+      break;
+    case PROP_MULTICAST_TTL:
+      self->multicast_ttl = g_value_get_uint (value);
+      break;
+    case PROP_MULTICAST_INTERFACE:{
+      LOCK_RELAY;
+      g_free (self->multicast_interface);
+      self->multicast_interface = g_value_dup_string (value);
+      break;
+    }
+    case PROP_ADAPTIVE_LATENCY:
+      self->adaptive_latency = g_value_get_boolean (value);
+      break;
+    case PROP_LATENCY_RTT_MULTIPLIER:
+      self->latency_rtt_multiplier = g_value_get_double (value);
+      break;
+    case PROP_LATENCY_MIN:
+      self->latency_min = g_value_get_uint (value);
+      break;
+    case PROP_LATENCY_MAX:
+      self->latency_max = g_value_get_uint (value);
+      break;
+    case PROP_MAX_STREAMS_PER_USER:
+      self->max_streams_per_user = g_value_get_uint (value);
+      break;
+    case PROP_MAX_SUBSCRIBERS_PER_USER:
+      self->max_subscribers_per_user = g_value_get_uint (value);
+      break;
+    case PROP_MAX_SUBSCRIBERS:
+      self->max_subscribers = g_value_get_uint (value);
+      break;
+    case PROP_MAX_SUBSCRIBERS_PER_STREAM:
+      self->max_subscribers_per_stream = g_value_get_uint (value);
+      break;
+    case PROP_ALTERNATE_RELAYS:
+      _set_alternate_relays (self, g_value_get_boxed (value));
+      break;
+    case PROP_IDLE_TIMEOUT:
+      self->idle_timeout = g_value_get_uint (value);
+      break;
+    case PROP_RECV_BUDGET:
+      self->recv_budget = g_value_get_uint (value);
+      break;
+    case PROP_THINNING_THRESHOLD:
+      self->thinning_threshold = g_value_get_uint (value);
+      break;
+    case PROP_MEMORY_BUDGET:
+      self->memory_budget = g_value_get_uint (value);
+      break;
+    case PROP_STREAM_MEMORY_LIMIT:
+      self->stream_memory_limit = g_value_get_uint (value);
+      break;
+    case PROP_MAX_UTILIZATION:
+      self->max_utilization = g_value_get_uint (value);
+      break;
+    case PROP_MAX_FANOUT_LAG:
+      self->max_fanout_lag = g_value_get_uint (value);
+      break;
+    case PROP_SENDER_THREADS:
+      self->sender_threads = g_value_get_uint (value);
+      break;
+    case PROP_STATS_FILE:
+      g_free (self->stats_file);
+      self->stats_file = g_value_dup_string (value);
+      break;
+    case PROP_CLASS_TOKENS:
+      _set_class_tokens (self, g_value_get_variant (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+hwangsae_relay_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  HwangsaeRelay *self = HWANGSAE_RELAY (object);
+  switch (prop_id) {
+    case PROP_SINK_PORT:
+      g_value_set_uint (value, self->sink_port);
+      break;
+    case PROP_SOURCE_PORT:
+      g_value_set_uint (value, self->source_port);
+      break;
+    case PROP_SINK_PORT_COUNT:
+      g_value_set_uint (value, self->sink_port_count);
+      break;
+    case PROP_SOURCE_PORT_COUNT:
+      g_value_set_uint (value, self->source_port_count);
+      break;
+    case PROP_BIND_ADDRESSES:
+      g_value_set_boxed (value, self->bind_addresses);
+      break;
+    case PROP_WORKER_CPUS:
+      g_value_set_string (value, self->worker_cpus);
+      break;
+    case PROP_WORKER_NICE:
+      g_value_set_int (value, self->worker_nice);
+      break;
+    case PROP_WORKER_RT_PRIORITY:
+      g_value_set_uint (value, self->worker_rt_priority);
+      break;
+    case PROP_WORKERS_PER_ADDRESS:
+      g_value_set_uint (value, self->workers_per_address);
+      break;
+    case PROP_REBALANCE_INTERVAL:
+      g_value_set_uint (value, self->rebalance_interval);
+      break;
+    case PROP_LATENCY_PROBE:
+      g_value_set_boolean (value, self->latency_probe);
+      break;
+    case PROP_STREAM_PASSPHRASES:
+      g_value_set_variant (value, self->stream_passphrases);
+      break;
+    case PROP_PBKEYLEN:
+      g_value_set_int (value, self->pbkeylen);
+      break;
+    case PROP_STREAM_PACKET_FILTERS:
+      g_value_set_variant (value, self->stream_packet_filters);
+      break;
+    case PROP_STREAM_UDP_OUTPUTS:
+      g_value_set_variant (value, self->stream_udp_outputs);
+      break;
+    case PROP_STREAM_RENDITIONS:
+      g_value_set_variant (value, self->stream_renditions);
+      break;
+    case PROP_MULTICAST_TTL:
+      g_value_set_uint (value, self->multicast_ttl);
+      break;
+    case PROP_MULTICAST_INTERFACE:{
+      LOCK_RELAY;
+      g_value_set_string (value, self->multicast_interface);
+      break;
+    }
+    case PROP_ADAPTIVE_LATENCY:
+      g_value_set_boolean (value, self->adaptive_latency);
+      break;
+    case PROP_LATENCY_RTT_MULTIPLIER:
+      g_value_set_double (value, self->latency_rtt_multiplier);
+      break;
+    case PROP_LATENCY_MIN:
+      g_value_set_uint (value, self->latency_min);
+      break;
+    case PROP_LATENCY_MAX:
+      g_value_set_uint (value, self->latency_max);
+      break;
+    case PROP_MAX_STREAMS_PER_USER:
+      g_value_set_uint (value, self->max_streams_per_user);
+      break;
+    case PROP_MAX_SUBSCRIBERS_PER_USER:
+      g_value_set_uint (value, self->max_subscribers_per_user);
+      break;
+    case PROP_MAX_SUBSCRIBERS:
+      g_value_set_uint (value, self->max_subscribers);
+      break;
+    case PROP_MAX_SUBSCRIBERS_PER_STREAM:
+      g_value_set_uint (value, self->max_subscribers_per_stream);
+      break;
+    case PROP_ALTERNATE_RELAYS:{
+      LOCK_RELAY;
+      g_value_set_boxed (value, self->alternate_relays);
+      break;
+    }
+    case PROP_IDLE_TIMEOUT:
+      g_value_set_uint (value, self->idle_timeout);
+      break;
+    case PROP_RECV_BUDGET:
+      g_value_set_uint (value, self->recv_budget);
+      break;
+    case PROP_THINNING_THRESHOLD:
+      g_value_set_uint (value, self->thinning_threshold);
+      break;
+    case PROP_MEMORY_BUDGET:
+      g_value_set_uint (value, self->memory_budget);
+      break;
+    case PROP_STREAM_MEMORY_LIMIT:
+      g_value_set_uint (value, self->stream_memory_limit);
+      break;
+    case PROP_MAX_UTILIZATION:
+      g_value_set_uint (value, self->max_utilization);
+      break;
+    case PROP_MAX_FANOUT_LAG:
+      g_value_set_uint (value, self->max_fanout_lag);
+      break;
+    case PROP_SENDER_THREADS:
+      g_value_set_uint (value, self->sender_threads);
+      break;
+    case PROP_STATS_FILE:
+      g_value_set_string (value, self->stats_file);
+      break;
+    case PROP_CLASS_TOKENS:
+      g_value_set_variant (value, self->class_tokens);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+_apply_socket_options (SRTSOCKET sock)
+{
+  SrtParam *params = srt_params;
+
+  for (; params->name != NULL; params++) {
+    if (srt_setsockflag (sock, params->param, &params->val, sizeof (gint))) {
+      g_error ("%s", srt_getlasterror_str ());
+    }
+  }
+}
+
+static SRTSOCKET
+_srt_open_listen_sock (const gchar * address, guint port,
+    gboolean accept_groups)
+{
+  g_autoptr (GSocketAddress) sockaddr = NULL;
+  g_autoptr (GError) error = NULL;
+
+  SRTSOCKET listen_sock;
+  gsize sockaddr_len;
+  gpointer sa;
+
+  g_debug ("Opening SRT listener (address: %s port: %" G_GUINT32_FORMAT ")",
+      address, port);
+
+  sockaddr = g_inet_socket_address_new_from_string (address, port);
+  if (!sockaddr) {
+    g_error ("Invalid bind address %s", address);
+  }
+  sockaddr_len = g_socket_address_get_native_size (sockaddr);
+
+  sa = g_alloca (sockaddr_len);
+
+  if (!g_socket_address_to_native (sockaddr, sa, sockaddr_len, &error)) {
+    goto failed;
+  }
+
+  listen_sock = srt_socket (g_socket_address_get_family (sockaddr),
+      SOCK_DGRAM, 0);
+  _apply_socket_options (listen_sock);
+
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 0)
+  if (g_socket_address_get_family (sockaddr) == G_SOCKET_FAMILY_IPV6) {
+    /* Lets "::" share the port with "0.0.0.0" on the same host. */
+    gint yes = 1;
+
+    srt_setsockflag (listen_sock, SRTO_IPV6ONLY, &yes, sizeof (yes));
+  }
+#endif
+
+  if (accept_groups) {
+#ifdef HAVE_SRT_GROUPS
+    gint yes = 1;
+
+    if (srt_setsockflag (listen_sock, SRTO_GROUPCONNECT, &yes,
+            sizeof (yes)) == SRT_ERROR) {
+      g_warning ("Bonded connections not available: %s",
+          srt_getlasterror_str ());
+    }
+#else
+    g_debug ("Bonded connections need SRT 1.5.0 or newer");
+#endif
+  }
+
+  if (srt_bind (listen_sock, sa, sockaddr_len) == SRT_ERROR) {
+    goto srt_failed;
+  }
+
+  if (srt_listen (listen_sock, SRT_BACKLOG_LEN) == SRT_ERROR) {
+    goto srt_failed;
+  }
+
+  return listen_sock;
+
+srt_failed:
+  g_error ("%s", srt_getlasterror_str ());
+
+  if (listen_sock != SRT_INVALID_SOCK) {
+    srt_close (listen_sock);
+  }
+
+failed:
+  if (error != NULL) {
+    g_error ("%s", error->message);
+  }
+
+  return SRT_INVALID_SOCK;
+}
+
+static void
+hwangsae_relay_class_init (HwangsaeRelayClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = hwangsae_relay_set_property;
+  gobject_class->get_property = hwangsae_relay_get_property;
+  gobject_class->finalize = hwangsae_relay_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_SINK_PORT,
+      g_param_spec_uint ("sink-port", "SRT Binding port (from) ",
+          "SRT Binding port (from)", 0, G_MAXUINT, 8888,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SOURCE_PORT,
+      g_param_spec_uint ("source-port", "SRT Binding port (to) ",
+          "SRT Binding port (to)", 0, G_MAXUINT, 9999,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SINK_PORT_COUNT,
+      g_param_spec_uint ("sink-port-count", "Sink port count",
+          "Number of consecutive ports from sink-port to accept publishers on",
+          1, 64, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SOURCE_PORT_COUNT,
+      g_param_spec_uint ("source-port-count", "Source port count",
+          "Number of consecutive ports from source-port to accept "
+          "subscribers on", 1, 64, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BIND_ADDRESSES,
+      g_param_spec_boxed ("bind-addresses", "Bind addresses",
+          "Local addresses to listen on, each optionally followed by @ and "
+          "the CPUs to pin its worker thread to, e.g. \"10.0.0.1@0-7\"",
+          G_TYPE_STRV, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WORKER_CPUS,
+      g_param_spec_string ("worker-cpus", "Worker CPUs",
+          "CPUs to pin worker threads without CPUs of their own to, "
+          "e.g. \"2-3\" (NULL = no pinning)",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WORKER_NICE,
+      g_param_spec_int ("worker-nice", "Worker nice value",
+          "Nice value of the worker threads", -20, 19, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WORKER_RT_PRIORITY,
+      g_param_spec_uint ("worker-rt-priority", "Worker real-time priority",
+          "SCHED_FIFO priority of the worker threads (0 = no real-time "
+          "scheduling)", 0, 99, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_WORKERS_PER_ADDRESS,
+      g_param_spec_uint ("workers-per-address", "Workers per address",
+          "Number of threads forwarding the streams received on each bind "
+          "address", 1, 64, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_REBALANCE_INTERVAL,
+      g_param_spec_uint ("rebalance-interval", "Rebalance interval",
+          "Milliseconds between moves of streams from the busiest worker to "
+          "the least busy one (0 = never move streams)",
+          0, G_MAXUINT, 5000, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LATENCY_PROBE,
+      g_param_spec_boolean ("latency-probe", "Latency probe",
+          "Insert timing markers into relayed streams and measure relay "
+          "residence time", FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_PASSPHRASES,
+      g_param_spec_variant ("stream-passphrases", "Stream passphrases",
+          "Dictionary of SRT encryption passphrases keyed by stream name",
+          G_VARIANT_TYPE ("a{ss}"), NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PBKEYLEN,
+      g_param_spec_int ("pbkeylen", "Crypto key length",
+          "Crypto key length in bytes (0 = SRT default, 16, 24 or 32)",
+          0, 32, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_PACKET_FILTERS,
+      g_param_spec_variant ("stream-packet-filters", "Stream packet filters",
+          "Dictionary of SRT packet filter (FEC) configurations keyed by "
+          "stream name", G_VARIANT_TYPE ("a{ss}"), NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_UDP_OUTPUTS,
+      g_param_spec_variant ("stream-udp-outputs", "Stream UDP outputs",
+          "Dictionary of comma-separated ADDRESS:PORT lists keyed by stream "
+          "name to forward the stream to over plain UDP or multicast",
+          G_VARIANT_TYPE ("a{ss}"), NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_RENDITIONS,
+      g_param_spec_variant ("stream-renditions", "Stream renditions",
+          "Dictionary of rendition ladders, e.g. \"720p,480p,240p\", keyed "
+          "by stream name that subscribers can pick from with q=",
+          G_VARIANT_TYPE ("a{ss}"), NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MULTICAST_TTL,
+      g_param_spec_uint ("multicast-ttl", "Multicast TTL",
+          "TTL of datagrams sent to multicast groups",
+          0, 255, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MULTICAST_INTERFACE,
+      g_param_spec_string ("multicast-interface", "Multicast interface",
+          "Network interface to send multicast through (NULL = default)",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_LATENCY,
+      g_param_spec_boolean ("adaptive-latency", "Adaptive latency",
+          "Derive the latency of subscribers from their round-trip time",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LATENCY_RTT_MULTIPLIER,
+      g_param_spec_double ("latency-rtt-multiplier", "Latency RTT multiplier",
+          "Subscriber latency as a multiple of its round-trip time",
+          1.0, G_MAXDOUBLE, 4.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LATENCY_MIN,
+      g_param_spec_uint ("latency-min", "Minimum latency",
+          "Lower bound of adaptive subscriber latency (in ms)",
+          0, G_MAXUINT, 20, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LATENCY_MAX,
+      g_param_spec_uint ("latency-max", "Maximum latency",
+          "Upper bound of adaptive subscriber latency (in ms)",
+          0, G_MAXUINT, 2000, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_STREAMS_PER_USER,
+      g_param_spec_uint ("max-streams-per-user", "Max streams per user",
+          "Max number of streams a user can publish (0 = unlimited)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MAX_SUBSCRIBERS_PER_USER,
+      g_param_spec_uint ("max-subscribers-per-user",
+          "Max subscribers per user",
+          "Max number of subscribers of all streams of a user (0 = unlimited)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SUBSCRIBERS,
+      g_param_spec_uint ("max-subscribers", "Max subscribers",
+          "Max number of subscribers of the relay (0 = unlimited)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      PROP_MAX_SUBSCRIBERS_PER_STREAM,
+      g_param_spec_uint ("max-subscribers-per-stream",
+          "Max subscribers per stream",
+          "Max number of subscribers of a single stream (0 = unlimited)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_ALTERNATE_RELAYS,
+      g_param_spec_boxed ("alternate-relays", "Alternate relays",
+          "URIs of relays to redirect subscribers to when this one is full",
+          G_TYPE_STRV, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_IDLE_TIMEOUT,
+      g_param_spec_uint ("idle-timeout", "Idle timeout",
+          "Disconnect publishers not sending any data for this long "
+          "(in seconds, 0 = never)",
+          0, G_MAXUINT, 10, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_RECV_BUDGET,
+      g_param_spec_uint ("recv-budget", "Receive budget",
+          "Max packets forwarded from one publisher before serving the next "
+          "one (0 = read the whole backlog)",
+          0, G_MAXUINT, 8, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_THINNING_THRESHOLD,
+      g_param_spec_uint ("thinning-threshold", "Thinning threshold",
+          "Packets in a subscriber's send buffer at which the relay starts "
+          "dropping non-reference frames for it (0 = never)",
+          0, G_MAXUINT, 1000, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MEMORY_BUDGET,
+      g_param_spec_uint ("memory-budget", "Memory budget",
+          "KiB of data the relay may hold queued before it sheds load "
+          "(0 = unlimited)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_MEMORY_LIMIT,
+      g_param_spec_uint ("stream-memory-limit", "Stream memory limit",
+          "KiB of data the relay may hold queued for a single stream "
+          "(0 = unlimited)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_UTILIZATION,
+      g_param_spec_uint ("max-utilization", "Max utilization",
+          "Percentage of time a worker may spend busy and still take new "
+          "subscribers (0 = no limit)",
+          0, 100, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_FANOUT_LAG,
+      g_param_spec_uint ("max-fanout-lag", "Max fan-out lag",
+          "Microseconds from reading a packet to having sent it to all "
+          "subscribers above which a worker takes no new subscribers "
+          "(0 = no limit)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SENDER_THREADS,
+      g_param_spec_uint ("sender-threads", "Sender threads",
+          "Number of threads sending to subscribers (0 = the workers send "
+          "what they receive)", 0, 64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_FILE,
+      g_param_spec_string ("stats-file", "Stats file",
+          "File to keep memory-mapped with live counters for hwangsae-top "
+          "(NULL = none)", NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CLASS_TOKENS,
+      g_param_spec_variant ("class-tokens", "Class tokens",
+          "Dictionary of tokens subscribers must give with s= to join a "
+          "privileged subscriber class, keyed by class name",
+          G_VARIANT_TYPE ("a{ss}"), NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  signals[DRAINED_SIGNAL] =
+      g_signal_new ("drained", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+}
+
+static void
+_parse_stream_id (const gchar * stream_id, gchar ** username,
+    gchar ** resource, gchar ** rendition, gchar ** subscriber_class,
+    gchar ** class_token)
+{
+  const gchar STREAM_ID_PREFIX[] = "#!::";
+  gchar **keys;
+  gchar **it;
+
+  if (!g_str_has_prefix (stream_id, STREAM_ID_PREFIX)) {
+    return;
+  }
+
+  if (username) {
+    *username = NULL;
+  }
+  if (resource) {
+    *resource = NULL;
+  }
+  if (rendition) {
+    *rendition = NULL;
+  }
+  if (subscriber_class) {
+    *subscriber_class = NULL;
+  }
+  if (class_token) {
+    *class_token = NULL;
+  }
+
+  keys = g_strsplit (stream_id + sizeof (STREAM_ID_PREFIX) - 1, ",", -1);
+  for (it = keys; *it; ++it) {
+    gchar **keyval;
+
+    keyval = g_strsplit (*it, "=", 2);
+
+    if (keyval && keyval[0] && keyval[1]) {
+      if (g_str_equal (keyval[0], "u") && username) {
+        g_clear_pointer (username, g_free);
+        *username = g_strdup (keyval[1]);
+      } else if (g_str_equal (keyval[0], "r") && resource) {
+        g_clear_pointer (resource, g_free);
+        *resource = g_strdup (keyval[1]);
+      } else if (g_str_equal (keyval[0], "q") && rendition) {
+        g_clear_pointer (rendition, g_free);
+        *rendition = g_strdup (keyval[1]);
+      } else if (g_str_equal (keyval[0], "c") && subscriber_class) {
+        g_clear_pointer (subscriber_class, g_free);
+        *subscriber_class = g_strdup (keyval[1]);
+      } else if (g_str_equal (keyval[0], "s") && class_token) {
+        g_clear_pointer (class_token, g_free);
+        *class_token = g_strdup (keyval[1]);
+      }
+    }
+
+    g_strfreev (keyval);
+  }
+
+  g_strfreev (keys);
+}
+
+/* Publishers identify themselves with u= and may name the stream with r=,
+ * which defaults to the username. */
+static gboolean
+_parse_sink_stream_id (const gchar * stream_id, gchar ** username,
+    gchar ** stream)
+{
+  g_autofree gchar *resource = NULL;
+
+  *username = NULL;
+  *stream = NULL;
+
+  if (stream_id) {
+    _parse_stream_id (stream_id, username, &resource, NULL, NULL, NULL);
+  }
+
+  if (!*username) {
+    return FALSE;
+  }
+
+  *stream = resource ? g_steal_pointer (&resource) : g_strdup (*username);
+
+  return TRUE;
+}
+
+static gboolean
+_user_can_publish (HwangsaeRelay * self, const gchar * username)
+{
+  UserAccount *user = g_hash_table_lookup (self->users, username);
+
+  return !user || self->max_streams_per_user == 0 ||
+      (guint) g_atomic_int_get (&user->streams) < self->max_streams_per_user;
+}
+
+static gboolean
+_user_can_subscribe (HwangsaeRelay * self, SinkConnection * sink)
+{
+  return self->max_subscribers_per_user == 0 ||
+      (guint) g_atomic_int_get (&sink->user->subscribers) <
+      self->max_subscribers_per_user;
+}
+
+static void
+_set_reject_reason (SRTSOCKET sock, gint reason)
+{
+#ifdef HAVE_SRT_REJECT_REASON
+  srt_setrejectreason (sock, reason);
+#endif
+}
+
+/* A worker that is busy most of the time or falls behind with sending the
+ * packets it reads would only degrade the subscribers it already serves by
+ * taking another one. */
+static gboolean
+_worker_is_saturated (HwangsaeRelay * self, Worker * worker)
+{
+  if (self->max_utilization != 0 &&
+      (guint) g_atomic_int_get (&worker->utilization) > self->max_utilization) {
+    g_debug ("Worker of %s is %d%% busy", worker->address,
+        g_atomic_int_get (&worker->utilization));
+    return TRUE;
+  }
+
+  if (self->max_fanout_lag != 0 &&
+      (guint) g_atomic_int_get (&worker->fanout_lag) > self->max_fanout_lag) {
+    g_debug ("Worker of %s lags %d us behind", worker->address,
+        g_atomic_int_get (&worker->fanout_lag));
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+_sender_is_saturated (HwangsaeRelay * self, SinkConnection * sink)
+{
+  gint lag;
+
+  if (self->max_fanout_lag == 0 || !sink->ring) {
+    return FALSE;
+  }
+
+  lag = g_atomic_int_get (&sink->ring->sender->fanout_lag);
+  if ((guint) lag > self->max_fanout_lag) {
+    g_debug ("Sender %u lags %d us behind", sink->ring->sender->index, lag);
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Subscribers without c= are public. */
+static gboolean
+_parse_subscriber_class (const gchar * name, SubscriberClass * result)
+{
+  guint i;
+
+  *result = SUBSCRIBER_CLASS_PUBLIC;
+
+  if (!name) {
+    return TRUE;
+  }
+
+  for (i = 0; i != G_N_ELEMENTS (SUBSCRIBER_CLASS_NAMES); ++i) {
+    if (g_str_equal (name, SUBSCRIBER_CLASS_NAMES[i])) {
+      *result = i;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* Compares in constant time so that the token can't be guessed from how
+ * long the relay takes to refuse it. */
+static gboolean
+_check_class_token (HwangsaeRelay * self, const gchar * class_name,
+    const gchar * token)
+{
+  const gchar *expected = g_hash_table_lookup (self->privileged_tokens,
+      class_name);
+  gsize len;
+  guint8 diff = 0;
+  gsize i;
+
+  if (!expected || !token) {
+    return FALSE;
+  }
+
+  len = strlen (expected);
+  if (strlen (token) != len) {
+    return FALSE;
+  }
+
+  for (i = 0; i != len; ++i) {
+    diff |= expected[i] ^ token[i];
+  }
+
+  return diff == 0;
+}
+
+/* Turns the reason to refuse a client with into a redirect when the relay
+ * has alternates to offer. */
+static gint
+_redirect_to_alternate_relay (HwangsaeRelay * self, gint reason)
+{
+  guint n_alternates = self->alternate_relays ?
+      g_strv_length (self->alternate_relays) : 0;
+  guint index;
+
+  if (n_alternates == 0) {
+    return reason;
+  }
+
+  index = self->next_alternate_relay++ % n_alternates;
+
+  g_debug ("Redirecting client to %s", self->alternate_relays[index]);
+
+  return HWANGSAE_REJECT_REDIRECT + index;
+}
+
+/* Returns the reason to reject a new subscriber of the sink with, or 0 when
+ * there's room for it. Recorders get in even when the relay sheds load, as
+ * they'd be the last to go anyway. */
+static gint
+_check_subscriber_limits (HwangsaeRelay * self, SinkConnection * sink,
+    SubscriberClass subscriber_class)
+{
+  gboolean shedding = subscriber_class != SUBSCRIBER_CLASS_RECORDER;
+
+  gint reason = 0;
+
+  if (!_user_can_subscribe (self, sink)) {
+    g_debug ("User %s reached the limit of subscribers", sink->user->name);
+    return HWANGSAE_REJECT_USER_QUOTA;
+  }
+
+  if (shedding && (self->memory_pressure == MEMORY_PRESSURE_REFUSE ||
+          sink->over_memory_limit)) {
+    g_debug ("Refusing subscriber of %s for lack of memory", sink->stream);
+    ++self->connections_refused;
+    reason = HWANGSAE_REJECT_OVERLOADED;
+  } else if (shedding && (_worker_is_saturated (self, sink->worker) ||
+          _sender_is_saturated (self, sink))) {
+    ++self->connections_refused;
+    reason = HWANGSAE_REJECT_OVERLOADED;
+  } else if (self->max_subscribers_per_stream != 0 &&
+      sink->n_sources >= self->max_subscribers_per_stream) {
+    g_debug ("Stream %s reached the limit of subscribers", sink->stream);
+    reason = HWANGSAE_REJECT_STREAM_FULL;
+  } else if (self->max_subscribers != 0 &&
+      self->n_sources >= self->max_subscribers) {
+    g_debug ("Relay reached the limit of subscribers");
+    reason = HWANGSAE_REJECT_RELAY_FULL;
+  }
+
+  if (reason != 0) {
+    reason = _redirect_to_alternate_relay (self, reason);
+  }
+
+  return reason;
+}
+
+static gboolean
+_apply_stream_passphrase (HwangsaeRelay * self, SRTSOCKET sock,
+    const gchar * stream)
+{
+  const gchar *passphrase = g_hash_table_lookup (self->passphrases, stream);
+
+  if (!passphrase) {
+    return TRUE;
+  }
+
+  if (self->pbkeylen != 0 && srt_setsockflag (sock, SRTO_PBKEYLEN,
+          &self->pbkeylen, sizeof (self->pbkeylen)) == SRT_ERROR) {
+    g_warning ("Couldn't set key length of stream %s: %s", stream,
+        srt_getlasterror_str ());
+    return FALSE;
+  }
+
+  if (srt_setsockflag (sock, SRTO_PASSPHRASE, passphrase,
+          strlen (passphrase)) == SRT_ERROR) {
+    g_warning ("Couldn't set passphrase of stream %s: %s", stream,
+        srt_getlasterror_str ());
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+_apply_stream_packet_filter (HwangsaeRelay * self, SRTSOCKET sock,
+    const gchar * stream)
+{
+  const gchar *filter = g_hash_table_lookup (self->packet_filters, stream);
+
+  if (!filter) {
+    return TRUE;
+  }
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 0)
+  if (srt_setsockflag (sock, SRTO_PACKETFILTER, filter,
+          strlen (filter)) == SRT_ERROR) {
+    g_warning ("Couldn't set packet filter '%s' of stream %s: %s", filter,
+        stream, srt_getlasterror_str ());
+    return FALSE;
+  }
+
+  return TRUE;
+#else
+  g_warning ("Packet filter of stream %s requires SRT 1.4.0 or newer",
+      stream);
+  return FALSE;
+#endif
+}
+
+static gchar *
+_sockaddr_to_string (const struct sockaddr *sa)
+{
+  char buf[INET6_ADDRSTRLEN + 1];
+  socklen_t addr_len;
+
+  switch (sa->sa_family) {
+    case AF_INET:
+      addr_len = sizeof (struct sockaddr_in);
+      break;
+    case AF_INET6:
+      addr_len = sizeof (struct sockaddr_in6);
+      break;
+    default:
+      return NULL;
+  }
+
+  if (getnameinfo (sa, addr_len, buf, sizeof (buf), NULL, 0,
+          NI_NUMERICHOST) != 0) {
+    return NULL;
+  }
+
+  return g_strdup (buf);
+}
+
+/* The handshake doesn't tell the RTT, so we use the one measured on earlier
+ * connections from the same address. Because the receiver latency gets
+ * negotiated to the larger of both sides' proposals, SRTO_PEERLATENCY sets a
+ * lower bound; viewers on fast paths should ask for a small SRTO_LATENCY. */
+static void
+_apply_adaptive_latency (HwangsaeRelay * self, SRTSOCKET sock,
+    const struct sockaddr *peeraddr)
+{
+  g_autofree gchar *peer = NULL;
+  PeerRtt *peer_rtt;
+  gint latency;
+
+  if (!self->adaptive_latency) {
+    return;
+  }
+
+  peer = _sockaddr_to_string (peeraddr);
+  peer_rtt = peer ? g_hash_table_lookup (self->peer_rtts, peer) : NULL;
+  if (!peer_rtt) {
+    return;
+  }
+
+  latency = CLAMP (peer_rtt->rtt * self->latency_rtt_multiplier,
+      self->latency_min, self->latency_max);
+
+  g_debug ("Proposing %d ms latency to %s (RTT %.1f ms)", latency, peer,
+      peer_rtt->rtt);
+
+  if (srt_setsockflag (sock, SRTO_PEERLATENCY, &latency,
+          sizeof (latency)) == SRT_ERROR) {
+    g_warning ("Couldn't set latency of %s: %s", peer,
+        srt_getlasterror_str ());
+  }
+}
+
+static gboolean
+_stream_has_rendition (HwangsaeRelay * self, const gchar * stream,
+    const gchar * rendition)
+{
+  const gchar *ladder = g_hash_table_lookup (self->renditions, stream);
+
+  return ladder && hwangsae_transcoder_ladder_has_rendition (ladder,
+      rendition);
+}
+
+static gboolean
+_handshake_expired (gpointer sock, gint64 * expiry_time, gint64 * now)
+{
+  return *expiry_time <= *now;
+}
+
+/* Clients count from the moment the listener callback lets them through,
+ * a burst of them would otherwise all get sent to the same port. Failed
+ * handshakes, which srt_accept() never returns, count until they expire. */
+static guint
+_listener_load (Listener * listener)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  g_hash_table_foreach_remove (listener->handshakes,
+      (GHRFunc) _handshake_expired, &now);
+
+  return listener->n_connections + g_hash_table_size (listener->handshakes);
+}
+
+static void
+_listener_begin_handshake (Listener * listener, SRTSOCKET sock)
+{
+  gint64 *expiry_time = g_new (gint64, 1);
+
+  *expiry_time = g_get_monotonic_time () + HANDSHAKE_TIMEOUT_US;
+  g_hash_table_insert (listener->handshakes, GINT_TO_POINTER (sock),
+      expiry_time);
+}
+
+static void
+_listener_end_handshake (Listener * listener, SRTSOCKET sock)
+{
+  g_hash_table_remove (listener->handshakes, GINT_TO_POINTER (sock));
+}
+
+/* Considers only the listeners of the given worker unless it's NULL. */
+static Listener *
+_least_loaded_listener (GPtrArray * listeners, Worker * worker)
+{
+  Listener *result = NULL;
+  guint result_load = 0;
+  guint i;
+
+  for (i = 0; i != listeners->len; ++i) {
+    Listener *listener = g_ptr_array_index (listeners, i);
+    guint load;
+
+    if (worker && listener->worker != worker) {
+      continue;
+    }
+
+    load = _listener_load (listener);
+    if (!result || load < result_load) {
+      result = listener;
+      result_load = load;
+    }
+  }
+
+  return result;
+}
+
+/* Clients connecting to the first of several ports get redirected to the
+ * least loaded port of the same address unless that's the first port
+ * itself. Returns the reason to reject the client with or 0 to accept it. */
+static gint
+_check_listener_load (GPtrArray * listeners, Listener * listener,
+    guint first_port)
+{
+  Listener *least_loaded;
+
+  if (listener->port != first_port) {
+    return 0;
+  }
+
+  least_loaded = _least_loaded_listener (listeners, listener->worker);
+  if (_listener_load (least_loaded) >= _listener_load (listener)) {
+    return 0;
+  }
+
+  g_debug ("Redirecting client from port %u to %u", listener->port,
+      least_loaded->port);
+
+  return HWANGSAE_REJECT_REDIRECT_PORT + least_loaded->port - listener->port;
+}
+
+static gint
+hwangsae_relay_accept_sink (Listener * listener, SRTSOCKET sock,
+    gint hs_version, const struct sockaddr *peeraddr, const gchar * stream_id)
+{
+  HwangsaeRelay *self = listener->relay;
+  SinkConnection *sink;
+  g_autofree gchar *username = NULL;
+  g_autofree gchar *stream = NULL;
+
+  LOCK_RELAY;
+
+  if (!_parse_sink_stream_id (stream_id, &username, &stream)) {
+    // Sink socket must have username in its Stream ID.
+    return -1;
+  }
+
+  sink = g_hash_table_lookup (self->sinks, stream);
+  if (sink) {
+    gboolean group_member = FALSE;
+
+#ifdef HAVE_SRT_GROUPS
+    gint group_type = SRT_GTYPE_UNDEFINED;
+    gint len = sizeof (group_type);
+
+    if (srt_getsockflag (sock, SRTO_GROUPTYPE, &group_type, &len) == 0) {
+      group_member = group_type != SRT_GTYPE_UNDEFINED;
+    }
+#endif
+
+    if (!sink->bonded || !group_member) {
+      // We already have a sink connected with this stream name.
+      return -1;
+    }
+
+    // Another link of a bonded sink, libsrt adds it to the existing group.
+    g_debug ("Accepting link %d of bonded sink %s", sock, stream);
+  } else if (self->draining) {
+    g_debug ("Refusing sink %s while draining", stream);
+    _set_reject_reason (sock, _redirect_to_alternate_relay (self,
+            HWANGSAE_REJECT_DRAINING));
+    return -1;
+  } else if (!_user_can_publish (self, username)) {
+    g_debug ("User %s reached the limit of published streams", username);
+    _set_reject_reason (sock, HWANGSAE_REJECT_USER_QUOTA);
+    return -1;
+  } else if (self->memory_pressure == MEMORY_PRESSURE_REFUSE) {
+    g_debug ("Refusing sink %s for lack of memory", stream);
+    ++self->connections_refused;
+    _set_reject_reason (sock, HWANGSAE_REJECT_OVERLOADED);
+    return -1;
+  } else {
+    gint reject_reason = _check_listener_load (self->sink_listeners, listener,
+        self->sink_port);
+
+    if (reject_reason != 0) {
+      _set_reject_reason (sock, reject_reason);
+      return -1;
+    }
+  }
+
+  if (!_apply_stream_passphrase (self, sock, stream) ||
+      !_apply_stream_packet_filter (self, sock, stream)) {
+    return -1;
+  }
+
+  g_debug ("Accepting sink %d username: %s stream: %s", sock, username,
+      stream);
+
+  /* Further links of a bonded sink don't make new connections. */
+  if (!sink) {
+    _listener_begin_handshake (listener, sock);
+  }
+
+  return 0;
+}
+
+/* Looks up the stream by name or, failing that, as stream/progN for the
+ * program numbered N of a multi-program stream. */
+static SinkConnection *
+_lookup_stream_or_program (HwangsaeRelay * self, const gchar * name,
+    guint16 * program_number)
+{
+  SinkConnection *sink = g_hash_table_lookup (self->sinks, name);
+  g_autofree gchar *stream = NULL;
+  const gchar *selector;
+  const gchar *digits;
+  gchar *end;
+  guint64 number;
+
+  *program_number = 0;
+
+  if (sink) {
+    return sink;
+  }
+
+  selector = strrchr (name, '/');
+  if (!selector || !g_str_has_prefix (selector, "/prog")) {
+    return NULL;
+  }
+
+  digits = selector + strlen ("/prog");
+  number = g_ascii_strtoull (digits, &end, 10);
+  if (end == digits || *end != '\0' || number == 0 || number > G_MAXUINT16) {
+    return NULL;
+  }
+
+  stream = g_strndup (name, selector - name);
+  *program_number = number;
+
+  return g_hash_table_lookup (self->sinks, stream);
+}
+
+/* Resolves the r= of a subscriber into the streams it asks for, several of
+ * them for aggregates, and the programs it picked of them. Returns their
+ * number or 0 when any is missing or appears twice. */
+static guint
+_lookup_subscribed_sinks (HwangsaeRelay * self, const gchar * resource,
+    SinkConnection * sinks[HWANGSAE_MPEGTS_MAX_PROGRAMS],
+    guint16 program_numbers[HWANGSAE_MPEGTS_MAX_PROGRAMS])
+{
+  g_auto (GStrv) streams = NULL;
+  guint n_streams;
+  guint i;
+
+  /* Stream names may contain '+' themselves. */
+  sinks[0] = _lookup_stream_or_program (self, resource, &program_numbers[0]);
+  if (sinks[0]) {
+    return 1;
+  }
+
+  streams = g_strsplit (resource, "+", -1);
+  n_streams = g_strv_length (streams);
+
+  if (n_streams > HWANGSAE_MPEGTS_MAX_PROGRAMS) {
+    g_debug ("Subscriber asked for more than %u streams",
+        HWANGSAE_MPEGTS_MAX_PROGRAMS);
+    return 0;
+  }
+
+  for (i = 0; i != n_streams; ++i) {
+    guint j;
+
+    sinks[i] = _lookup_stream_or_program (self, streams[i],
+        &program_numbers[i]);
+    if (!sinks[i]) {
+      return 0;
+    }
+
+    /* Distinct programs of one stream can be aggregated, but not the
+     * whole stream together with any of its programs. */
+    for (j = 0; j != i; ++j) {
+      if (sinks[j] == sinks[i] && (program_numbers[j] == program_numbers[i]
+              || program_numbers[j] == 0 || program_numbers[i] == 0)) {
+        g_debug ("Subscriber asked for stream %s twice", streams[i]);
+        return 0;
+      }
+    }
+  }
+
+  return n_streams;
+}
+
+static gint
+hwangsae_relay_accept_source (Listener * listener, SRTSOCKET sock,
+    gint hs_version, const struct sockaddr *peeraddr, const gchar * stream_id)
+{
+  HwangsaeRelay *self = listener->relay;
+  SinkConnection *sink;
+  g_autofree gchar *resource = NULL;
+  g_autofree gchar *rendition = NULL;
+  g_autofree gchar *class_name = NULL;
+  g_autofree gchar *class_token = NULL;
+  SubscriberClass subscriber_class;
+  SinkConnection *sinks[HWANGSAE_MPEGTS_MAX_PROGRAMS];
+  guint16 program_numbers[HWANGSAE_MPEGTS_MAX_PROGRAMS];
+  guint n_sinks;
+  gint reject_reason = 0;
+  guint i;
+
+  LOCK_RELAY;
+
+  _parse_stream_id (stream_id, NULL, &resource, &rendition, &class_name,
+      &class_token);
+  if (!resource) {
+    // Source socket must specify the requested stream in its Stream ID.
+    return -1;
+  }
+
+  if (!_parse_subscriber_class (class_name, &subscriber_class)) {
+    g_debug ("Unknown subscriber class %s", class_name);
+    return -1;
+  }
+
+  /* Anyone can claim a class in the Stream ID, it must come with the
+   * class's token. The class grants no access to streams, subscribers of
+   * encrypted ones still need their passphrase. */
+  if (subscriber_class != SUBSCRIBER_CLASS_PUBLIC &&
+      !_check_class_token (self, class_name, class_token)) {
+    g_debug ("Subscriber gave no valid token for class %s", class_name);
+    return -1;
+  }
+
+  n_sinks = _lookup_subscribed_sinks (self, resource, sinks, program_numbers);
+  if (n_sinks == 0) {
+    // We have no such sink.
+    return -1;
+  }
+
+  sink = sinks[0];
+
+  if (n_sinks > 1 && rendition) {
+    g_debug ("Aggregate %s can't have rendition %s", resource, rendition);
+    return -1;
+  }
+
+  if (rendition && !_stream_has_rendition (self, resource, rendition)) {
+    g_debug ("Stream %s has no rendition %s", resource, rendition);
+    return -1;
+  }
+
+  /* One connection can only carry one passphrase. */
+  for (i = 1; i != n_sinks; ++i) {
+    if (g_strcmp0 (g_hash_table_lookup (self->passphrases, sinks[i]->stream),
+            g_hash_table_lookup (self->passphrases, sink->stream)) != 0) {
+      g_debug ("Streams of aggregate %s have different passphrases",
+          resource);
+      return -1;
+    }
+  }
+
+  if (self->draining) {
+    g_debug ("Refusing subscriber of %s while draining", resource);
+    _set_reject_reason (sock, _redirect_to_alternate_relay (self,
+            HWANGSAE_REJECT_DRAINING));
+    return -1;
+  }
+
+  for (i = 0; i != n_sinks && reject_reason == 0; ++i) {
+    reject_reason = _check_subscriber_limits (self, sinks[i],
+        subscriber_class);
+  }
+  if (reject_reason == 0) {
+    reject_reason = _check_listener_load (self->source_listeners, listener,
+        self->source_port);
+  }
+  if (reject_reason != 0) {
+    _set_reject_reason (sock, reject_reason);
+    return -1;
+  }
+
+  if (!_apply_stream_passphrase (self, sock, sink->stream) ||
+      !_apply_stream_packet_filter (self, sock, sink->stream)) {
+    return -1;
+  }
+
+  _apply_adaptive_latency (self, sock, peeraddr);
+
+  g_debug ("Accepting source %d resource: %s", sock, resource);
+
+  _listener_begin_handshake (listener, sock);
 
   return 0;
 }
 
+static gchar *
+_get_stream_id (SRTSOCKET sock)
+{
+  gchar stream_id[512];
+  gint len = sizeof (stream_id);
+
+#ifdef HAVE_SRT_GROUPS
+  if (sock & SRTGROUP_MASK) {
+    SRT_SOCKGROUPDATA links[MAX_GROUP_LINKS];
+    size_t n_links = G_N_ELEMENTS (links);
+
+    /* Stream ID is carried by the handshakes of the member links. */
+    if (srt_group_data (sock, links, &n_links) < 1) {
+      return NULL;
+    }
+
+    sock = links[0].id;
+  }
+#endif
+
+  if (srt_getsockflag (sock, SRTO_STREAMID, stream_id, &len) == SRT_ERROR) {
+    return NULL;
+  }
+
+  return g_strndup (stream_id, len);
+}
+
+static void
+_open_udp_output (HwangsaeRelay * self, SinkConnection * sink)
+{
+  const gchar *destinations = g_hash_table_lookup (self->udp_outputs,
+      sink->stream);
+  g_autoptr (GError) error = NULL;
+
+  if (!destinations) {
+    return;
+  }
+
+  sink->udp_output = hwangsae_udp_output_new (destinations,
+      self->multicast_ttl, self->multicast_interface, &error);
+  if (!sink->udp_output) {
+    g_warning ("Couldn't set up UDP output of stream %s: %s", sink->stream,
+        error->message);
+  }
+}
+
+/* New streams go to the worker of the listener's address with the fewest
+ * streams; the rebalancer corrects for their different bitrates later. */
+static Worker *
+_least_busy_worker (HwangsaeRelay * self, Worker * primary)
+{
+  Worker *result = primary;
+  guint i;
+
+  for (i = 0; i != self->workers->len; ++i) {
+    Worker *worker = g_ptr_array_index (self->workers, i);
+
+    if (worker->primary == primary && worker->n_sinks < result->n_sinks) {
+      result = worker;
+    }
+  }
+
+  return result;
+}
+
+/* Rings only get added and removed under the relay lock. */
+static Sender *
+_least_busy_sender (HwangsaeRelay * self)
+{
+  Sender *result = NULL;
+  guint i;
+
+  for (i = 0; i != self->senders->len; ++i) {
+    Sender *sender = g_ptr_array_index (self->senders, i);
+
+    if (!result || sender->rings->len < result->rings->len) {
+      result = sender;
+    }
+  }
+
+  return result;
+}
+
+/* Connections get registered only once srt_accept() returns them, because
+ * the handshake may still fail after the listener callback has let them
+ * through, e.g. when the peer's passphrase doesn't match. */
+static void
+hwangsae_relay_add_sink (HwangsaeRelay * self, Listener * listener,
+    SRTSOCKET sock)
+{
+  SinkConnection *sink;
+  g_autofree gchar *stream_id = _get_stream_id (sock);
+  g_autofree gchar *username = NULL;
+  g_autofree gchar *stream = NULL;
+
+  _listener_end_handshake (listener, sock);
+
+  if (!_parse_sink_stream_id (stream_id, &username, &stream) ||
+      g_hash_table_contains (self->sinks, stream) ||
+      !_user_can_publish (self, username)) {
+    // Another sink with the same stream name won the race.
+    srt_close (sock);
+    return;
+  }
+
+  sink = g_new0 (SinkConnection, 1);
+  g_mutex_init (&sink->lock);
+  sink->socket = sock;
+  sink->stream = g_steal_pointer (&stream);
+  sink->user = _get_user_account (self, username);
+  sink->listener = listener;
+  ++listener->n_connections;
+#ifdef HAVE_SRT_GROUPS
+  sink->bonded = (sock & SRTGROUP_MASK) != 0;
+#endif
+
+  if (sink->bonded) {
+    g_debug ("Sink %s is bonded in group %d", sink->stream, sock);
+  }
+
+  g_atomic_int_inc (&sink->user->streams);
+
+  sink->last_activity = g_get_monotonic_time ();
+  _idle_wheel_schedule (self, sink, sink->last_activity);
+
+  _open_udp_output (self, sink);
+
+  g_hash_table_insert (self->sinks, sink->stream, sink);
+  g_hash_table_insert (self->sink_sockets, GINT_TO_POINTER (sock), sink);
+  sink->worker = _least_busy_worker (self, listener->worker);
+  ++sink->worker->n_sinks;
+  if (self->senders) {
+    sink->ring = _send_ring_new (sink, _least_busy_sender (self));
+  }
+  srt_epoll_add_usock (sink->worker->poll_id, sock, &SRT_POLL_EVENTS);
+}
+
+static gboolean
+_start_transcoder (HwangsaeRelay * self, SinkConnection * sink,
+    const gchar * rendition)
+{
+  TranscoderJob *job;
+
+  if (!_stream_has_rendition (self, sink->stream, rendition)) {
+    return FALSE;
+  }
+
+  if (sink->transcoder || sink->transcoder_job) {
+    return TRUE;
+  }
+
+  /* Subscribers get their rendition once the transcoder runs. */
+  job = g_new0 (TranscoderJob, 1);
+  job->sink = sink;
+  job->stream = g_strdup (sink->stream);
+  job->ladder = g_strdup (g_hash_table_lookup (self->renditions,
+          sink->stream));
+
+  sink->transcoder_job = job;
+  g_thread_pool_push (self->transcoder_pool, job, NULL);
+
+  return TRUE;
+}
+
+/* Keeps subscribers of the same class in the order they came. */
+static gint
+_compare_source_classes (gconstpointer a, gconstpointer b)
+{
+  const SourceConnection *new_source = a;
+  const SourceConnection *source = b;
+
+  return new_source->subscriber_class <= source->subscriber_class ? 1 : -1;
+}
+
+static void
+_attach_source (SinkConnection * sink, SourceConnection * source)
+{
+  g_atomic_int_inc (&sink->user->subscribers);
+  ++sink->n_sources;
+  if (source->rendition) {
+    ++sink->n_rendition_sources;
+  }
+
+  _sink_lock (sink);
+  if (source->program_number != 0 && !sink->splitter) {
+    sink->splitter = hwangsae_mpegts_splitter_new ();
+  }
+  sink->sources = g_slist_insert_sorted (sink->sources, source,
+      _compare_source_classes);
+  _sink_unlock (sink);
+}
+
+static void
+hwangsae_relay_add_source (HwangsaeRelay * self, Listener * listener,
+    SRTSOCKET sock)
+{
+  SinkConnection *sinks[HWANGSAE_MPEGTS_MAX_PROGRAMS];
+  guint16 program_numbers[HWANGSAE_MPEGTS_MAX_PROGRAMS];
+  guint n_sinks = 0;
+  Aggregate *aggregate = NULL;
+  struct sockaddr_storage peeraddr;
+  gint peeraddr_len = sizeof (peeraddr);
+  g_autofree gchar *peer = NULL;
+  g_autofree gchar *stream_id = _get_stream_id (sock);
+  g_autofree gchar *resource = NULL;
+  g_autofree gchar *rendition = NULL;
+  g_autofree gchar *class_name = NULL;
+  SubscriberClass subscriber_class = SUBSCRIBER_CLASS_PUBLIC;
+  guint i;
+
+  _listener_end_handshake (listener, sock);
+
+  if (stream_id) {
+    _parse_stream_id (stream_id, NULL, &resource, &rendition, &class_name,
+        NULL);
+    _parse_subscriber_class (class_name, &subscriber_class);
+  }
+
+  if (resource) {
+    n_sinks = _lookup_subscribed_sinks (self, resource, sinks,
+        program_numbers);
+  }
+
+  for (i = 0; i != n_sinks; ++i) {
+    if (_check_subscriber_limits (self, sinks[i], subscriber_class) != 0) {
+      break;
+    }
+  }
+
+  if (n_sinks == 0 || i != n_sinks) {
+    // The sink disconnected or a limit got reached in the meantime.
+    srt_close (sock);
+    return;
+  }
+
+  if (rendition && (n_sinks > 1 || program_numbers[0] != 0 ||
+          !_start_transcoder (self, sinks[0], rendition))) {
+    srt_close (sock);
+    return;
+  }
+
+  ++self->n_sources;
+  ++listener->n_connections;
+
+  if (srt_getpeername (sock, (struct sockaddr *) &peeraddr,
+          &peeraddr_len) == 0) {
+    peer = _sockaddr_to_string ((struct sockaddr *) &peeraddr);
+  }
+
+  if (n_sinks > 1) {
+    g_debug ("Aggregating %u streams into connection %d", n_sinks, sock);
+
+    aggregate = g_new0 (Aggregate, 1);
+    aggregate->socket = sock;
+    aggregate->listener = listener;
+    aggregate->aggregator = hwangsae_mpegts_aggregator_new (n_sinks);
+  }
+
+  for (i = 0; i != n_sinks; ++i) {
+    SourceConnection *source = g_new0 (SourceConnection, 1);
+
+    source->socket = sock;
+    source->rendition = g_strdup (rendition);
+    source->subscriber_class = subscriber_class;
+    source->listener = listener;
+    source->peer = g_strdup (peer);
+    source->program_number = program_numbers[i];
+
+    if (aggregate) {
+      source->aggregate = aggregate;
+      source->sink = sinks[i];
+      source->program = i;
+      aggregate->members = g_slist_append (aggregate->members, source);
+    }
+
+    _attach_source (sinks[i], source);
+  }
+}
+
+/* Picks the source's thinning level from the fill of its send buffer, with
+ * some hysteresis so that it doesn't flap between levels. */
+static void
+_update_thinning_level (HwangsaeRelay * self, SourceConnection * source,
+    gint64 now)
+{
+  guint threshold = self->thinning_threshold;
+  gint buffered;
+  gint len = sizeof (buffered);
+
+  /* Operators tolerate twice the backlog of public viewers before losing
+   * frames, recorders never lose any. */
+  if (source->subscriber_class == SUBSCRIBER_CLASS_RECORDER) {
+    return;
+  } else if (source->subscriber_class == SUBSCRIBER_CLASS_OPERATOR) {
+    threshold *= 2;
+  }
+
+  if (now - source->last_thinning_check < THINNING_CHECK_INTERVAL_US) {
+    return;
+  }
+
+  source->last_thinning_check = now;
+
+  if (srt_getsockflag (source->socket, SRTO_SNDDATA, &buffered, &len) != 0) {
+    return;
+  }
+
+  if ((guint) buffered >= 2 * threshold) {
+    source->next_thinning_level = THINNING_KEYFRAMES;
+  } else if ((guint) buffered >= threshold) {
+    source->next_thinning_level = MAX (source->next_thinning_level,
+        THINNING_NON_REFERENCE);
+  } else if ((guint) buffered < threshold / 2) {
+    source->next_thinning_level = THINNING_NONE;
+  } else if (source->next_thinning_level == THINNING_KEYFRAMES) {
+    source->next_thinning_level = THINNING_NON_REFERENCE;
+  }
+}
+
+/* Returns the packets of the buffer the source's thinning level drops.
+ * A new level takes over only where an access unit starts, so that no frame
+ * goes out truncated, and THINNING_KEYFRAMES is only left at an IDR frame,
+ * the frames before it would miss their references. */
+static guint32
+_thinning_drop_mask (SourceConnection * source, const guint32 drop_masks[],
+    gint unit_start, gint idr_start)
+{
+  ThinningLevel level = source->thinning_level;
+  guint32 drop_mask = drop_masks[level];
+  guint32 before;
+  gint boundary;
+
+  if (source->next_thinning_level == level) {
+    return drop_mask;
+  }
+
+  boundary = level == THINNING_KEYFRAMES ? idr_start : unit_start;
+  if (boundary < 0) {
+    return drop_mask;
+  }
+
+  source->thinning_level = source->next_thinning_level;
+
+  before = (1u << boundary) - 1;
+
+  return (drop_mask & before) |
+      (drop_masks[source->thinning_level] & ~before);
+}
+
+/* Marks the packets of the buffer each thinning level drops and finds the
+ * first packets starting a video access unit and an IDR frame, which are
+ * left at -1 when there's none. An access unit counts from its first packet
+ * in the buffer even when its first slice comes only in a later one. */
+static gboolean
+_scan_frames (SinkConnection * sink, const guint8 * buf, gint len,
+    guint32 drop_masks[], gint * unit_start, gint * idr_start)
+{
+  /* Video packets of the access unit whose first slice is yet to come */
+  gint pending_start = sink->scanner.searching ? 0 : -1;
+  guint32 pending_mask = 0;
+  guint i;
+
+  *unit_start = -1;
+  *idr_start = -1;
+
+  if (len % HWANGSAE_MPEGTS_PACKET_SIZE != 0 ||
+      len / HWANGSAE_MPEGTS_PACKET_SIZE > 32) {
+    return FALSE;
+  }
+
+  drop_masks[THINNING_NONE] = 0;
+  drop_masks[THINNING_NON_REFERENCE] = 0;
+  drop_masks[THINNING_KEYFRAMES] = 0;
+
+  for (i = 0; i != len / HWANGSAE_MPEGTS_PACKET_SIZE; ++i) {
+    const guint8 *packet = buf + i * HWANGSAE_MPEGTS_PACKET_SIZE;
+    HwangsaeFrameType frame =
+        hwangsae_mpegts_scanner_push (&sink->scanner, packet);
+    guint32 frame_mask = 1u << i;
+    gint start = -1;
+
+    if (frame == HWANGSAE_FRAME_UNKNOWN) {
+      if (sink->scanner.searching &&
+          hwangsae_mpegts_packet_pid (packet) == sink->scanner.video_pid) {
+        if (hwangsae_mpegts_packet_has_unit_start (packet)) {
+          pending_start = i;
+          pending_mask = 0;
+        }
+        pending_mask |= frame_mask;
+      }
+      continue;
+    }
+
+    if (hwangsae_mpegts_packet_has_unit_start (packet)) {
+      start = i;
+    } else if (pending_start >= 0) {
+      start = pending_start;
+      frame_mask |= pending_mask;
+    }
+    pending_start = -1;
+    pending_mask = 0;
+
+    if (start >= 0) {
+      if (*unit_start < 0) {
+        *unit_start = start;
+      }
+      if (frame == HWANGSAE_FRAME_IDR && *idr_start < 0) {
+        *idr_start = start;
+      }
+    }
+
+    switch (frame) {
+      case HWANGSAE_FRAME_NON_REFERENCE:
+        drop_masks[THINNING_NON_REFERENCE] |= frame_mask;
+        /* fall through */
+      case HWANGSAE_FRAME_REFERENCE:
+        drop_masks[THINNING_KEYFRAMES] |= frame_mask;
+        break;
+      default:
+        break;
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+_send_to_source (HwangsaeRelay * self, SinkConnection * sink,
+    SourceConnection * source, const gchar * data, gint len)
+{
+  if (srt_send (source->socket, data, len) < 0) {
+    gint error = srt_getlasterror (NULL);
+    if (error == SRT_ECONNLOST) {
+      /* Subscribers change only under the relay lock, which neither the
+       * workers nor the senders take while they fan out. */
+      _mark_source_lost (self, source);
+    } else {
+      g_debug ("srt_send failed %s", srt_strerror (error, 0));
+    }
+  } else {
+    USER_ACCOUNT_ADD_BYTES (sink->user->bytes_out, len);
+    USER_ACCOUNT_ADD_BYTES (sink->bytes_out, len);
+  }
+}
+
+static void
+_send_to_sources (HwangsaeRelay * self, SinkConnection * sink,
+    const gchar * buf, gint len)
+{
+  GSList *it = sink->sources;
+  guint32 drop_masks[THINNING_KEYFRAMES + 1] = { 0 };
+  gint unit_start = -1;
+  gint idr_start = -1;
+  gboolean scanned = FALSE;
+  gint64 now = g_get_monotonic_time ();
+
+  if (sink->udp_output) {
+    hwangsae_udp_output_queue (sink->udp_output, (const guint8 *) buf, len);
+  }
+
+  if (sink->transcoder) {
+    hwangsae_transcoder_push (sink->transcoder, (const guint8 *) buf, len);
+  }
+
+  if (self->thinning_threshold != 0) {
+    scanned = _scan_frames (sink, (const guint8 *) buf, len, drop_masks,
+        &unit_start, &idr_start);
+  }
+
+  if (sink->splitter) {
+    hwangsae_mpegts_splitter_scan (sink->splitter, (const guint8 *) buf, len);
+  }
+
+  while (it) {
+    SourceConnection *source = it->data;
+    const gchar *data = buf;
+    gint data_len = len;
+    guint8 thinned[HWANGSAE_MPEGTS_PACKET_SIZE * 32];
+
+    it = it->next;
+
+    if (source->rendition || g_atomic_int_get (&source->lost)) {
+      continue;
+    }
+
+    /* All subscribers of a program share its packets. */
+    if (source->program_number != 0) {
+      gsize program_len;
+
+      data = (const gchar *) hwangsae_mpegts_splitter_get_program
+          (sink->splitter, source->program_number, &program_len);
+      if (!data) {
+        continue;
+      }
+      data_len = program_len;
+    }
+
+    /* Aggregates never get thinned, their connection mixes streams of
+     * different bitrates. */
+    if (source->aggregate) {
+      data_len = hwangsae_mpegts_aggregator_remux
+          (source->aggregate->aggregator, source->program,
+          (const guint8 *) data, data_len, now, thinned);
+      if (data_len != 0) {
+        _send_to_source (self, sink, source, (const gchar *) thinned,
+            data_len);
+      }
+      continue;
+    }
+
+    /* The frame scanner only follows the first program of a stream. */
+    if (scanned && source->program_number == 0) {
+      guint32 drop_mask;
+
+      _update_thinning_level (self, source, now);
+      drop_mask = _thinning_drop_mask (source, drop_masks, unit_start,
+          idr_start);
+
+      /* Once anything got dropped, continuity counters need rewriting. */
+      if (drop_mask != 0 || source->video_cc_offset != 0) {
+        data_len = hwangsae_mpegts_filter_packets ((const guint8 *) buf, len,
+            drop_mask, sink->scanner.video_pid, &source->video_cc_offset,
+            thinned);
+        data = (const gchar *) thinned;
+
+        source->packets_thinned +=
+            (len - data_len) / HWANGSAE_MPEGTS_PACKET_SIZE;
+
+        if (data_len == 0) {
+          continue;
+        }
+      }
+    } else if (source->program_number == 0 && source->video_cc_offset != 0 &&
+        len <= (gint) sizeof (thinned)) {
+      /* Buffers the scanner skipped still continue the shifted counters,
+       * only whole packets get rewritten. */
+      gsize whole_len = len - len % HWANGSAE_MPEGTS_PACKET_SIZE;
+
+      data_len = hwangsae_mpegts_filter_packets ((const guint8 *) buf,
+          whole_len, 0, sink->scanner.video_pid, &source->video_cc_offset,
+          thinned);
+      memcpy (thinned + data_len, buf + data_len, len - data_len);
+      data_len = len;
+      data = (const gchar *) thinned;
+    }
+
+    _send_to_source (self, sink, source, data, data_len);
+  }
+}
+
+/* Renditions get encoded in the transcoder's threads, their output is sent
+ * from the relay thread like any other data. */
+static void
+_send_renditions (HwangsaeRelay * self, SinkConnection * sink)
+{
+  const gchar *rendition;
+  GstBuffer *buffer;
+
+  while ((buffer = hwangsae_transcoder_pull (sink->transcoder, &rendition))) {
+    GstMapInfo map;
+    GSList *it = sink->sources;
+
+    gst_buffer_map (buffer, &map, GST_MAP_READ);
+
+    while (it) {
+      SourceConnection *source = it->data;
+
+      it = it->next;
+
+      if (g_strcmp0 (source->rendition, rendition) == 0) {
+        _send_to_source (self, sink, source, (const gchar *) map.data,
+            map.size);
+      }
+    }
+
+    gst_buffer_unmap (buffer, &map);
+    gst_buffer_unref (buffer);
+  }
+}
+
+static void
+_stamp_probe_markers (HwangsaeRelay * self, SinkConnection * sink, guint8 * buf,
+    gint len)
+{
+  gint64 now = g_get_real_time ();
+  gint offset;
+
+  for (offset = 0; offset + HWANGSAE_MPEGTS_PACKET_SIZE <= len;
+      offset += HWANGSAE_MPEGTS_PACKET_SIZE) {
+    guint8 *packet = buf + offset;
+
+    if (hwangsae_mpegts_packet_pid (packet) != HWANGSAE_MPEGTS_PROBE_PID) {
+      continue;
+    }
+
+    /* Markers inserted by the edge get our ingest time added, so subscribers
+     * can tell the uplink and the relay-to-subscriber path apart. */
+    if (hwangsae_mpegts_probe_stamp_relay (packet, now)) {
+      sink->last_edge_probe_time = g_get_monotonic_time ();
+      __atomic_add_fetch (&self->probes_stamped, 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static void
+_inject_probe_marker (HwangsaeRelay * self, SinkConnection * sink,
+    gint64 recv_time)
+{
+  guint8 packet[HWANGSAE_MPEGTS_PACKET_SIZE];
+  HwangsaeProbeMarker marker;
+
+  /* The edge inserts its own markers, don't interleave ours with them. */
+  if (sink->last_edge_probe_time != 0 &&
+      recv_time - sink->last_edge_probe_time < PROBE_EDGE_TIMEOUT_US) {
+    return;
+  }
+
+  if (recv_time - sink->last_probe_time < PROBE_INTERVAL_US) {
+    return;
+  }
+
+  sink->last_probe_time = recv_time;
+
+  marker.seqnum = sink->probe_seqnum++;
+  marker.edge_time = -1;
+  marker.relay_time = g_get_real_time () - (g_get_monotonic_time () -
+      recv_time);
+
+  hwangsae_mpegts_probe_write (packet, sink->probe_cc++, &marker);
+
+  if (!sink->ring) {
+    _send_to_sources (self, sink, (const gchar *) packet, sizeof (packet));
+  } else if (!_send_ring_push (sink->ring, packet, sizeof (packet),
+          recv_time)) {
+    return;
+  }
+
+  __atomic_add_fetch (&self->probes_injected, 1, __ATOMIC_RELAXED);
+}
+
+/* Workers and sender threads update the counters without holding the
+ * relay lock. */
+static void
+_update_residence_time (HwangsaeRelay * self, gint64 recv_time)
+{
+  guint64 residence = g_get_monotonic_time () - recv_time;
+  guint64 max = __atomic_load_n (&self->residence_max, __ATOMIC_RELAXED);
+
+  __atomic_add_fetch (&self->residence_samples, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&self->residence_sum, residence, __ATOMIC_RELAXED);
+
+  while (residence > max &&
+      !__atomic_compare_exchange_n (&self->residence_max, &max, residence,
+          TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void
+_sample_peer_rtts (HwangsaeRelay * self)
+{
+  gint64 now = g_get_monotonic_time ();
+  GHashTableIter iter;
+  SinkConnection *sink;
+  PeerRtt *peer_rtt;
+
+  if (now - self->last_rtt_sample_time < RTT_SAMPLE_INTERVAL_US) {
+    return;
+  }
+
+  self->last_rtt_sample_time = now;
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    GSList *it;
+
+    for (it = sink->sources; it; it = it->next) {
+      SourceConnection *source = it->data;
+      SRT_TRACEBSTATS stats;
+
+      if (!source->peer || srt_bstats (source->socket, &stats, 0) != 0) {
+        continue;
+      }
+
+      peer_rtt = g_hash_table_lookup (self->peer_rtts, source->peer);
+      if (!peer_rtt) {
+        peer_rtt = g_new0 (PeerRtt, 1);
+        peer_rtt->rtt = stats.msRTT;
+        g_hash_table_insert (self->peer_rtts, g_strdup (source->peer),
+            peer_rtt);
+      }
+
+      /* Smooth the samples of all connections from the same address. */
+      peer_rtt->rtt = 0.875 * peer_rtt->rtt + 0.125 * stats.msRTT;
+      peer_rtt->update_time = now;
+    }
+  }
+
+  g_hash_table_iter_init (&iter, self->peer_rtts);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & peer_rtt)) {
+    if (now - peer_rtt->update_time > RTT_CACHE_TTL_US) {
+      g_hash_table_iter_remove (&iter);
+    }
+  }
+}
+
+/* Sinks get checked when their slot of the wheel comes up. Those that were
+ * active in the meantime are just moved to the slot of their new deadline,
+ * so receiving data never has to touch the wheel. */
+static void
+_reap_idle_sinks (HwangsaeRelay * self)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 now_tick = now / IDLE_WHEEL_TICK_US;
+  gint64 deadline = now - self->idle_timeout * G_TIME_SPAN_SECOND;
+
+  if (self->idle_wheel_tick == 0) {
+    self->idle_wheel_tick = now_tick;
+  } else if (now_tick - self->idle_wheel_tick > IDLE_WHEEL_SLOTS) {
+    /* The reaper was disabled for a while, check each slot once. */
+    self->idle_wheel_tick = now_tick - IDLE_WHEEL_SLOTS;
+  }
+
+  for (; self->idle_wheel_tick < now_tick; ++self->idle_wheel_tick) {
+    guint slot = (self->idle_wheel_tick + 1) % IDLE_WHEEL_SLOTS;
+    GList *expired = g_steal_pointer (&self->idle_wheel[slot]);
+
+    while (expired) {
+      SinkConnection *sink = expired->data;
+
+      expired = g_list_delete_link (expired, expired);
+      sink->wheel_link = NULL;
+
+      if (__atomic_load_n (&sink->last_activity, __ATOMIC_RELAXED) <=
+          deadline) {
+        g_debug ("Sink %s has been idle for %u s", sink->stream,
+            self->idle_timeout);
+        ++self->idle_sinks_reaped;
+        hwangsae_relay_remove_sink (self, sink);
+      } else {
+        _idle_wheel_schedule (self, sink, now);
+      }
+    }
+  }
+}
+
+/* Taking the relay lock with the sink's lock held could deadlock, the sink
+ * gets looked up again as something else may have removed it meanwhile. */
+static void
+_remove_lost_sink (HwangsaeRelay * self, SRTSOCKET rsocket)
+{
+  SinkConnection *sink;
+
+  LOCK_RELAY;
+
+  sink = g_hash_table_lookup (self->sink_sockets, GINT_TO_POINTER (rsocket));
+  if (sink) {
+    hwangsae_relay_remove_sink (self, sink);
+  }
+}
+
+static void
+_update_fanout_lag (Worker * worker, gint64 recv_time)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 lag = g_atomic_int_get (&worker->fanout_lag);
+
+  lag += (now - recv_time - lag) / 8;
+  g_atomic_int_set (&worker->fanout_lag, CLAMP (lag, 0, G_MAXINT));
+  worker->fanout_lag_time = now;
+}
+
+/* Forwards at most recv_budget packets from the sink. Returns TRUE when
+ * the sink may have more data to read. */
+static gboolean
+_receive_from_sink (HwangsaeRelay * self, SRTSOCKET rsocket, gchar * buf,
+    gsize len)
+{
+  SinkConnection *sink;
+  gboolean more = TRUE;
+  gint64 start_time;
+  gint64 cost;
+  guint budget;
+  guint n = 0;
+  gint recv;
+
+  /* The relay lock is only held to find the sink, workers receive from
+   * their streams in parallel. Removing the sink takes its lock under the
+   * relay lock, so it stays valid until we release it. */
+  g_mutex_lock (&self->lock);
+  sink = g_hash_table_lookup (self->sink_sockets, GINT_TO_POINTER (rsocket));
+  if (sink) {
+    g_mutex_lock (&sink->lock);
+  }
+  g_mutex_unlock (&self->lock);
+
+  if (!sink) {
+    return FALSE;
+  }
+
+  start_time = g_get_monotonic_time ();
+
+  budget = self->recv_budget ? self->recv_budget : G_MAXUINT;
+
+  while (more && n != budget) {
+    SendSlot *slot = NULL;
+
+    if (sink->ring) {
+      /* Data stays in the socket until the sender catches up. */
+      slot = _send_ring_reserve (sink->ring);
+      if (!slot) {
+        ++sink->ring->stalls;
+        _send_ring_pause (sink->ring, sink);
+        more = FALSE;
+        break;
+      }
+
+      buf = slot->data;
+      len = sizeof (slot->data);
+    }
+
+    recv = srt_recv (rsocket, buf, len);
+
+    if (recv > 0) {
+      gint64 recv_time = g_get_monotonic_time ();
+
+      ++n;
+      __atomic_store_n (&sink->last_activity, recv_time, __ATOMIC_RELAXED);
+
+      USER_ACCOUNT_ADD_BYTES (sink->user->bytes_in, recv);
+      USER_ACCOUNT_ADD_BYTES (sink->bytes_in, recv);
+
+      if (self->latency_probe) {
+        _stamp_probe_markers (self, sink, (guint8 *) buf, recv);
+      }
+
+      if (slot) {
+        slot->len = recv;
+        slot->recv_time = recv_time;
+        _send_ring_commit (sink->ring);
+      } else {
+        _send_to_sources (self, sink, buf, recv);
+        _update_fanout_lag (sink->worker, recv_time);
+      }
+
+      if (self->latency_probe) {
+        _inject_probe_marker (self, sink, recv_time);
+        if (!slot) {
+          _update_residence_time (self, recv_time);
+        }
+      }
+    } else {
+      more = FALSE;
+
+      if (recv < 0) {
+        gint error = srt_getlasterror (NULL);
+        if (error == SRT_ECONNLOST) {
+          g_mutex_unlock (&sink->lock);
+          _remove_lost_sink (self, rsocket);
+          return FALSE;
+        } else if (error != SRT_EASYNCRCV) {
+          g_debug ("srt_recv error %s", srt_strerror (error, 0));
+        }
+      }
+    }
+  }
+
+  if (sink->transcoder) {
+    _send_renditions (self, sink);
+  }
+
+  /* Datagrams queued for plain UDP receivers go out in one batch. */
+  if (sink->udp_output && !sink->ring) {
+    hwangsae_udp_output_flush (sink->udp_output);
+  }
+
+  cost = g_get_monotonic_time () - start_time;
+  __atomic_add_fetch (&sink->forward_time, cost, __ATOMIC_RELAXED);
+  sink->worker->busy_time += cost;
+
+  g_mutex_unlock (&sink->lock);
+
+  return more;
+}
+
+static void
+_send_all_renditions (HwangsaeRelay * self)
+{
+  GHashTableIter iter;
+  SinkConnection *sink;
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    if (sink->transcoder) {
+      g_mutex_lock (&sink->lock);
+      _send_renditions (self, sink);
+      g_mutex_unlock (&sink->lock);
+    }
+  }
+}
+
+/* The sink's lock makes the current receive batch finish first. Packets
+ * arriving meanwhile stay in the socket's buffer and the new worker's epoll
+ * reports them as soon as the socket is added. The ring lock keeps the
+ * sender from putting the socket back into the old epoll. */
+static void
+_move_sink (HwangsaeRelay * self, SinkConnection * sink, Worker * worker)
+{
+  g_debug ("Moving stream %s to another worker of %s", sink->stream,
+      worker->address);
+
+  _sink_lock (sink);
+
+  srt_epoll_remove_usock (sink->worker->poll_id, sink->socket);
+  --sink->worker->n_sinks;
+
+  sink->worker = worker;
+  ++worker->n_sinks;
+  srt_epoll_add_usock (worker->poll_id, sink->socket, &SRT_POLL_EVENTS);
+
+  if (sink->ring) {
+    g_atomic_int_set (&sink->ring->paused, FALSE);
+  }
+  _sink_unlock (sink);
+
+  ++self->streams_moved;
+}
+
+static guint64
+_sink_recent_cost (SinkConnection * sink)
+{
+  return __atomic_load_n (&sink->forward_time, __ATOMIC_RELAXED) -
+      sink->balanced_forward_time;
+}
+
+/* Moves the one stream whose forwarding cost best evens out the busiest
+ * and the least busy worker of the address. Streams costing as much as
+ * the gap or more would only swap the roles of the two workers. */
+static void
+_rebalance_address (HwangsaeRelay * self, Worker * primary)
+{
+  Worker *busiest = NULL;
+  Worker *least_busy = NULL;
+  SinkConnection *best = NULL;
+  GHashTableIter iter;
+  SinkConnection *sink;
+  gint64 gap;
+  guint i;
+
+  for (i = 0; i != self->workers->len; ++i) {
+    Worker *worker = g_ptr_array_index (self->workers, i);
+
+    if (worker->primary != primary) {
+      continue;
+    }
+    if (!busiest || worker->load > busiest->load) {
+      busiest = worker;
+    }
+    if (!least_busy || worker->load < least_busy->load) {
+      least_busy = worker;
+    }
+  }
+
+  gap = busiest->load - least_busy->load;
+
+  /* Not worth disturbing the streams for. */
+  if (busiest == least_busy || gap <= (gint64) busiest->load / 4) {
+    return;
+  }
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    gint64 cost = _sink_recent_cost (sink);
+
+    if (sink->worker != busiest || cost == 0 || cost >= gap) {
+      continue;
+    }
+
+    if (!best || ABS (2 * cost - gap) <
+        ABS (2 * (gint64) _sink_recent_cost (best) - gap)) {
+      best = sink;
+    }
+  }
+
+  if (best) {
+    _move_sink (self, best, least_busy);
+  }
+}
+
+static void
+_rebalance_workers (HwangsaeRelay * self)
+{
+  GHashTableIter iter;
+  SinkConnection *sink;
+  guint i;
+
+  for (i = 0; i != self->workers->len; ++i) {
+    Worker *worker = g_ptr_array_index (self->workers, i);
+
+    worker->load = 0;
+  }
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    sink->worker->load += _sink_recent_cost (sink);
+  }
+
+  for (i = 0; i != self->workers->len; ++i) {
+    Worker *worker = g_ptr_array_index (self->workers, i);
+
+    if (worker->primary == worker) {
+      _rebalance_address (self, worker);
+    }
+  }
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    sink->balanced_forward_time = __atomic_load_n (&sink->forward_time,
+        __ATOMIC_RELAXED);
+  }
+}
+
+/* Estimates the data in an SRT buffer from the number of packets in it. */
+static guint64
+_socket_queued_bytes (SRTSOCKET sock, SRT_SOCKOPT opt)
+{
+  gint packets;
+  gint len = sizeof (packets);
+
+  if (srt_getsockflag (sock, opt, &packets, &len) != 0 || packets < 0) {
+    return 0;
+  }
+
+  return (guint64) packets * SRT_LIVE_DEF_PLSIZE;
+}
+
+static void
+_update_sink_memory_usage (SinkConnection * sink)
+{
+  GSList *it;
+
+  sink->memory_usage = _socket_queued_bytes (sink->socket, SRTO_RCVDATA);
+
+  if (sink->ring) {
+    sink->memory_usage +=
+        (guint64) _send_ring_count (sink->ring) * SRT_LIVE_DEF_PLSIZE;
+  }
+
+  if (sink->transcoder) {
+    sink->memory_usage +=
+        hwangsae_transcoder_get_queued_bytes (sink->transcoder);
+  }
+
+  for (it = sink->sources; it; it = it->next) {
+    SourceConnection *source = it->data;
+
+    if (source->aggregate && source != source->aggregate->members->data) {
+      source->backlog_bytes = 0;
+      continue;
+    }
+
+    source->backlog_bytes = _socket_queued_bytes (source->socket,
+        SRTO_SNDDATA);
+    sink->memory_usage += source->backlog_bytes;
+  }
+}
+
+typedef struct
+{
+  SinkConnection *sink;
+  SourceConnection *source;
+} LaggingSource;
+
+/* Lower classes come first, then larger backlogs. */
+static gint
+_compare_lagging_sources (gconstpointer a, gconstpointer b)
+{
+  const LaggingSource *la = a;
+  const LaggingSource *lb = b;
+
+  if (la->source->subscriber_class != lb->source->subscriber_class) {
+    return (gint) la->source->subscriber_class -
+        (gint) lb->source->subscriber_class;
+  }
+
+  return (lb->source->backlog_bytes > la->source->backlog_bytes) -
+      (lb->source->backlog_bytes < la->source->backlog_bytes);
+}
+
+/* Drops the subscribers of the lowest class with the largest send
+ * backlogs, only those of the given sink unless it's NULL, until they free
+ * the given number of bytes. Recorders are never dropped. Returns the
+ * bytes left to free. */
+static guint64
+_shed_lagging_sources (HwangsaeRelay * self, SinkConnection * only_sink,
+    guint64 excess)
+{
+  g_autoptr (GArray) lagging = g_array_new (FALSE, FALSE,
+      sizeof (LaggingSource));
+  GHashTableIter iter;
+  SinkConnection *sink;
+  guint i;
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    GSList *it;
+
+    if (only_sink && sink != only_sink) {
+      continue;
+    }
+
+    for (it = sink->sources; it; it = it->next) {
+      LaggingSource entry = { sink, it->data };
+
+      if (entry.source->backlog_bytes != 0 &&
+          entry.source->subscriber_class != SUBSCRIBER_CLASS_RECORDER) {
+        g_array_append_val (lagging, entry);
+      }
+    }
+  }
+
+  g_array_sort (lagging, _compare_lagging_sources);
+
+  for (i = 0; i != lagging->len && excess != 0; ++i) {
+    LaggingSource *entry = &g_array_index (lagging, LaggingSource, i);
+    guint64 freed = entry->source->backlog_bytes;
+
+    g_debug ("Dropping subscriber %d of %s lagging %" G_GUINT64_FORMAT
+        " bytes behind", entry->source->socket, entry->sink->stream, freed);
+
+    entry->sink->memory_usage -= freed;
+    excess -= MIN (excess, freed);
+    ++self->subscribers_shed;
+
+    _remove_subscriber (self, entry->sink, entry->source);
+  }
+
+  return excess;
+}
+
+/* Sheds load in a fixed order while the queued data exceeds the limits:
+ * trimming the transcoder queues, which drain by themselves, comes first,
+ * dropping the most lagging subscribers second and refusing new
+ * connections last. Pressure eases only below 90% of the limit so that
+ * the relay doesn't flap between the steps. */
+static void
+_enforce_memory_budget (HwangsaeRelay * self)
+{
+  guint64 budget = (guint64) self->memory_budget * 1024;
+  guint64 stream_limit = (guint64) self->stream_memory_limit * 1024;
+  guint64 transcoder_bytes = 0;
+  GHashTableIter iter;
+  SinkConnection *sink;
+
+  self->memory_usage = 0;
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    guint64 queued_input = 0;
+
+    _update_sink_memory_usage (sink);
+
+    if (sink->transcoder) {
+      queued_input = hwangsae_transcoder_get_queued_bytes (sink->transcoder);
+    }
+
+    if (stream_limit != 0 && sink->memory_usage > stream_limit) {
+      guint64 excess = sink->memory_usage - stream_limit;
+
+      sink->over_memory_limit = TRUE;
+      excess -= MIN (excess, queued_input);
+      _shed_lagging_sources (self, sink, excess);
+    } else if (stream_limit == 0 ||
+        sink->memory_usage < stream_limit / 10 * 9) {
+      sink->over_memory_limit = FALSE;
+    }
+
+    self->memory_usage += sink->memory_usage;
+    transcoder_bytes += queued_input;
+  }
+
+  if (budget == 0 || self->memory_usage < budget / 10 * 9) {
+    self->memory_pressure = MEMORY_PRESSURE_NONE;
+  } else if (self->memory_usage > budget) {
+    guint64 excess = self->memory_usage - budget;
+
+    self->memory_pressure = MAX (self->memory_pressure, MEMORY_PRESSURE_TRIM);
+    excess -= MIN (excess, transcoder_bytes);
+
+    if (excess != 0) {
+      self->memory_pressure = MAX (self->memory_pressure,
+          MEMORY_PRESSURE_SHED);
+      self->memory_usage -= excess;
+      excess = _shed_lagging_sources (self, NULL, excess);
+      self->memory_usage += excess;
+    }
+
+    if (excess != 0) {
+      self->memory_pressure = MEMORY_PRESSURE_REFUSE;
+    }
+  }
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    if (sink->transcoder) {
+      hwangsae_transcoder_set_trimmed (sink->transcoder,
+          self->memory_pressure != MEMORY_PRESSURE_NONE ||
+          sink->over_memory_limit);
+    }
+  }
+}
+
+static const gchar *
+_memory_pressure_name (MemoryPressure pressure)
+{
+  switch (pressure) {
+    case MEMORY_PRESSURE_NONE:
+      return "none";
+    case MEMORY_PRESSURE_TRIM:
+      return "trim";
+    case MEMORY_PRESSURE_SHED:
+      return "shed";
+    case MEMORY_PRESSURE_REFUSE:
+      return "refuse";
+  }
+
+  return NULL;
+}
+
+static Listener *
+_find_listener (GPtrArray * listeners, SRTSOCKET sock)
+{
+  guint i;
+
+  for (i = 0; i != listeners->len; ++i) {
+    Listener *listener = g_ptr_array_index (listeners, i);
+
+    if (listener->socket == sock) {
+      return listener;
+    }
+  }
+
+  return NULL;
+}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+/* Parses a list of CPUs like "0-3,8". */
+static gboolean
+_parse_cpu_list (const gchar * list, cpu_set_t * cpus)
+{
+  g_auto (GStrv) ranges = g_strsplit (list, ",", -1);
+  gchar **it;
+
+  CPU_ZERO (cpus);
+
+  for (it = ranges; *it; ++it) {
+    gchar *end;
+    guint64 first = g_ascii_strtoull (*it, &end, 10);
+    guint64 last = first;
+
+    if (end == *it) {
+      return FALSE;
+    }
+
+    if (*end == '-') {
+      const gchar *start = end + 1;
+
+      last = g_ascii_strtoull (start, &end, 10);
+      if (end == start || last < first) {
+        return FALSE;
+      }
+    }
+
+    if (*end != '\0' || last >= CPU_SETSIZE) {
+      return FALSE;
+    }
+
+    for (; first <= last; ++first) {
+      CPU_SET (first, cpus);
+    }
+  }
+
+  return CPU_COUNT (cpus) != 0;
+}
+#endif
+
+#ifdef HAVE_SCHED_SETAFFINITY
+static gchar *
+_format_cpu_list (const cpu_set_t * cpus)
+{
+  GString *list = g_string_new (NULL);
+  gint cpu;
+
+  for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    gint last = cpu;
+
+    if (!CPU_ISSET (cpu, cpus)) {
+      continue;
+    }
+
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET (last + 1, cpus)) {
+      ++last;
+    }
+
+    if (list->len != 0) {
+      g_string_append_c (list, ',');
+    }
+
+    if (last == cpu) {
+      g_string_append_printf (list, "%d", cpu);
+    } else {
+      g_string_append_printf (list, "%d-%d", cpu, last);
+    }
+
+    cpu = last;
+  }
+
+  return g_string_free (list, FALSE);
+}
+#endif
+
+static const gchar *
+_sched_policy_name (gint policy)
+{
+  switch (policy) {
+    case SCHED_FIFO:
+      return "fifo";
+    case SCHED_RR:
+      return "rr";
+    case SCHED_OTHER:
+      return "other";
+    default:
+      return "unknown";
+  }
+}
+
+/* Applies the CPU affinity and priority settings to the calling worker
+ * thread. Failures, typically for lack of privileges, leave the thread
+ * where the scheduler put it. */
+static void
+_place_worker (Worker * worker)
+{
+  HwangsaeRelay *self = worker->relay;
+  const gchar *cpu_list = worker->cpus ? worker->cpus : self->worker_cpus;
+  gint tid = 0;
+
+#ifdef SYS_gettid
+  tid = syscall (SYS_gettid);
+#endif
+
+  if (cpu_list && *cpu_list) {
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t cpus;
+
+    if (!_parse_cpu_list (cpu_list, &cpus)) {
+      g_warning ("Invalid CPU list '%s' for worker of %s", cpu_list,
+          worker->address);
+    } else if (sched_setaffinity (0, sizeof (cpus), &cpus) != 0) {
+      /* Affects only the calling thread. */
+      g_warning ("Couldn't pin worker of %s to CPUs %s: %s", worker->address,
+          cpu_list, g_strerror (errno));
+    }
+#else
+    g_warning ("Pinning threads to CPUs isn't supported on this system");
+#endif
+  }
+
+  if (self->worker_rt_priority != 0) {
+    struct sched_param param = {.sched_priority = self->worker_rt_priority };
+    gint res = pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+
+    if (res != 0) {
+      g_warning ("Couldn't give worker of %s real-time priority %u: %s",
+          worker->address, self->worker_rt_priority, g_strerror (res));
+    }
+  } else if (self->worker_nice != 0 && tid != 0) {
+    /* Linux keeps a nice value per thread. */
+    if (setpriority (PRIO_PROCESS, tid, self->worker_nice) != 0) {
+      g_warning ("Couldn't set nice value of worker of %s to %d: %s",
+          worker->address, self->worker_nice, g_strerror (errno));
+    }
+  }
+
+  g_atomic_int_set (&worker->tid, tid);
+}
+
+/* Called after each epoll wait; everything else the worker does counts as
+ * busy time. */
+static void
+_update_utilization (Worker * worker, gint64 wait_start_time)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 window = now - worker->window_start_time;
+
+  worker->window_wait_time += now - wait_start_time;
+
+  if (window < UTILIZATION_WINDOW_US) {
+    return;
+  }
+
+  if (worker->window_start_time != 0) {
+    g_atomic_int_set (&worker->utilization,
+        100 * (window - MIN (window, worker->window_wait_time)) / window);
+  }
+
+  if (worker->fanout_lag_time < worker->window_start_time) {
+    g_atomic_int_set (&worker->fanout_lag,
+        g_atomic_int_get (&worker->fanout_lag) / 2);
+  }
+
+  if (worker->relay->stats_page &&
+      worker->index < HWANGSAE_STATS_PAGE_MAX_WORKERS) {
+    HwangsaeStatsWorker *slot =
+        &worker->relay->stats_page->workers[worker->index];
+
+    hwangsae_stats_page_write_begin (&slot->seq);
+    slot->streams = worker->n_sinks;
+    slot->utilization = g_atomic_int_get (&worker->utilization);
+    slot->fanout_lag = g_atomic_int_get (&worker->fanout_lag);
+    slot->busy_time = worker->busy_time;
+    hwangsae_stats_page_write_end (&slot->seq);
+  }
+
+  worker->window_start_time = now;
+  worker->window_wait_time = 0;
+}
+
+/* Sends what the ring holds and returns FALSE if it was empty. */
+static gboolean
+_drain_send_ring (HwangsaeRelay * self, SendRing * ring, gdouble * fanout_lag)
+{
+  guint head = g_atomic_int_get (&ring->head);
+  guint tail = g_atomic_int_get (&ring->tail);
+  SinkConnection *sink;
+
+  if (head == tail) {
+    return FALSE;
+  }
+
+  g_mutex_lock (&ring->lock);
+
+  sink = ring->sink;
+
+  for (; tail != head; ++tail) {
+    SendSlot *slot = &ring->slots[tail % SEND_RING_SLOTS];
+
+    if (sink) {
+      _send_to_sources (self, sink, slot->data, slot->len);
+
+      *fanout_lag = 0.875 * *fanout_lag +
+          0.125 * (g_get_monotonic_time () - slot->recv_time);
+
+      if (self->latency_probe) {
+        _update_residence_time (self, slot->recv_time);
+      }
+    }
+
+    /* Hands the slot back to the worker. */
+    g_atomic_int_set (&ring->tail, tail + 1);
+  }
+
+  if (sink && sink->udp_output) {
+    hwangsae_udp_output_flush (sink->udp_output);
+  }
+
+  if (sink) {
+    _send_ring_resume (ring, sink);
+  }
+
+  g_mutex_unlock (&ring->lock);
+
+  return TRUE;
+}
+
+static gboolean
+_sender_has_data (Sender * sender)
+{
+  guint i;
+
+  for (i = 0; i != sender->rings->len; ++i) {
+    if (_send_ring_count (g_ptr_array_index (sender->rings, i)) != 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static void
+_sender_wait (Sender * sender)
+{
+  g_mutex_lock (&sender->lock);
+
+  g_atomic_int_set (&sender->sleeping, TRUE);
+
+  if (g_atomic_int_get (&sender->running) && !_sender_has_data (sender)) {
+    g_cond_wait_until (&sender->cond, &sender->lock,
+        g_get_monotonic_time () + SENDER_IDLE_WAIT_US);
+  }
+
+  g_atomic_int_set (&sender->sleeping, FALSE);
+
+  g_mutex_unlock (&sender->lock);
+}
+
+static gpointer
+_sender_main (gpointer data)
+{
+  Sender *sender = data;
+  HwangsaeRelay *self = sender->relay;
+  g_autoptr (GPtrArray) rings =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) _send_ring_unref);
+  gdouble fanout_lag = 0;
+
+  while (g_atomic_int_get (&sender->running)) {
+    gboolean sent = FALSE;
+    guint i;
+
+    /* Streams may come and go while we send. */
+    g_mutex_lock (&sender->lock);
+    for (i = 0; i != sender->rings->len; ++i) {
+      g_ptr_array_add (rings,
+          _send_ring_ref (g_ptr_array_index (sender->rings, i)));
+    }
+    g_mutex_unlock (&sender->lock);
+
+    for (i = 0; i != rings->len; ++i) {
+      sent |= _drain_send_ring (self, g_ptr_array_index (rings, i),
+          &fanout_lag);
+    }
+
+    g_ptr_array_remove_range (rings, 0, rings->len);
+
+    /* Nothing was queued, so a lag left over from a past burst shouldn't
+     * keep the sender looking saturated. */
+    if (!sent) {
+      fanout_lag /= 2;
+    }
+
+    g_atomic_int_set (&sender->fanout_lag, fanout_lag);
+
+    if (!sent) {
+      _sender_wait (sender);
+    }
+  }
+
+  return NULL;
+}
+
+static void
+_reap_lost_sources (HwangsaeRelay * self)
+{
+  GHashTableIter iter;
+  SinkConnection *sink;
+
+  g_atomic_int_set (&self->lost_sources, 0);
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    GSList *it = sink->sources;
+
+    while (it) {
+      SourceConnection *source = it->data;
+
+      it = it->next;
+
+      if (g_atomic_int_get (&source->lost)) {
+        _remove_subscriber (self, sink, source);
+      }
+    }
+  }
+}
+
+static void
+_publish_stats_page (HwangsaeRelay * self)
+{
+  HwangsaeStatsPage *page = self->stats_page;
+  GHashTableIter iter;
+  SinkConnection *sink;
+  guint n = 0;
+
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (n != HWANGSAE_STATS_PAGE_MAX_STREAMS &&
+      g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    HwangsaeStatsStream *slot = &page->streams[n++];
+    SRT_TRACEBSTATS stats;
+    guint64 dropped = 0;
+    guint64 thinned = 0;
+    GSList *it;
+
+    for (it = sink->sources; it; it = it->next) {
+      thinned += ((SourceConnection *) it->data)->packets_thinned;
+    }
+
+    if (srt_bstats (sink->socket, &stats, 0) == 0) {
+      dropped = stats.pktRcvDropTotal;
+    }
+
+    hwangsae_stats_page_write_begin (&slot->seq);
+    g_strlcpy (slot->stream, sink->stream, sizeof (slot->stream));
+    slot->subscribers = sink->n_sources;
+    slot->worker = sink->worker->index;
+    slot->bytes_in = __atomic_load_n (&sink->bytes_in, __ATOMIC_RELAXED);
+    slot->bytes_out = __atomic_load_n (&sink->bytes_out, __ATOMIC_RELAXED);
+    slot->packets_thinned = thinned;
+    slot->packets_dropped = dropped;
+    slot->memory_usage = sink->memory_usage;
+    hwangsae_stats_page_write_end (&slot->seq);
+  }
+
+  hwangsae_stats_page_write_begin (&page->summary.seq);
+  page->summary.n_streams = n;
+  page->summary.subscribers = self->n_sources;
+  page->summary.update_time = g_get_real_time ();
+  page->summary.memory_usage = self->memory_usage;
+  hwangsae_stats_page_write_end (&page->summary.seq);
+}
+
+static gboolean
+_emit_drained (gpointer data)
+{
+  g_autoptr (HwangsaeRelay) self = g_weak_ref_get (data);
+
+  if (self) {
+    g_signal_emit (self, signals[DRAINED_SIGNAL], 0);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_free_weak_ref (GWeakRef * ref)
+{
+  g_weak_ref_clear (ref);
+  g_free (ref);
+}
+
+/* Closes connections so that the ones left shrink linearly until the drain
+ * deadline and their reconnects, refused while draining, spread over the
+ * whole time. Streams go together with their subscribers, which can follow
+ * the publisher to where it got redirected. Only a stream too large for one
+ * batch loses subscribers first, those of the lowest class. */
+static void
+_close_draining_connections (HwangsaeRelay * self, gint64 now)
+{
+  guint target = 0;
+
+  if (now < self->drain_deadline) {
+    gint64 window = self->drain_deadline - self->drain_start;
+
+    /* Rounded up, so that the last batch goes at the deadline */
+    target = (self->drain_connections * (self->drain_deadline - now) +
+        window - 1) / window;
+  }
+
+  for (;;) {
+    guint n_connections = self->n_sources + g_hash_table_size (self->sinks);
+    GHashTableIter iter;
+    SinkConnection *sink;
+
+    if (n_connections <= target) {
+      break;
+    }
+
+    g_hash_table_iter_init (&iter, self->sinks);
+    if (!g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+      break;
+    }
+
+    if (sink->n_sources < n_connections - target) {
+      g_debug ("Closing stream %s to drain", sink->stream);
+      hwangsae_relay_remove_sink (self, sink);
+    } else {
+      _remove_subscriber (self, sink, g_slist_last (sink->sources)->data);
+    }
+  }
+}
+
+/* The relay may already be on its way to finalization, so the main context
+ * gets only a weak reference to it. */
+static void
+_check_drained (HwangsaeRelay * self, gint64 now)
+{
+  GWeakRef *ref;
+
+  if (!self->draining || self->drained) {
+    return;
+  }
+
+  /* With a deadline, publishers have to be gone too, or they would all
+   * reconnect at once when the relay shuts down. */
+  if (self->drain_deadline != 0) {
+    _close_draining_connections (self, now);
+
+    if (g_hash_table_size (self->sinks) != 0 && now < self->drain_deadline) {
+      return;
+    }
+  }
+
+  if (self->n_sources != 0) {
+    if (self->drain_deadline == 0 || now < self->drain_deadline) {
+      return;
+    }
+
+    g_debug ("Drain timed out with %u subscribers left", self->n_sources);
+  }
+
+  self->drained = TRUE;
+
+  ref = g_new0 (GWeakRef, 1);
+  g_weak_ref_init (ref, self);
+
+  g_main_context_invoke_full (self->drain_context, G_PRIORITY_DEFAULT,
+      _emit_drained, ref, (GDestroyNotify) _free_weak_ref);
+}
+
 static gpointer
-_relay_main (gpointer data)
+_worker_main (gpointer data)
 {
-  HwangsaeRelay *self = HWANGSAE_RELAY (data);
+  Worker *worker = data;
+  HwangsaeRelay *self = worker->relay;
   SRTSOCKET readfds[MAX_EPOLL_SRT_SOCKETS];
   gchar buf[1400];
+  int64_t timeout = MAX_EPOLL_WAIT_TIMEOUT_MS;
+  /* Housekeeping of the whole relay is the first worker's job. */
+  gboolean housekeeping = worker == g_ptr_array_index (self->workers, 0);
+
+  _place_worker (worker);
 
   while (self->run_relay_thread) {
     gint rnum = G_N_ELEMENTS (readfds);
+    gint n_pending = 0;
+    gint64 wait_start_time;
+    gint64 now;
+    gint n_ready;
+    gint i;
 
-    if (srt_epoll_wait (self->poll_id, readfds, &rnum, 0, 0,
-            MAX_EPOLL_WAIT_TIMEOUT_MS, NULL, 0, NULL, 0) > 0) {
+#ifdef HAVE_SCHED_GETCPU
+    g_atomic_int_set (&worker->cpu, sched_getcpu ());
+#endif
+
+    wait_start_time = g_get_monotonic_time ();
+    n_ready = srt_epoll_wait (worker->poll_id, readfds, &rnum, 0, 0,
+        timeout, NULL, 0, NULL, 0);
+    _update_utilization (worker, wait_start_time);
+
+    if (n_ready > 0) {
 
       if (!self->run_relay_thread) {
         break;
       }
 
-      while (rnum != 0) {
-        SRTSOCKET rsocket = readfds[--rnum];
-        gint recv;
-
-        LOCK_RELAY;
-
-        if (rsocket == self->sink_listen_sock ||
-            rsocket == self->source_listen_sock) {
-          /* We already added the socket to our internal structures in the
-           * accept callback, so only finalize its creation with srt_accept
-           * here */
-          srt_accept (rsocket, NULL, NULL);
-        } else {
-          do {
-            recv = srt_recv (rsocket, buf, sizeof (buf));
-
-            if (recv > 0) {
-              GSList *it = self->sink->sources;
-
-              while (it) {
-                SRTSOCKET source_socket = GPOINTER_TO_INT (it->data);
-
-                it = it->next;
-
-                if (srt_send (source_socket, buf, recv) < 0) {
-                  gint error = srt_getlasterror (NULL);
-                  if (error == SRT_ECONNLOST) {
-                    hwangsae_relay_remove_source (self, rsocket, source_socket);
-                  } else {
-                    g_debug ("srt_send failed %s", srt_strerror (error, 0));
-                  }
-                }
-              }
-            } else if (recv < 0) {
-              gint error = srt_getlasterror (NULL);
-              if (error == SRT_ECONNLOST) {
-                hwangsae_relay_remove_sink (self, rsocket);
-                break;
-              } else if (error != SRT_EASYNCRCV) {
-                g_debug ("srt_recv error %s", srt_strerror (error, 0));
-              }
-            }
-          } while (recv > 0);
+      for (i = 0; i != rnum; ++i) {
+        SRTSOCKET rsocket = readfds[i];
+        Listener *listener;
+
+        if ((listener = _find_listener (self->sink_listeners, rsocket))) {
+          LOCK_RELAY;
+          SRTSOCKET sock = srt_accept (rsocket, NULL, NULL);
+
+          if (sock != SRT_INVALID_SOCK) {
+            hwangsae_relay_add_sink (self, listener, sock);
+          }
+        } else if ((listener = _find_listener (self->source_listeners,
+                    rsocket))) {
+          LOCK_RELAY;
+          SRTSOCKET sock = srt_accept (rsocket, NULL, NULL);
+
+          if (sock != SRT_INVALID_SOCK) {
+            hwangsae_relay_add_source (self, listener, sock);
+          }
+        } else if (_receive_from_sink (self, rsocket, buf, sizeof (buf))) {
+          ++n_pending;
         }
       }
     }
+
+    /* Each ready sink gets a limited turn so that a high-bitrate one can't
+     * delay the others until its whole backlog is forwarded. Sinks with data
+     * left get their next turn right away, together with any sink that
+     * became ready in the meantime. */
+    timeout = n_pending != 0 ? 0 : MAX_EPOLL_WAIT_TIMEOUT_MS;
+
+    if (!housekeeping) {
+      continue;
+    }
+
+    if (self->n_transcoders != 0) {
+      LOCK_RELAY;
+
+      _send_all_renditions (self);
+      timeout = MIN (timeout, RENDITION_POLL_TIMEOUT_MS);
+    }
+
+    if (self->adaptive_latency) {
+      LOCK_RELAY;
+
+      _sample_peer_rtts (self);
+    }
+
+    if (self->idle_timeout != 0) {
+      LOCK_RELAY;
+
+      _reap_idle_sinks (self);
+    }
+
+    now = g_get_monotonic_time ();
+
+    if (now >= self->next_memory_check_time) {
+      LOCK_RELAY;
+
+      _enforce_memory_budget (self);
+      self->next_memory_check_time = now + MEMORY_CHECK_INTERVAL_US;
+    }
+
+    if (self->rebalance_interval != 0 && self->workers->len > 1) {
+      LOCK_RELAY;
+
+      if (now >= self->next_rebalance_time) {
+        _rebalance_workers (self);
+        self->next_rebalance_time = now +
+            self->rebalance_interval * G_TIME_SPAN_MILLISECOND;
+      }
+    }
+
+    if (g_atomic_int_get (&self->lost_sources) != 0) {
+      LOCK_RELAY;
+
+      _reap_lost_sources (self);
+    }
+
+    if (self->stats_page && now >= self->next_stats_page_time) {
+      LOCK_RELAY;
+
+      _publish_stats_page (self);
+      self->next_stats_page_time = now + STATS_PAGE_INTERVAL_US;
+    }
+
+    if (self->draining) {
+      LOCK_RELAY;
+
+      _check_drained (self, now);
+    }
   }
 
   return NULL;
 }
 
+static void
+_worker_free (Worker * worker)
+{
+  g_clear_handle_id (&worker->poll_id, srt_epoll_release);
+  g_free (worker->address);
+  g_free (worker->cpus);
+  g_free (worker);
+}
+
+static void
+_add_workers (HwangsaeRelay * self, GPtrArray * workers,
+    const gchar * address, const gchar * cpus)
+{
+  Worker *primary = NULL;
+  guint i;
+
+  for (i = 0; i != self->workers_per_address; ++i) {
+    Worker *worker = g_new0 (Worker, 1);
+
+    worker->relay = self;
+    worker->index = workers->len;
+    worker->cpu = -1;
+    worker->address = g_strdup (address);
+    worker->cpus = g_strdup (cpus);
+    worker->primary = primary ? primary : worker;
+    primary = worker->primary;
+
+    g_ptr_array_add (workers, worker);
+  }
+}
+
+static void
+_sender_free (Sender * sender)
+{
+  g_ptr_array_unref (sender->rings);
+  g_mutex_clear (&sender->lock);
+  g_cond_clear (&sender->cond);
+  g_free (sender);
+}
+
+/* The file gets replaced, so a reader that still maps the previous one
+ * sees its counters freeze instead of garbage. */
+static void
+_open_stats_page (HwangsaeRelay * self)
+{
+  HwangsaeStatsPage *page;
+  gint fd;
+
+  if (!self->stats_file || *self->stats_file == '\0') {
+    return;
+  }
+
+  g_unlink (self->stats_file);
+
+  fd = open (self->stats_file, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    g_warning ("Couldn't create stats file %s: %s", self->stats_file,
+        g_strerror (errno));
+    return;
+  }
+
+  if (ftruncate (fd, sizeof (HwangsaeStatsPage)) < 0) {
+    g_warning ("Couldn't size stats file %s: %s", self->stats_file,
+        g_strerror (errno));
+    close (fd);
+    return;
+  }
+
+  page = mmap (NULL, sizeof (HwangsaeStatsPage), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (page == MAP_FAILED) {
+    g_warning ("Couldn't map stats file %s: %s", self->stats_file,
+        g_strerror (errno));
+    return;
+  }
+
+  page->version = HWANGSAE_STATS_PAGE_VERSION;
+  page->n_workers = MIN (self->workers->len, HWANGSAE_STATS_PAGE_MAX_WORKERS);
+  /* Readers check the magic last. */
+  __atomic_store_n (&page->magic, HWANGSAE_STATS_PAGE_MAGIC, __ATOMIC_RELEASE);
+
+  self->stats_page = page;
+}
+
+static void
+_start_senders (HwangsaeRelay * self)
+{
+  guint i;
+
+  if (self->sender_threads == 0) {
+    return;
+  }
+
+  self->senders = g_ptr_array_new_with_free_func
+      ((GDestroyNotify) _sender_free);
+
+  for (i = 0; i != self->sender_threads; ++i) {
+    Sender *sender = g_new0 (Sender, 1);
+    g_autofree gchar *name = g_strdup_printf ("HwangsaeSender%u", i);
+
+    sender->relay = self;
+    sender->index = i;
+    sender->running = TRUE;
+    sender->rings = g_ptr_array_new_with_free_func
+        ((GDestroyNotify) _send_ring_unref);
+    g_mutex_init (&sender->lock);
+    g_cond_init (&sender->cond);
+
+    g_ptr_array_add (self->senders, sender);
+
+    sender->thread = g_thread_new (name, _sender_main, sender);
+  }
+}
+
+/* Entries of bind-addresses are ADDRESS or ADDRESS@CPUS. */
+static GPtrArray *
+_create_workers (HwangsaeRelay * self)
+{
+  GPtrArray *workers = g_ptr_array_new_with_free_func
+      ((GDestroyNotify) _worker_free);
+  gchar **it;
+
+  for (it = self->bind_addresses; it && *it; ++it) {
+    g_auto (GStrv) fields = g_strsplit (*it, "@", 2);
+    g_autoptr (GInetAddress) address = NULL;
+    g_autofree gchar *address_string = NULL;
+
+    g_strstrip (fields[0]);
+    address = g_inet_address_new_from_string (fields[0]);
+    if (!address) {
+      g_warning ("Ignoring invalid bind address '%s'", *it);
+      continue;
+    }
+
+    address_string = g_inet_address_to_string (address);
+    _add_workers (self, workers, address_string,
+        fields[1] && *fields[1] ? g_strstrip (fields[1]) : NULL);
+  }
+
+  if (workers->len == 0) {
+    _add_workers (self, workers, "0.0.0.0", NULL);
+  }
+
+  return workers;
+}
+
+static void
+_listener_free (Listener * listener)
+{
+  if (listener->socket != SRT_INVALID_SOCK) {
+    srt_close (listener->socket);
+  }
+  g_hash_table_unref (listener->handshakes);
+  g_free (listener);
+}
+
+static void
+_open_listeners (Worker * worker, GPtrArray * listeners, guint port,
+    guint count, gboolean accept_groups, srt_listen_callback_fn * callback)
+{
+  guint i;
+
+  if (port > G_MAXUINT16) {
+    g_error ("Invalid port %u", port);
+  }
+
+  if (port + count - 1 > G_MAXUINT16) {
+    g_warning ("Ports from %u only go up to %u, listening on %u of %u ports",
+        port, G_MAXUINT16, G_MAXUINT16 - port + 1, count);
+    count = G_MAXUINT16 - port + 1;
+  }
+
+  for (i = 0; i != count; ++i) {
+    Listener *listener = g_new0 (Listener, 1);
+
+    listener->relay = worker->relay;
+    listener->worker = worker;
+    listener->handshakes = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+    listener->port = port + i;
+    listener->socket = _srt_open_listen_sock (worker->address, listener->port,
+        accept_groups);
+    srt_listen_callback (listener->socket, callback, listener);
+    srt_epoll_add_usock (worker->poll_id, listener->socket, &SRT_POLL_EVENTS);
+
+    g_ptr_array_add (listeners, listener);
+  }
+}
+
 static void
 hwangsae_relay_init (HwangsaeRelay * self)
 {
+  guint i;
+
   if (g_atomic_int_add (&hwangsae_relay_init_refcnt, 1) == 0) {
     if (srt_startup () != 0) {
       g_error ("%s", srt_getlasterror_str ());
@@ -431,31 +4570,139 @@ hwangsae_relay_init (HwangsaeRelay * self)
 
   g_mutex_init (&self->lock);
 
+  self->sinks = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) _sink_connection_free);
+  self->users = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) _user_account_free);
+  self->sink_sockets = g_hash_table_new (NULL, NULL);
+  self->passphrases = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+  self->privileged_tokens = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, g_free);
+  self->packet_filters = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  self->udp_outputs = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  self->renditions = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  self->transcoder_pool = g_thread_pool_new (_transcoder_job_run, self, 1,
+      FALSE, NULL);
+  self->peer_rtts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
+
   self->settings = g_settings_new ("org.hwangsaeul.hwangsae.relay");
 
   g_settings_bind (self->settings, "sink-port", self, "sink-port",
       G_SETTINGS_BIND_DEFAULT);
   g_settings_bind (self->settings, "source-port", self, "source-port",
       G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "sink-port-count", self, "sink-port-count",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "source-port-count", self,
+      "source-port-count", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "bind-addresses", self, "bind-addresses",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "worker-cpus", self, "worker-cpus",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "worker-nice", self, "worker-nice",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "worker-rt-priority", self,
+      "worker-rt-priority", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "workers-per-address", self,
+      "workers-per-address", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "rebalance-interval", self,
+      "rebalance-interval", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "latency-probe", self, "latency-probe",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "stream-passphrases", self,
+      "stream-passphrases", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "pbkeylen", self, "pbkeylen",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "stream-packet-filters", self,
+      "stream-packet-filters", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "stream-udp-outputs", self,
+      "stream-udp-outputs", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "multicast-ttl", self, "multicast-ttl",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "multicast-interface", self,
+      "multicast-interface", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "stream-renditions", self,
+      "stream-renditions", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "adaptive-latency", self,
+      "adaptive-latency", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "latency-rtt-multiplier", self,
+      "latency-rtt-multiplier", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "latency-min", self, "latency-min",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "latency-max", self, "latency-max",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "max-streams-per-user", self,
+      "max-streams-per-user", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "max-subscribers-per-user", self,
+      "max-subscribers-per-user", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "max-subscribers", self,
+      "max-subscribers", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "max-subscribers-per-stream", self,
+      "max-subscribers-per-stream", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "alternate-relays", self,
+      "alternate-relays", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "idle-timeout", self, "idle-timeout",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "recv-budget", self, "recv-budget",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "thinning-threshold", self,
+      "thinning-threshold", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "memory-budget", self, "memory-budget",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "stream-memory-limit", self,
+      "stream-memory-limit", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "max-utilization", self,
+      "max-utilization", G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "max-fanout-lag", self, "max-fanout-lag",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "sender-threads", self, "sender-threads",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "stats-file", self, "stats-file",
+      G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (self->settings, "class-tokens", self, "class-tokens",
+      G_SETTINGS_BIND_DEFAULT);
 
-  self->poll_id = srt_epoll_create ();
+  self->workers = _create_workers (self);
+  _open_stats_page (self);
+  _start_senders (self);
+  self->sink_listeners = g_ptr_array_new_with_free_func
+      ((GDestroyNotify) _listener_free);
+  self->source_listeners = g_ptr_array_new_with_free_func
+      ((GDestroyNotify) _listener_free);
 
-  self->sink_listen_sock = _srt_open_listen_sock (self->sink_port);
-  srt_listen_callback (self->sink_listen_sock,
-      (srt_listen_callback_fn *) hwangsae_relay_accept_sink, self);
-  srt_epoll_add_usock (self->poll_id, self->sink_listen_sock, &SRT_POLL_EVENTS);
+  for (i = 0; i != self->workers->len; ++i) {
+    Worker *worker = g_ptr_array_index (self->workers, i);
 
-  g_debug ("URI for sink connection is %s", hwangsae_relay_get_sink_uri (self));
+    worker->poll_id = srt_epoll_create ();
+
+    if (worker->primary != worker) {
+      continue;
+    }
 
-  self->source_listen_sock = _srt_open_listen_sock (self->source_port);
-  srt_listen_callback (self->source_listen_sock,
-      (srt_listen_callback_fn *) hwangsae_relay_accept_source, self);
-  srt_epoll_add_usock (self->poll_id, self->source_listen_sock,
-      &SRT_POLL_EVENTS);
+    _open_listeners (worker, self->sink_listeners, self->sink_port,
+        self->sink_port_count, TRUE,
+        (srt_listen_callback_fn *) hwangsae_relay_accept_sink);
+    _open_listeners (worker, self->source_listeners, self->source_port,
+        self->source_port_count, FALSE,
+        (srt_listen_callback_fn *) hwangsae_relay_accept_source);
+  }
+
+  g_debug ("URI for sink connection is %s", hwangsae_relay_get_sink_uri (self));
 
   LOCK_RELAY;
   self->run_relay_thread = TRUE;
-  self->relay_thread = g_thread_new ("HwangsaeRelay", _relay_main, self);
+
+  for (i = 0; i != self->workers->len; ++i) {
+    Worker *worker = g_ptr_array_index (self->workers, i);
+    g_autofree gchar *name = g_strdup_printf ("HwangsaeRelay%u", i);
+
+    worker->thread = g_thread_new (name, _worker_main, worker);
+  }
 }
 
 HwangsaeRelay *
@@ -514,10 +4761,371 @@ const gchar *
 hwangsae_relay_get_sink_uri (HwangsaeRelay * self)
 {
   if (!self->sink_uri) {
-    g_autofree gchar *ip = _get_local_ip ();
+    Worker *worker = g_ptr_array_index (self->workers, 0);
+    g_autoptr (GInetAddress) address =
+        g_inet_address_new_from_string (worker->address);
+    g_autofree gchar *ip = NULL;
+
+    /* A wildcard address doesn't tell where to connect. */
+    if (g_inet_address_get_is_any (address)) {
+      ip = _get_local_ip ();
+    } else {
+      ip = g_strdup (worker->address);
+    }
 
-    self->sink_uri = g_strdup_printf ("srt://%s:%d", ip, self->sink_port);
+    if (strchr (ip, ':')) {
+      self->sink_uri = g_strdup_printf ("srt://[%s]:%d", ip, self->sink_port);
+    } else {
+      self->sink_uri = g_strdup_printf ("srt://%s:%d", ip, self->sink_port);
+    }
   }
 
   return self->sink_uri;
 }
+
+static GVariant *
+_source_get_stats (SourceConnection * source)
+{
+  GVariantDict dict;
+  SRT_TRACEBSTATS stats;
+  gint latency;
+  gint len = sizeof (latency);
+
+  g_variant_dict_init (&dict, NULL);
+
+  g_variant_dict_insert (&dict, "socket", "i", source->socket);
+  g_variant_dict_insert (&dict, "class", "s",
+      SUBSCRIBER_CLASS_NAMES[source->subscriber_class]);
+  if (source->peer) {
+    g_variant_dict_insert (&dict, "peer", "s", source->peer);
+  }
+  if (source->rendition) {
+    g_variant_dict_insert (&dict, "rendition", "s", source->rendition);
+  }
+  if (source->aggregate) {
+    g_variant_dict_insert (&dict, "program", "u", source->program + 1);
+  }
+  if (source->program_number != 0) {
+    g_variant_dict_insert (&dict, "split-program", "u",
+        source->program_number);
+  }
+  if (srt_bstats (source->socket, &stats, 0) == 0) {
+    g_variant_dict_insert (&dict, "rtt", "d", stats.msRTT);
+  }
+  /* The latency negotiated for the subscriber's receiver. */
+  if (srt_getsockflag (source->socket, SRTO_PEERLATENCY, &latency,
+          &len) == 0) {
+    g_variant_dict_insert (&dict, "latency", "u", latency);
+  }
+  g_variant_dict_insert (&dict, "thinning-level", "u", source->thinning_level);
+  g_variant_dict_insert (&dict, "packets-thinned", "t",
+      source->packets_thinned);
+
+  return g_variant_dict_end (&dict);
+}
+
+static GVariant *
+_sink_get_stats (SinkConnection * sink)
+{
+  GVariantDict dict;
+  GVariantBuilder sources;
+  GSList *it;
+
+  g_variant_dict_init (&dict, NULL);
+
+  g_variant_builder_init (&sources, G_VARIANT_TYPE ("aa{sv}"));
+  for (it = sink->sources; it; it = it->next) {
+    g_variant_builder_add_value (&sources, _source_get_stats (it->data));
+  }
+  g_variant_dict_insert_value (&dict, "sources",
+      g_variant_builder_end (&sources));
+
+  g_variant_dict_insert (&dict, "stream", "s", sink->stream);
+  g_variant_dict_insert (&dict, "user", "s", sink->user->name);
+  g_variant_dict_insert (&dict, "subscribers", "u",
+      g_slist_length (sink->sources));
+  g_variant_dict_insert (&dict, "bonded", "b", sink->bonded);
+  g_variant_dict_insert (&dict, "worker", "u", sink->worker->index);
+  g_variant_dict_insert (&dict, "forward-time", "t",
+      __atomic_load_n (&sink->forward_time, __ATOMIC_RELAXED));
+  g_variant_dict_insert (&dict, "memory-usage", "t", sink->memory_usage);
+  g_variant_dict_insert (&dict, "bytes-in", "t",
+      __atomic_load_n (&sink->bytes_in, __ATOMIC_RELAXED));
+  g_variant_dict_insert (&dict, "bytes-out", "t",
+      __atomic_load_n (&sink->bytes_out, __ATOMIC_RELAXED));
+
+  if (sink->ring) {
+    g_variant_dict_insert (&dict, "sender", "u", sink->ring->sender->index);
+    g_variant_dict_insert (&dict, "send-ring-stalls", "t", sink->ring->stalls);
+  }
+
+  if (sink->n_rendition_sources != 0) {
+    g_variant_dict_insert (&dict, "transcoding", "b",
+        sink->transcoder != NULL);
+  }
+
+  if (sink->udp_output) {
+    g_variant_dict_insert (&dict, "udp-packets-sent", "t",
+        hwangsae_udp_output_get_packets_sent (sink->udp_output));
+    g_variant_dict_insert (&dict, "udp-send-calls", "t",
+        hwangsae_udp_output_get_send_calls (sink->udp_output));
+  }
+
+#ifdef HAVE_SRT_GROUPS
+  if (sink->bonded) {
+    SRT_SOCKGROUPDATA links[MAX_GROUP_LINKS];
+    size_t n_links = G_N_ELEMENTS (links);
+    gint n = srt_group_data (sink->socket, links, &n_links);
+
+    g_variant_dict_insert (&dict, "links", "u", MAX (n, 0));
+  }
+#endif
+
+  return g_variant_dict_end (&dict);
+}
+
+static GVariant *
+_user_get_stats (UserAccount * user)
+{
+  GVariantDict dict;
+
+  g_variant_dict_init (&dict, NULL);
+
+  g_variant_dict_insert (&dict, "user", "s", user->name);
+  g_variant_dict_insert (&dict, "streams", "u",
+      g_atomic_int_get (&user->streams));
+  g_variant_dict_insert (&dict, "subscribers", "u",
+      g_atomic_int_get (&user->subscribers));
+  g_variant_dict_insert (&dict, "bytes-in", "t",
+      __atomic_load_n (&user->bytes_in, __ATOMIC_RELAXED));
+  g_variant_dict_insert (&dict, "bytes-out", "t",
+      __atomic_load_n (&user->bytes_out, __ATOMIC_RELAXED));
+
+  return g_variant_dict_end (&dict);
+}
+
+static void
+_add_listener_stats (GVariantBuilder * builder, GPtrArray * listeners,
+    const gchar * role)
+{
+  guint i;
+
+  for (i = 0; i != listeners->len; ++i) {
+    Listener *listener = g_ptr_array_index (listeners, i);
+    GVariantDict dict;
+
+    g_variant_dict_init (&dict, NULL);
+    g_variant_dict_insert (&dict, "role", "s", role);
+    g_variant_dict_insert (&dict, "address", "s", listener->worker->address);
+    g_variant_dict_insert (&dict, "port", "u", listener->port);
+    g_variant_dict_insert (&dict, "connections", "u",
+        listener->n_connections);
+
+    g_variant_builder_add_value (builder, g_variant_dict_end (&dict));
+  }
+}
+
+/* Reports where the kernel actually runs the worker thread, which may
+ * differ from what the settings asked for. */
+static GVariant *
+_worker_get_stats (Worker * worker)
+{
+  GVariantDict dict;
+  gint tid = g_atomic_int_get (&worker->tid);
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "address", "s", worker->address);
+  g_variant_dict_insert (&dict, "streams", "u", worker->n_sinks);
+  g_variant_dict_insert (&dict, "busy-time", "t", worker->busy_time);
+  g_variant_dict_insert (&dict, "utilization", "u",
+      g_atomic_int_get (&worker->utilization));
+  g_variant_dict_insert (&dict, "fanout-lag", "t",
+      (guint64) g_atomic_int_get (&worker->fanout_lag));
+
+  if (tid != 0) {
+    struct sched_param param;
+    gint policy;
+    gint nice;
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t cpus;
+
+    if (sched_getaffinity (tid, sizeof (cpus), &cpus) == 0) {
+      g_autofree gchar *cpu_list = _format_cpu_list (&cpus);
+
+      g_variant_dict_insert (&dict, "cpus", "s", cpu_list);
+    }
+#endif
+
+    g_variant_dict_insert (&dict, "thread-id", "i", tid);
+
+    policy = sched_getscheduler (tid);
+    if (policy >= 0 && sched_getparam (tid, &param) == 0) {
+      g_variant_dict_insert (&dict, "policy", "s", _sched_policy_name (policy));
+      g_variant_dict_insert (&dict, "priority", "i", param.sched_priority);
+    }
+
+    errno = 0;
+    nice = getpriority (PRIO_PROCESS, tid);
+    if (errno == 0) {
+      g_variant_dict_insert (&dict, "nice", "i", nice);
+    }
+  }
+
+  g_variant_dict_insert (&dict, "cpu", "i", g_atomic_int_get (&worker->cpu));
+
+  return g_variant_dict_end (&dict);
+}
+
+void
+hwangsae_relay_drain (HwangsaeRelay * self, guint timeout)
+{
+  g_return_if_fail (HWANGSAE_IS_RELAY (self));
+
+  LOCK_RELAY;
+
+  if (self->draining) {
+    return;
+  }
+
+  g_debug ("Draining the relay with %u subscribers", self->n_sources);
+
+  self->draining = TRUE;
+  self->drain_start = g_get_monotonic_time ();
+  self->drain_deadline = timeout == 0 ? 0 :
+      self->drain_start + timeout * G_TIME_SPAN_SECOND;
+  self->drain_connections = self->n_sources + g_hash_table_size (self->sinks);
+  self->drain_context = g_main_context_ref_thread_default ();
+}
+
+guint
+hwangsae_relay_pick_sink_port (HwangsaeRelay * self, const gchar ** address)
+{
+  Listener *listener;
+
+  g_return_val_if_fail (HWANGSAE_IS_RELAY (self), 0);
+
+  LOCK_RELAY;
+
+  listener = _least_loaded_listener (self->sink_listeners, NULL);
+  if (address) {
+    *address = listener->worker->address;
+  }
+
+  return listener->port;
+}
+
+guint
+hwangsae_relay_pick_source_port (HwangsaeRelay * self, const gchar ** address)
+{
+  Listener *listener;
+
+  g_return_val_if_fail (HWANGSAE_IS_RELAY (self), 0);
+
+  LOCK_RELAY;
+
+  listener = _least_loaded_listener (self->source_listeners, NULL);
+  if (address) {
+    *address = listener->worker->address;
+  }
+
+  return listener->port;
+}
+
+GVariant *
+hwangsae_relay_get_stats (HwangsaeRelay * self)
+{
+  GVariantDict dict;
+  GVariantBuilder streams;
+  GVariantBuilder users;
+  GVariantBuilder listeners;
+  GVariantBuilder workers;
+  GHashTableIter iter;
+  SinkConnection *sink;
+  UserAccount *user;
+  guint i;
+
+  g_return_val_if_fail (HWANGSAE_IS_RELAY (self), NULL);
+
+  LOCK_RELAY;
+
+  g_variant_dict_init (&dict, NULL);
+
+  g_variant_builder_init (&streams, G_VARIANT_TYPE ("aa{sv}"));
+  g_hash_table_iter_init (&iter, self->sinks);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sink)) {
+    g_variant_builder_add_value (&streams, _sink_get_stats (sink));
+  }
+  g_variant_dict_insert_value (&dict, "streams",
+      g_variant_builder_end (&streams));
+
+  g_variant_builder_init (&users, G_VARIANT_TYPE ("aa{sv}"));
+  g_hash_table_iter_init (&iter, self->users);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & user)) {
+    g_variant_builder_add_value (&users, _user_get_stats (user));
+  }
+  g_variant_dict_insert_value (&dict, "users", g_variant_builder_end (&users));
+
+  g_variant_builder_init (&listeners, G_VARIANT_TYPE ("aa{sv}"));
+  _add_listener_stats (&listeners, self->sink_listeners, "sink");
+  _add_listener_stats (&listeners, self->source_listeners, "source");
+  g_variant_dict_insert_value (&dict, "listeners",
+      g_variant_builder_end (&listeners));
+
+  g_variant_builder_init (&workers, G_VARIANT_TYPE ("aa{sv}"));
+  for (i = 0; i != self->workers->len; ++i) {
+    g_variant_builder_add_value (&workers,
+        _worker_get_stats (g_ptr_array_index (self->workers, i)));
+  }
+  g_variant_dict_insert_value (&dict, "workers",
+      g_variant_builder_end (&workers));
+
+  if (self->senders) {
+    GVariantBuilder senders;
+
+    g_variant_builder_init (&senders, G_VARIANT_TYPE ("aa{sv}"));
+    for (i = 0; i != self->senders->len; ++i) {
+      Sender *sender = g_ptr_array_index (self->senders, i);
+      GVariantDict sender_dict;
+
+      g_variant_dict_init (&sender_dict, NULL);
+      g_variant_dict_insert (&sender_dict, "streams", "u", sender->rings->len);
+      g_variant_dict_insert (&sender_dict, "fanout-lag", "t",
+          (guint64) g_atomic_int_get (&sender->fanout_lag));
+      g_variant_builder_add_value (&senders, g_variant_dict_end (&sender_dict));
+    }
+    g_variant_dict_insert_value (&dict, "senders",
+        g_variant_builder_end (&senders));
+  }
+
+  g_variant_dict_insert (&dict, "subscribers", "u", self->n_sources);
+  g_variant_dict_insert (&dict, "draining", "b", self->draining);
+  /* Clients resolve HWANGSAE_REJECT_REDIRECT against this list. */
+  g_variant_dict_insert_value (&dict, "alternate-relays",
+      g_variant_new_strv ((const gchar * const *) self->alternate_relays,
+          self->alternate_relays ? -1 : 0));
+  g_variant_dict_insert (&dict, "idle-sinks-reaped", "t",
+      self->idle_sinks_reaped);
+  g_variant_dict_insert (&dict, "streams-moved", "t", self->streams_moved);
+
+  g_variant_dict_insert (&dict, "memory-usage", "t", self->memory_usage);
+  g_variant_dict_insert (&dict, "memory-pressure", "s",
+      _memory_pressure_name (self->memory_pressure));
+  g_variant_dict_insert (&dict, "subscribers-shed", "t",
+      self->subscribers_shed);
+  g_variant_dict_insert (&dict, "connections-refused", "t",
+      self->connections_refused);
+
+  g_variant_dict_insert (&dict, "residence-samples", "t",
+      self->residence_samples);
+  g_variant_dict_insert (&dict, "residence-time-avg", "t",
+      self->residence_samples ?
+      self->residence_sum / self->residence_samples : 0);
+  g_variant_dict_insert (&dict, "residence-time-max", "t",
+      self->residence_max);
+  g_variant_dict_insert (&dict, "probe-markers-injected", "t",
+      self->probes_injected);
+  g_variant_dict_insert (&dict, "probe-markers-stamped", "t",
+      self->probes_stamped);
+
+  return g_variant_dict_end (&dict);
+}
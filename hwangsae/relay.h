@@ -24,6 +24,7 @@
 #endif
 
 #include <glib-object.h>
+#include "types.h"
 
 G_BEGIN_DECLS
 
@@ -35,6 +36,22 @@ HwangsaeRelay          *hwangsae_relay_new              (void);
 
 const gchar            *hwangsae_relay_get_sink_uri     (HwangsaeRelay *relay);
 
+GVariant               *hwangsae_relay_get_stats        (HwangsaeRelay *relay);
+
+/* Stops taking new connections and emits "drained" once the subscribers
+ * left. With a timeout in seconds, the relay closes its publishers and
+ * subscribers in batches spread over it instead of waiting for them. */
+void                    hwangsae_relay_drain            (HwangsaeRelay *relay,
+                                                         guint timeout);
+
+/* Returns the least loaded port over all bind addresses and, unless address
+ * is NULL, the address it's bound to. The address is owned by the relay. */
+guint                   hwangsae_relay_pick_sink_port   (HwangsaeRelay *relay,
+                                                         const gchar **address);
+
+guint                   hwangsae_relay_pick_source_port (HwangsaeRelay *relay,
+                                                         const gchar **address);
+
 G_END_DECLS
 
 #endif // __HWANGSAE_RELAY_H__
@@ -0,0 +1,128 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __HWANGSAE_STATS_PAGE_H__
+#define __HWANGSAE_STATS_PAGE_H__
+
+#if !defined(HWANGSAE_COMPILATION)
+#error "This is a private header of the Hwangsae library."
+#endif
+
+#include <glib.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+/* Layout of the file a relay with stats-file set keeps mapped and updates
+ * while it runs. Each block has a single writer that brackets its updates
+ * with hwangsae_stats_page_write_begin() and _end(), readers copy it with
+ * hwangsae_stats_page_read() and retry when that fails. Nothing ever
+ * waits for a reader. */
+
+#define HWANGSAE_STATS_PAGE_MAGIC       0x48575354      /* "HWST" */
+#define HWANGSAE_STATS_PAGE_VERSION     1
+
+#define HWANGSAE_STATS_PAGE_MAX_WORKERS 64
+#define HWANGSAE_STATS_PAGE_MAX_STREAMS 256
+
+/* Written by relay housekeeping. */
+typedef struct
+{
+  guint32 seq;
+  guint32 n_streams;
+  guint32 subscribers;
+  guint32 reserved;
+  /* Wall-clock time of the last update in microseconds */
+  gint64 update_time;
+  guint64 memory_usage;
+} HwangsaeStatsSummary;
+
+/* Written by the worker thread itself, once a second. */
+typedef struct
+{
+  guint32 seq;
+  guint32 streams;
+  /* Percent of time spent outside of epoll wait */
+  guint32 utilization;
+  /* Microseconds from reading a packet to having sent it */
+  guint32 fanout_lag;
+  guint64 busy_time;
+} HwangsaeStatsWorker;
+
+/* Written by relay housekeeping. Slots past n_streams are stale and slots
+ * may change streams between updates, readers match them by name. */
+typedef struct
+{
+  guint32 seq;
+  guint32 subscribers;
+  guint32 worker;
+  guint32 reserved;
+  gchar stream[64];
+  guint64 bytes_in;
+  guint64 bytes_out;
+  /* Packets kept from lagging subscribers by frame thinning */
+  guint64 packets_thinned;
+  /* Packets the publisher's connection lost for good */
+  guint64 packets_dropped;
+  guint64 memory_usage;
+} HwangsaeStatsStream;
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint32 n_workers;
+  guint32 reserved;
+  HwangsaeStatsSummary summary;
+  HwangsaeStatsWorker workers[HWANGSAE_STATS_PAGE_MAX_WORKERS];
+  HwangsaeStatsStream streams[HWANGSAE_STATS_PAGE_MAX_STREAMS];
+} HwangsaeStatsPage;
+
+static inline void
+hwangsae_stats_page_write_begin (guint32 * seq)
+{
+  __atomic_store_n (seq, *seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+static inline void
+hwangsae_stats_page_write_end (guint32 * seq)
+{
+  __atomic_store_n (seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Copies the block guarded by seq into dst. Returns FALSE when the writer
+ * was in the middle of an update. */
+static inline gboolean
+hwangsae_stats_page_read (const guint32 * seq, const void *src, void *dst,
+    gsize size)
+{
+  guint32 start = __atomic_load_n (seq, __ATOMIC_ACQUIRE);
+
+  if (start & 1) {
+    return FALSE;
+  }
+
+  memcpy (dst, src, size);
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+  return __atomic_load_n (seq, __ATOMIC_RELAXED) == start;
+}
+
+G_END_DECLS
+
+#endif // __HWANGSAE_STATS_PAGE_H__
@@ -0,0 +1,305 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "transcoder.h"
+
+#include <gio/gio.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <stdlib.h>
+
+/* Input beyond this gets dropped rather than queued when the encoders can't
+ * keep up. */
+#define MAX_QUEUED_INPUT_BYTES  (4 * 1024 * 1024)
+
+typedef struct
+{
+  gchar *name;
+  guint height;
+  guint bitrate;
+  GstElement *appsink;
+} Rendition;
+
+struct _HwangsaeTranscoder
+{
+  GstElement *pipeline;
+  GstElement *appsrc;
+  GArray *renditions;
+  /* Rendition to pull from first, so that none of them starves */
+  guint next_rendition;
+  gboolean trimmed;
+};
+
+static void
+_rendition_clear (Rendition * rendition)
+{
+  g_free (rendition->name);
+  g_clear_object (&rendition->appsink);
+}
+
+static gboolean
+_parse_rendition (const gchar * spec, Rendition * rendition)
+{
+  g_auto (GStrv) fields = g_strsplit (spec, ":", 2);
+  gchar *end;
+
+  rendition->height = strtoul (fields[0], &end, 10);
+  if (rendition->height == 0 || g_strcmp0 (end, "p") != 0) {
+    return FALSE;
+  }
+
+  if (fields[1]) {
+    rendition->bitrate = strtoul (fields[1], &end, 10);
+    if (rendition->bitrate == 0 || *end != '\0') {
+      return FALSE;
+    }
+  } else {
+    /* Scales with the number of pixels, about 2.6 Mbit/s at 720p. */
+    rendition->bitrate = rendition->height * rendition->height / 200;
+  }
+
+  rendition->name = g_strdup (fields[0]);
+
+  return TRUE;
+}
+
+static GArray *
+_parse_ladder (const gchar * ladder, GError ** error)
+{
+  g_autoptr (GArray) renditions = g_array_new (FALSE, TRUE,
+      sizeof (Rendition));
+  g_auto (GStrv) specs = g_strsplit (ladder, ",", -1);
+  gchar **it;
+
+  g_array_set_clear_func (renditions, (GDestroyNotify) _rendition_clear);
+
+  for (it = specs; *it; ++it) {
+    Rendition rendition = { 0 };
+
+    g_strstrip (*it);
+    if (**it == '\0') {
+      continue;
+    }
+
+    if (!_parse_rendition (*it, &rendition)) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+          "Invalid rendition '%s'", *it);
+      return NULL;
+    }
+
+    g_array_append_val (renditions, rendition);
+  }
+
+  return g_steal_pointer (&renditions);
+}
+
+gboolean
+hwangsae_transcoder_ladder_has_rendition (const gchar * ladder,
+    const gchar * rendition)
+{
+  g_autoptr (GArray) renditions = _parse_ladder (ladder, NULL);
+  guint i;
+
+  if (!renditions) {
+    return FALSE;
+  }
+
+  for (i = 0; i != renditions->len; ++i) {
+    if (g_str_equal (g_array_index (renditions, Rendition, i).name,
+            rendition)) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* No main loop watches the pipeline's bus, messages get handled as they're
+ * posted instead of piling up in its queue. */
+static GstBusSyncReply
+_bus_sync_handler (GstBus * bus, GstMessage * message, gpointer user_data)
+{
+  g_autoptr (GError) error = NULL;
+
+  switch (GST_MESSAGE_TYPE (message)) {
+    case GST_MESSAGE_ERROR:
+      gst_message_parse_error (message, &error, NULL);
+      g_warning ("Transcoding failed in %s: %s", GST_OBJECT_NAME
+          (GST_MESSAGE_SRC (message)), error->message);
+      break;
+    case GST_MESSAGE_WARNING:
+      gst_message_parse_warning (message, &error, NULL);
+      g_debug ("Transcoding warning from %s: %s", GST_OBJECT_NAME
+          (GST_MESSAGE_SRC (message)), error->message);
+      break;
+    default:
+      break;
+  }
+
+  return GST_BUS_DROP;
+}
+
+HwangsaeTranscoder *
+hwangsae_transcoder_new (const gchar * ladder, GError ** error)
+{
+  g_autoptr (HwangsaeTranscoder) transcoder = g_new0 (HwangsaeTranscoder, 1);
+  g_autoptr (GString) pipeline_str = NULL;
+  g_autoptr (GError) parse_error = NULL;
+  g_autoptr (GstBus) bus = NULL;
+  GstElement *pipeline;
+  guint i;
+
+  if (!gst_is_initialized ()) {
+    gst_init (NULL, NULL);
+  }
+
+  transcoder->renditions = _parse_ladder (ladder, error);
+  if (!transcoder->renditions) {
+    return NULL;
+  }
+
+  if (transcoder->renditions->len == 0) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "Empty rendition ladder");
+    return NULL;
+  }
+
+  pipeline_str = g_string_new ("appsrc name=src is-live=true format=time "
+      "do-timestamp=true caps=video/mpegts,systemstream=true,packetsize=188 ! "
+      "tsdemux ! h264parse ! avdec_h264 ! tee name=decoded ");
+
+  for (i = 0; i != transcoder->renditions->len; ++i) {
+    Rendition *rendition = &g_array_index (transcoder->renditions, Rendition,
+        i);
+
+    /* A slow encoder drops pictures instead of stalling the others. */
+    g_string_append_printf (pipeline_str,
+        "decoded. ! queue leaky=downstream max-size-buffers=4 ! videoscale ! "
+        "videoconvert ! video/x-raw,height=%u,pixel-aspect-ratio=1/1 ! "
+        "x264enc tune=zerolatency speed-preset=veryfast bitrate=%u "
+        "key-int-max=60 ! h264parse config-interval=-1 ! "
+        "mpegtsmux alignment=7 ! appsink name=rendition%u sync=false "
+        "max-buffers=256 drop=true ", rendition->height, rendition->bitrate,
+        i);
+  }
+
+  pipeline = gst_parse_launch (pipeline_str->str, &parse_error);
+  if (pipeline) {
+    transcoder->pipeline = gst_object_ref_sink (pipeline);
+  }
+
+  /* Missing elements don't make the parser give up. */
+  if (parse_error) {
+    g_propagate_error (error, g_steal_pointer (&parse_error));
+    return NULL;
+  }
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (transcoder->pipeline));
+  gst_bus_set_sync_handler (bus, _bus_sync_handler, NULL, NULL);
+
+  transcoder->appsrc = gst_bin_get_by_name (GST_BIN (transcoder->pipeline),
+      "src");
+
+  for (i = 0; i != transcoder->renditions->len; ++i) {
+    Rendition *rendition = &g_array_index (transcoder->renditions, Rendition,
+        i);
+    g_autofree gchar *name = g_strdup_printf ("rendition%u", i);
+
+    rendition->appsink = gst_bin_get_by_name (GST_BIN (transcoder->pipeline),
+        name);
+  }
+
+  if (gst_element_set_state (transcoder->pipeline,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+        "Couldn't start the transcoding pipeline");
+    return NULL;
+  }
+
+  return g_steal_pointer (&transcoder);
+}
+
+void
+hwangsae_transcoder_free (HwangsaeTranscoder * transcoder)
+{
+  if (transcoder->pipeline) {
+    gst_element_set_state (transcoder->pipeline, GST_STATE_NULL);
+  }
+
+  g_clear_pointer (&transcoder->renditions, g_array_unref);
+  g_clear_object (&transcoder->appsrc);
+  g_clear_object (&transcoder->pipeline);
+  g_free (transcoder);
+}
+
+void
+hwangsae_transcoder_push (HwangsaeTranscoder * transcoder,
+    const guint8 * data, gsize len)
+{
+  GstAppSrc *appsrc = GST_APP_SRC (transcoder->appsrc);
+  GstBuffer *buffer;
+
+  if (transcoder->trimmed ||
+      gst_app_src_get_current_level_bytes (appsrc) > MAX_QUEUED_INPUT_BYTES) {
+    return;
+  }
+
+  buffer = gst_buffer_new_allocate (NULL, len, NULL);
+  gst_buffer_fill (buffer, 0, data, len);
+
+  gst_app_src_push_buffer (appsrc, buffer);
+}
+
+guint64
+hwangsae_transcoder_get_queued_bytes (HwangsaeTranscoder * transcoder)
+{
+  return gst_app_src_get_current_level_bytes (GST_APP_SRC
+      (transcoder->appsrc));
+}
+
+void
+hwangsae_transcoder_set_trimmed (HwangsaeTranscoder * transcoder,
+    gboolean trimmed)
+{
+  transcoder->trimmed = trimmed;
+}
+
+GstBuffer *
+hwangsae_transcoder_pull (HwangsaeTranscoder * transcoder,
+    const gchar ** rendition_name)
+{
+  guint n = transcoder->renditions->len;
+  guint i;
+
+  for (i = 0; i != n; ++i) {
+    guint index = (transcoder->next_rendition + i) % n;
+    Rendition *rendition = &g_array_index (transcoder->renditions, Rendition,
+        index);
+    g_autoptr (GstSample) sample = NULL;
+
+    sample = gst_app_sink_try_pull_sample (GST_APP_SINK (rendition->appsink),
+        0);
+    if (sample) {
+      transcoder->next_rendition = index + 1;
+      *rendition_name = rendition->name;
+
+      return gst_buffer_ref (gst_sample_get_buffer (sample));
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,69 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __HWANGSAE_TRANSCODER_H__
+#define __HWANGSAE_TRANSCODER_H__
+
+#if !defined(HWANGSAE_COMPILATION)
+#error "This is a private header of the Hwangsae library."
+#endif
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Produces a ladder of lower-bitrate renditions of an H.264 MPEG-TS stream.
+ * The input gets decoded once and each rendition is a scaled encode of the
+ * decoded pictures, muxed back into MPEG-TS.
+ *
+ * The ladder is a comma-separated list of renditions named after their
+ * picture height, optionally followed by the bitrate in kbit/s, e.g.
+ * "720p,480p:800,240p". Only the video gets transcoded. */
+typedef struct _HwangsaeTranscoder HwangsaeTranscoder;
+
+HwangsaeTranscoder     *hwangsae_transcoder_new         (const gchar * ladder,
+                                                         GError ** error);
+
+void                    hwangsae_transcoder_free        (HwangsaeTranscoder * transcoder);
+
+gboolean                hwangsae_transcoder_ladder_has_rendition
+                                                        (const gchar * ladder,
+                                                         const gchar * rendition);
+
+void                    hwangsae_transcoder_push        (HwangsaeTranscoder * transcoder,
+                                                         const guint8 * data,
+                                                         gsize len);
+
+/* Bytes of input waiting to be decoded. */
+guint64                 hwangsae_transcoder_get_queued_bytes
+                                                        (HwangsaeTranscoder * transcoder);
+
+/* While trimmed, the transcoder drops its input so that the queued data
+ * drains. */
+void                    hwangsae_transcoder_set_trimmed (HwangsaeTranscoder * transcoder,
+                                                         gboolean trimmed);
+
+/* Returns the next chunk of any rendition's output without blocking, or NULL
+ * when there's none. */
+GstBuffer              *hwangsae_transcoder_pull        (HwangsaeTranscoder * transcoder,
+                                                         const gchar ** rendition);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (HwangsaeTranscoder, hwangsae_transcoder_free)
+
+G_END_DECLS
+
+#endif // __HWANGSAE_TRANSCODER_H__
@@ -35,4 +35,25 @@ typedef enum {
   HWANGSAE_CONTAINER_TS,
 } HwangsaeContainer;
 
+/* Reject reasons a relay reports to refused SRT callers through
+ * srt_getrejectreason(). They lie in the user-defined range of SRT reject
+ * codes. */
+typedef enum {
+  HWANGSAE_REJECT_STREAM_FULL = 2001,
+  HWANGSAE_REJECT_RELAY_FULL = 2002,
+  HWANGSAE_REJECT_USER_QUOTA = 2003,
+  /* The relay is short of resources and sheds load. */
+  HWANGSAE_REJECT_OVERLOADED = 2004,
+  /* The relay is about to shut down. */
+  HWANGSAE_REJECT_DRAINING = 2005,
+  /* Try the alternate relay at index (reason - HWANGSAE_REJECT_REDIRECT)
+   * of the relay's "alternate-relays" list. Clients get the list from the
+   * relay's stats or must be configured with the same list in the same
+   * order. */
+  HWANGSAE_REJECT_REDIRECT = 2100,
+  /* Reconnect to the same relay at the port that is
+   * (reason - HWANGSAE_REJECT_REDIRECT_PORT) above the one tried. */
+  HWANGSAE_REJECT_REDIRECT_PORT = 2200,
+} HwangsaeRejectReason;
+
 #endif // __HWANGSAE_TYPES_H__
@@ -0,0 +1,381 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include "udp-output.h"
+
+#include <gio/gio.h>
+#include <errno.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* GSO can't put more than 64 segments into one datagram. */
+#define UDP_BATCH_PACKETS       32
+#define UDP_MAX_PAYLOAD         1472
+
+typedef struct
+{
+  gint fd;
+  gchar *name;
+} UdpDestination;
+
+struct _HwangsaeUdpOutput
+{
+  GArray *destinations;
+
+  guint8 batch[UDP_BATCH_PACKETS * UDP_MAX_PAYLOAD];
+  gsize sizes[UDP_BATCH_PACKETS];
+  guint n_packets;
+  gsize batch_len;
+
+  gboolean gso;
+
+  guint64 packets_sent;
+  guint64 send_calls;
+};
+
+static void
+_udp_destination_clear (UdpDestination * destination)
+{
+  if (destination->fd >= 0) {
+    close (destination->fd);
+  }
+  g_free (destination->name);
+}
+
+/* Receivers on the relay host itself get a copy of the stream too. */
+static gboolean
+_set_multicast_options (gint fd, gint family, guint ttl,
+    const gchar * interface, GError ** error)
+{
+  guint ifindex = 0;
+  gint hops = ttl;
+  gint loop = 1;
+  gint res;
+
+  if (interface && *interface) {
+    ifindex = if_nametoindex (interface);
+    if (ifindex == 0) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+          "No such network interface %s", interface);
+      return FALSE;
+    }
+  }
+
+  if (family == AF_INET) {
+    struct ip_mreqn mreq = {.imr_ifindex = ifindex };
+
+    res = setsockopt (fd, IPPROTO_IP, IP_MULTICAST_TTL, &hops, sizeof (hops));
+    res |= setsockopt (fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+        sizeof (loop));
+    if (ifindex != 0) {
+      res |= setsockopt (fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq,
+          sizeof (mreq));
+    }
+  } else {
+    res = setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops,
+        sizeof (hops));
+    res |= setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop,
+        sizeof (loop));
+    if (ifindex != 0) {
+      res |= setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex,
+          sizeof (ifindex));
+    }
+  }
+
+  if (res != 0) {
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+        "Couldn't set up multicast: %s", g_strerror (errno));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+_udp_destination_open (UdpDestination * destination, const gchar * uri,
+    guint multicast_ttl, const gchar * multicast_interface, GError ** error)
+{
+  g_autoptr (GSocketConnectable) connectable = NULL;
+  g_autoptr (GInetAddress) address = NULL;
+  g_autoptr (GSocketAddress) sockaddr = NULL;
+  struct sockaddr_storage native;
+  GNetworkAddress *network_address;
+
+  connectable = g_network_address_parse (uri, 0, error);
+  if (!connectable) {
+    return FALSE;
+  }
+
+  network_address = G_NETWORK_ADDRESS (connectable);
+
+  /* Resolving host names would block the relay thread. */
+  address = g_inet_address_new_from_string
+      (g_network_address_get_hostname (network_address));
+  if (!address || g_network_address_get_port (network_address) == 0) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "UDP destination %s must be a numeric address and a port", uri);
+    return FALSE;
+  }
+
+  sockaddr = g_inet_socket_address_new (address,
+      g_network_address_get_port (network_address));
+  if (!g_socket_address_to_native (sockaddr, &native, sizeof (native), error)) {
+    return FALSE;
+  }
+
+  destination->fd = socket (native.ss_family,
+      SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (destination->fd < 0) {
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+        "Couldn't open UDP socket to %s: %s", uri, g_strerror (errno));
+    return FALSE;
+  }
+
+  if (g_inet_address_get_is_multicast (address) &&
+      !_set_multicast_options (destination->fd, native.ss_family,
+          multicast_ttl, multicast_interface, error)) {
+    return FALSE;
+  }
+
+  if (connect (destination->fd, (struct sockaddr *) &native,
+          g_socket_address_get_native_size (sockaddr)) < 0) {
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+        "Couldn't connect UDP socket to %s: %s", uri, g_strerror (errno));
+    return FALSE;
+  }
+
+  destination->name = g_strdup (uri);
+
+  return TRUE;
+}
+
+HwangsaeUdpOutput *
+hwangsae_udp_output_new (const gchar * destinations, guint multicast_ttl,
+    const gchar * multicast_interface, GError ** error)
+{
+  g_autoptr (HwangsaeUdpOutput) output = g_new0 (HwangsaeUdpOutput, 1);
+  g_auto (GStrv) uris = g_strsplit (destinations, ",", -1);
+  gchar **it;
+
+  output->destinations = g_array_new (FALSE, TRUE, sizeof (UdpDestination));
+  g_array_set_clear_func (output->destinations,
+      (GDestroyNotify) _udp_destination_clear);
+
+#ifdef HAVE_UDP_SEGMENT
+  output->gso = TRUE;
+#endif
+
+  for (it = uris; *it; ++it) {
+    UdpDestination destination = {.fd = -1 };
+
+    g_strstrip (*it);
+    if (**it == '\0') {
+      continue;
+    }
+
+    if (!_udp_destination_open (&destination, *it, multicast_ttl,
+            multicast_interface, error)) {
+      _udp_destination_clear (&destination);
+      return NULL;
+    }
+
+    g_array_append_val (output->destinations, destination);
+  }
+
+  return g_steal_pointer (&output);
+}
+
+void
+hwangsae_udp_output_free (HwangsaeUdpOutput * output)
+{
+  g_clear_pointer (&output->destinations, g_array_unref);
+  g_free (output);
+}
+
+void
+hwangsae_udp_output_queue (HwangsaeUdpOutput * output, const guint8 * data,
+    gsize len)
+{
+  g_return_if_fail (len <= UDP_MAX_PAYLOAD);
+
+  if (output->n_packets == UDP_BATCH_PACKETS) {
+    hwangsae_udp_output_flush (output);
+  }
+
+  memcpy (output->batch + output->batch_len, data, len);
+  output->sizes[output->n_packets++] = len;
+  output->batch_len += len;
+}
+
+#ifdef HAVE_UDP_SEGMENT
+/* All segments of a GSO datagram but the last must have the same size. */
+static gboolean
+_batch_allows_gso (HwangsaeUdpOutput * output)
+{
+  guint i;
+
+  if (output->n_packets < 2) {
+    return FALSE;
+  }
+
+  for (i = 1; i != output->n_packets - 1; ++i) {
+    if (output->sizes[i] != output->sizes[0]) {
+      return FALSE;
+    }
+  }
+
+  return output->sizes[output->n_packets - 1] <= output->sizes[0];
+}
+
+static gboolean
+_send_gso (HwangsaeUdpOutput * output, UdpDestination * destination)
+{
+  struct iovec iov = {
+    .iov_base = output->batch,
+    .iov_len = output->batch_len
+  };
+  guint8 control[CMSG_SPACE (sizeof (guint16))] = { 0 };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof (control)
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+  guint16 segment_size = output->sizes[0];
+
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (segment_size));
+  memcpy (CMSG_DATA (cmsg), &segment_size, sizeof (segment_size));
+
+  ++output->send_calls;
+
+  if (sendmsg (destination->fd, &msg, 0) < 0) {
+    if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+        errno == EOPNOTSUPP) {
+      /* The kernel or the outgoing device can't segment for us. */
+      g_debug ("Disabling UDP GSO: %s", g_strerror (errno));
+      output->gso = FALSE;
+      return FALSE;
+    }
+
+    g_debug ("UDP send to %s failed: %s", destination->name,
+        g_strerror (errno));
+    return TRUE;
+  }
+
+  output->packets_sent += output->n_packets;
+
+  return TRUE;
+}
+#endif
+
+static void
+_send_batch (HwangsaeUdpOutput * output, UdpDestination * destination)
+{
+#ifdef HAVE_SENDMMSG
+  struct mmsghdr msgs[UDP_BATCH_PACKETS] = { 0 };
+  struct iovec iovs[UDP_BATCH_PACKETS];
+  gsize offset = 0;
+  guint i;
+  gint sent;
+
+  for (i = 0; i != output->n_packets; ++i) {
+    iovs[i].iov_base = output->batch + offset;
+    iovs[i].iov_len = output->sizes[i];
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    offset += output->sizes[i];
+  }
+
+  ++output->send_calls;
+
+  sent = sendmmsg (destination->fd, msgs, output->n_packets, 0);
+  if (sent < 0) {
+    g_debug ("UDP send to %s failed: %s", destination->name,
+        g_strerror (errno));
+    return;
+  }
+
+  output->packets_sent += sent;
+#else
+  gsize offset = 0;
+  guint i;
+
+  for (i = 0; i != output->n_packets; ++i) {
+    ++output->send_calls;
+
+    if (send (destination->fd, output->batch + offset, output->sizes[i],
+            0) < 0) {
+      g_debug ("UDP send to %s failed: %s", destination->name,
+          g_strerror (errno));
+    } else {
+      ++output->packets_sent;
+    }
+
+    offset += output->sizes[i];
+  }
+#endif
+}
+
+void
+hwangsae_udp_output_flush (HwangsaeUdpOutput * output)
+{
+  guint i;
+
+  if (output->n_packets == 0) {
+    return;
+  }
+
+  for (i = 0; i != output->destinations->len; ++i) {
+    UdpDestination *destination =
+        &g_array_index (output->destinations, UdpDestination, i);
+
+#ifdef HAVE_UDP_SEGMENT
+    if (output->gso && _batch_allows_gso (output) &&
+        _send_gso (output, destination)) {
+      continue;
+    }
+#endif
+
+    _send_batch (output, destination);
+  }
+
+  output->n_packets = 0;
+  output->batch_len = 0;
+}
+
+guint64
+hwangsae_udp_output_get_packets_sent (HwangsaeUdpOutput * output)
+{
+  return output->packets_sent;
+}
+
+guint64
+hwangsae_udp_output_get_send_calls (HwangsaeUdpOutput * output)
+{
+  return output->send_calls;
+}
@@ -0,0 +1,60 @@
+/**
+ *  Copyright 2019 SK Telecom Co., Ltd.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef __HWANGSAE_UDP_OUTPUT_H__
+#define __HWANGSAE_UDP_OUTPUT_H__
+
+#if !defined(HWANGSAE_COMPILATION)
+#error "This is a private header of the Hwangsae library."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Plain UDP egress of a stream to a fixed set of destinations. Queued
+ * datagrams get sent in batches, with a single sendmmsg() call per
+ * destination or even a single GSO datagram when the kernel supports it.
+ *
+ * Destinations may be multicast groups, which then get sent to with the
+ * given TTL through the given interface (or the system default). */
+typedef struct _HwangsaeUdpOutput HwangsaeUdpOutput;
+
+HwangsaeUdpOutput      *hwangsae_udp_output_new         (const gchar * destinations,
+                                                         guint multicast_ttl,
+                                                         const gchar * multicast_interface,
+                                                         GError ** error);
+
+void                    hwangsae_udp_output_free        (HwangsaeUdpOutput * output);
+
+void                    hwangsae_udp_output_queue       (HwangsaeUdpOutput * output,
+                                                         const guint8 * data,
+                                                         gsize len);
+
+void                    hwangsae_udp_output_flush       (HwangsaeUdpOutput * output);
+
+guint64                 hwangsae_udp_output_get_packets_sent
+                                                        (HwangsaeUdpOutput * output);
+
+guint64                 hwangsae_udp_output_get_send_calls
+                                                        (HwangsaeUdpOutput * output);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (HwangsaeUdpOutput, hwangsae_udp_output_free)
+
+G_END_DECLS
+
+#endif // __HWANGSAE_UDP_OUTPUT_H__
@@ -18,32 +18,3176 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include "hwangsae/hwangsae.h"
+#include "hwangsae/mpegts.h"
+#include "hwangsae/stats-page.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <gst/pbutils/pbutils.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <srt/srt.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SINK_PORT 8888
+#define SOURCE_PORT 9999
+#define TS_CHUNK_SIZE (7 * HWANGSAE_MPEGTS_PACKET_SIZE)
+#define PASSPHRASE "hwangsae-passphrase"
+#define RECORDER_TOKEN "hwangsae-recorder"
+#define OPERATOR_TOKEN "hwangsae-operator"
+
+/* The memory GSettings backend outlives the relays, make sure settings
+ * changed by a previous test don't leak into the next one. */
+static GSettings *
+_reset_relay_settings (void)
+{
+  GSettings *settings = g_settings_new ("org.hwangsaeul.hwangsae.relay");
+  g_autoptr (GSettingsSchema) schema = NULL;
+  g_auto (GStrv) keys = NULL;
+  gchar **it;
+
+  g_object_get (settings, "settings-schema", &schema, NULL);
+  keys = g_settings_schema_list_keys (schema);
+  for (it = keys; *it; ++it) {
+    g_settings_reset (settings, *it);
+  }
+
+  return settings;
+}
+
+static HwangsaeRelay *
+_relay_new (void)
+{
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+
+  return hwangsae_relay_new ();
+}
+
+static SRTSOCKET
+_srt_socket_new (const gchar * stream_id)
+{
+  SRTSOCKET sock;
+  gint timeout = 1000;
+
+  sock = srt_socket (AF_INET, SOCK_DGRAM, 0);
+  srt_setsockflag (sock, SRTO_RCVTIMEO, &timeout, sizeof (timeout));
+  srt_setsockflag (sock, SRTO_STREAMID, stream_id, strlen (stream_id));
+
+  return sock;
+}
+
+/* Closes the socket when the connection fails. */
+static SRTSOCKET
+_srt_socket_connect (SRTSOCKET sock, guint port)
+{
+  struct sockaddr_in sa = { 0 };
+
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  inet_pton (AF_INET, "127.0.0.1", &sa.sin_addr);
+
+  if (srt_connect (sock, (struct sockaddr *) &sa, sizeof (sa)) == SRT_ERROR) {
+    g_debug ("Couldn't connect to port %u: %s", port, srt_getlasterror_str ());
+    srt_close (sock);
+    return SRT_INVALID_SOCK;
+  }
+
+  return sock;
+}
+
+static SRTSOCKET
+_srt_connect_full (guint port, const gchar * stream_id,
+    const gchar * passphrase, gint pbkeylen)
+{
+  SRTSOCKET sock = _srt_socket_new (stream_id);
+
+  if (passphrase) {
+    srt_setsockflag (sock, SRTO_PASSPHRASE, passphrase, strlen (passphrase));
+  }
+  if (pbkeylen) {
+    srt_setsockflag (sock, SRTO_PBKEYLEN, &pbkeylen, sizeof (pbkeylen));
+  }
+
+  return _srt_socket_connect (sock, port);
+}
+
+static SRTSOCKET
+_srt_connect (guint port, const gchar * stream_id)
+{
+  return _srt_connect_full (port, stream_id, NULL, 0);
+}
+
+static SRTSOCKET
+_srt_connect_address (const gchar * address, guint port,
+    const gchar * stream_id)
+{
+  g_autoptr (GSocketAddress) sockaddr =
+      g_inet_socket_address_new_from_string (address, port);
+  gsize sockaddr_len = g_socket_address_get_native_size (sockaddr);
+  gpointer sa = g_alloca (sockaddr_len);
+  SRTSOCKET sock;
+  gint timeout = 1000;
+
+  g_assert_true (g_socket_address_to_native (sockaddr, sa, sockaddr_len,
+          NULL));
+
+  sock = srt_socket (g_socket_address_get_family (sockaddr), SOCK_DGRAM, 0);
+  srt_setsockflag (sock, SRTO_RCVTIMEO, &timeout, sizeof (timeout));
+  srt_setsockflag (sock, SRTO_STREAMID, stream_id, strlen (stream_id));
+
+  if (srt_connect (sock, sa, sockaddr_len) == SRT_ERROR) {
+    g_debug ("Couldn't connect to %s:%u: %s", address, port,
+        srt_getlasterror_str ());
+    srt_close (sock);
+    return SRT_INVALID_SOCK;
+  }
+
+  return sock;
+}
+
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 2)
+/* Returns the reason the relay gave for refusing the connection. */
+static gint
+_srt_connect_rejected (guint port, const gchar * stream_id)
+{
+  struct sockaddr_in sa = { 0 };
+  SRTSOCKET sock = _srt_socket_new (stream_id);
+  gint reason;
+
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  inet_pton (AF_INET, "127.0.0.1", &sa.sin_addr);
+
+  g_assert_cmpint (srt_connect (sock, (struct sockaddr *) &sa, sizeof (sa)),
+      ==, SRT_ERROR);
+
+  reason = srt_getrejectreason (sock);
+  srt_close (sock);
+
+  return reason;
+}
+#endif
+
+/* Finds the entry of the aa{sv} stats list whose "key" equals "name". */
+static GVariant *
+_lookup_stats_entry (HwangsaeRelay * relay, const gchar * list,
+    const gchar * key, const gchar * name)
+{
+  g_autoptr (GVariant) stats = hwangsae_relay_get_stats (relay);
+  g_autoptr (GVariant) entries = NULL;
+  GVariantIter iter;
+  GVariant *entry;
+
+  entries = g_variant_lookup_value (stats, list, G_VARIANT_TYPE ("aa{sv}"));
+  g_assert_nonnull (entries);
+
+  g_variant_iter_init (&iter, entries);
+  while ((entry = g_variant_iter_next_value (&iter))) {
+    const gchar *value;
+
+    if (g_variant_lookup (entry, key, "&s", &value) &&
+        g_str_equal (value, name)) {
+      return entry;
+    }
+
+    g_variant_unref (entry);
+  }
+
+  return NULL;
+}
+
+static GVariant *
+_lookup_stream_stats (HwangsaeRelay * relay, const gchar * stream)
+{
+  return _lookup_stats_entry (relay, "streams", "stream", stream);
+}
+
+static GVariant *
+_lookup_user_stats (HwangsaeRelay * relay, const gchar * user)
+{
+  return _lookup_stats_entry (relay, "users", "user", user);
+}
+
+/* Connections get registered by the relay thread asynchronously. */
+static void
+_wait_for_subscribers (HwangsaeRelay * relay, const gchar * stream,
+    guint subscribers)
+{
+  gint64 deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+
+  for (;;) {
+    g_autoptr (GVariant) stream_stats = _lookup_stream_stats (relay, stream);
+    guint n;
+
+    if (stream_stats &&
+        g_variant_lookup (stream_stats, "subscribers", "u", &n) &&
+        n == subscribers) {
+      return;
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+}
+
+static void
+_set_passphrase (HwangsaeRelay * relay, const gchar * stream,
+    const gchar * passphrase, gint pbkeylen)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+  g_variant_builder_add (&builder, "{ss}", stream, passphrase);
+
+  g_object_set (relay, "stream-passphrases", g_variant_builder_end (&builder),
+      "pbkeylen", pbkeylen, NULL);
+}
+
+static void
+_set_class_tokens (HwangsaeRelay * relay)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+  g_variant_builder_add (&builder, "{ss}", "recorder", RECORDER_TOKEN);
+  g_variant_builder_add (&builder, "{ss}", "operator", OPERATOR_TOKEN);
+
+  g_object_set (relay, "class-tokens", g_variant_builder_end (&builder),
+      NULL);
+}
+
+static gint64
+_get_cpu_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+  return ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/* Forwards UDP datagrams to the relay, dropping a given fraction of those
+ * sent towards it. */
+typedef struct
+{
+  GSocket *socket;
+  GSocket *upstream;
+  GSocketAddress *relay_address;
+  GSocketAddress *client_address;
+  GRand *rand;
+  gdouble loss;
+  gboolean running;
+  GThread *thread;
+} LossyProxy;
+
+static gpointer
+_lossy_proxy_thread_func (LossyProxy * proxy)
+{
+  gchar buf[2048];
+  GPollFD fds[2];
+
+  fds[0].fd = g_socket_get_fd (proxy->socket);
+  fds[0].events = G_IO_IN;
+  fds[1].fd = g_socket_get_fd (proxy->upstream);
+  fds[1].events = G_IO_IN;
+
+  while (proxy->running) {
+    gssize len;
+
+    if (g_poll (fds, G_N_ELEMENTS (fds), 50) <= 0) {
+      continue;
+    }
+
+    if (fds[0].revents & G_IO_IN) {
+      GSocketAddress *from = NULL;
+
+      len = g_socket_receive_from (proxy->socket, &from, buf, sizeof (buf),
+          NULL, NULL);
+      if (len > 0) {
+        g_clear_object (&proxy->client_address);
+        proxy->client_address = g_steal_pointer (&from);
+
+        if (g_rand_double (proxy->rand) >= proxy->loss) {
+          g_socket_send_to (proxy->upstream, proxy->relay_address, buf, len,
+              NULL, NULL);
+        }
+      }
+      g_clear_object (&from);
+    }
+
+    if (fds[1].revents & G_IO_IN) {
+      len = g_socket_receive (proxy->upstream, buf, sizeof (buf), NULL, NULL);
+      if (len > 0 && proxy->client_address) {
+        g_socket_send_to (proxy->socket, proxy->client_address, buf, len, NULL,
+            NULL);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static GSocket *
+_udp_socket_new (void)
+{
+  g_autoptr (GSocket) socket = NULL;
+  g_autoptr (GSocketAddress) address = NULL;
+  g_autoptr (GError) error = NULL;
+
+  socket = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+      G_SOCKET_PROTOCOL_UDP, &error);
+  g_assert_no_error (error);
+
+  address = g_inet_socket_address_new_from_string ("127.0.0.1", 0);
+  g_socket_bind (socket, address, FALSE, &error);
+  g_assert_no_error (error);
+
+  g_socket_set_blocking (socket, FALSE);
+
+  return g_steal_pointer (&socket);
+}
+
+static LossyProxy *
+lossy_proxy_new (guint relay_port, gdouble loss, guint32 seed)
+{
+  LossyProxy *proxy = g_new0 (LossyProxy, 1);
+
+  proxy->socket = _udp_socket_new ();
+  proxy->upstream = _udp_socket_new ();
+  proxy->relay_address = g_inet_socket_address_new_from_string ("127.0.0.1",
+      relay_port);
+  proxy->rand = g_rand_new_with_seed (seed);
+  proxy->loss = loss;
+  proxy->running = TRUE;
+  proxy->thread = g_thread_new ("LossyProxy",
+      (GThreadFunc) _lossy_proxy_thread_func, proxy);
+
+  return proxy;
+}
+
+static guint
+lossy_proxy_get_port (LossyProxy * proxy)
+{
+  g_autoptr (GSocketAddress) address = NULL;
+
+  address = g_socket_get_local_address (proxy->socket, NULL);
+
+  return g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address));
+}
+
+static void
+lossy_proxy_free (LossyProxy * proxy)
+{
+  proxy->running = FALSE;
+  g_thread_join (proxy->thread);
+
+  g_clear_object (&proxy->socket);
+  g_clear_object (&proxy->upstream);
+  g_clear_object (&proxy->relay_address);
+  g_clear_object (&proxy->client_address);
+  g_rand_free (proxy->rand);
+  g_free (proxy);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LossyProxy, lossy_proxy_free);
+
+static void
+_fill_null_packets (guint8 * buf, gsize len)
+{
+  gsize offset;
+
+  memset (buf, 0xff, len);
+
+  for (offset = 0; offset + HWANGSAE_MPEGTS_PACKET_SIZE <= len;
+      offset += HWANGSAE_MPEGTS_PACKET_SIZE) {
+    buf[offset] = HWANGSAE_MPEGTS_SYNC_BYTE;
+    buf[offset + 1] = 0x1f;
+    buf[offset + 2] = 0xff;
+    buf[offset + 3] = 0x10;
+  }
+}
+
+static void
+test_hwangsae_relay_instance (void)
+{
+  guint sink_port, source_port;
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+
+  g_assert_nonnull (relay);
+
+  g_object_get (relay, "sink-port", &sink_port, "source-port", &source_port,
+      NULL);
+
+  g_assert_cmpint (sink_port, ==, SINK_PORT);
+  g_assert_cmpint (source_port, ==, SOURCE_PORT);
+}
+
+static void
+test_hwangsae_relay_latency_probe (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GVariant) stats = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  HwangsaeProbeMarker marker;
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  guint relay_markers = 0;
+  guint edge_markers = 0;
+  guint64 residence_samples;
+  gint64 start_time = g_get_real_time ();
+  gint len;
+  gint i;
+
+  g_object_set (relay, "latency-probe", TRUE, NULL);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=probe");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "probe", 0);
+  source = _srt_connect (SOURCE_PORT, "#!::r=probe");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "probe", 1);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+
+  for (i = 0; i != 50; ++i) {
+    if (i == 40) {
+      /* Marker inserted by the edge should get stamped by the relay. */
+      marker.seqnum = 0;
+      marker.edge_time = g_get_real_time ();
+      marker.relay_time = -1;
+      hwangsae_mpegts_probe_write (buf, 0, &marker);
+      g_assert_cmpint (srt_send (sink, (char *) buf,
+              HWANGSAE_MPEGTS_PACKET_SIZE), ==, HWANGSAE_MPEGTS_PACKET_SIZE);
+    }
+
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  while ((len = srt_recvmsg (source, (char *) buf, sizeof (buf))) > 0) {
+    if (len != HWANGSAE_MPEGTS_PACKET_SIZE ||
+        !hwangsae_mpegts_probe_read (buf, &marker)) {
+      continue;
+    }
+
+    g_assert_cmpint (marker.relay_time, >=, start_time);
+    g_assert_cmpint (marker.relay_time, <=, g_get_real_time ());
+
+    if (marker.edge_time >= 0) {
+      g_assert_cmpint (marker.edge_time, <=, marker.relay_time);
+      ++edge_markers;
+    } else {
+      ++relay_markers;
+    }
+  }
+
+  g_assert_cmpuint (relay_markers, >, 0);
+  g_assert_cmpuint (edge_markers, ==, 1);
+
+  stats = hwangsae_relay_get_stats (relay);
+  g_assert_true (g_variant_lookup (stats, "residence-samples", "t",
+          &residence_samples));
+  g_assert_cmpuint (residence_samples, >=, 50);
+
+  srt_close (source);
+  srt_close (sink);
+}
+
+static void
+test_hwangsae_relay_encryption (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  SRTSOCKET plain_sink;
+
+  _set_passphrase (relay, "secret", PASSPHRASE, 32);
+
+  /* Publishers of an encrypted stream must know its passphrase. */
+  sink = _srt_connect (SINK_PORT, "#!::u=secret");
+  g_assert_cmpint (sink, ==, SRT_INVALID_SOCK);
+  sink = _srt_connect_full (SINK_PORT, "#!::u=secret", "wrong-passphrase", 0);
+  g_assert_cmpint (sink, ==, SRT_INVALID_SOCK);
+  sink = _srt_connect_full (SINK_PORT, "#!::u=secret", PASSPHRASE, 0);
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "secret", 0);
+
+  /* Other streams stay unencrypted. */
+  plain_sink = _srt_connect (SINK_PORT, "#!::u=plain");
+  g_assert_cmpint (plain_sink, !=, SRT_INVALID_SOCK);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=secret");
+  g_assert_cmpint (source, ==, SRT_INVALID_SOCK);
+  source = _srt_connect_full (SOURCE_PORT, "#!::r=secret", PASSPHRASE, 0);
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "secret", 1);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+      sizeof (chunk));
+  g_assert_cmpint (srt_recvmsg (source, (char *) buf, sizeof (buf)), ==,
+      sizeof (chunk));
+  g_assert_cmpmem (buf, sizeof (chunk), chunk, sizeof (chunk));
+
+  srt_close (source);
+
+  /* A subscriber class doesn't stand in for the stream's passphrase. */
+  _set_class_tokens (relay);
+  g_assert_cmpint (_srt_connect (SOURCE_PORT,
+          "#!::r=secret,c=recorder,s=" RECORDER_TOKEN), ==, SRT_INVALID_SOCK);
+  source = _srt_connect_full (SOURCE_PORT,
+      "#!::r=secret,c=recorder,s=" RECORDER_TOKEN, PASSPHRASE, 0);
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+
+  srt_close (source);
+  srt_close (plain_sink);
+  srt_close (sink);
+}
+
+#define BENCH_PACKETS 5000
+
+static gint64
+_measure_fanout_cpu_time (gint pbkeylen, guint n_subscribers)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  const gchar *passphrase = pbkeylen ? PASSPHRASE : NULL;
+  g_autofree SRTSOCKET *sources = g_new0 (SRTSOCKET, n_subscribers);
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  gint64 cpu_time;
+  gint no = 0;
+  guint i;
+  guint p;
+
+  if (pbkeylen) {
+    _set_passphrase (relay, "bench", PASSPHRASE, pbkeylen);
+  }
+
+  sink = _srt_connect_full (SINK_PORT, "#!::u=bench", passphrase, pbkeylen);
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "bench", 0);
+
+  for (i = 0; i != n_subscribers; ++i) {
+    sources[i] = _srt_connect_full (SOURCE_PORT, "#!::r=bench", passphrase,
+        pbkeylen);
+    g_assert_cmpint (sources[i], !=, SRT_INVALID_SOCK);
+    srt_setsockflag (sources[i], SRTO_RCVSYN, &no, sizeof (no));
+  }
+  _wait_for_subscribers (relay, "bench", n_subscribers);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+
+  cpu_time = _get_cpu_time ();
+
+  for (p = 0; p != BENCH_PACKETS; ++p) {
+    srt_send (sink, (char *) chunk, sizeof (chunk));
+
+    if (p % 10 == 0) {
+      /* ~10k packets per second, i.e. ~100 Mbps per subscriber. */
+      g_usleep (1000);
+
+      for (i = 0; i != n_subscribers; ++i) {
+        while (srt_recvmsg (sources[i], (char *) buf, sizeof (buf)) > 0) {
+          /* Just drain the receive buffer. */
+        }
+      }
+    }
+  }
+
+  cpu_time = _get_cpu_time () - cpu_time;
+
+  for (i = 0; i != n_subscribers; ++i) {
+    srt_close (sources[i]);
+  }
+  srt_close (sink);
+
+  return cpu_time;
+}
+
+static void
+test_hwangsae_relay_encryption_cost (void)
+{
+  const gint key_lengths[] = { 16, 24, 32 };
+  const guint subscriber_counts[] = { 1, 4, 16 };
+  guint i;
+  guint j;
+
+  for (i = 0; i != G_N_ELEMENTS (subscriber_counts); ++i) {
+    guint n = subscriber_counts[i];
+    gint64 plain = _measure_fanout_cpu_time (0, n);
+
+    g_test_message ("%2u subscribers, no encryption: %.2f us CPU per packet "
+        "per subscriber", n, (gdouble) plain / BENCH_PACKETS / n);
+
+    for (j = 0; j != G_N_ELEMENTS (key_lengths); ++j) {
+      gint64 encrypted = _measure_fanout_cpu_time (key_lengths[j], n);
+
+      /* Subscribers run in this process too, so the difference also
+       * includes their decryption work, roughly the same amount again. */
+      g_test_message ("%2u subscribers, AES-%d: %.2f us CPU per packet per "
+          "subscriber (+%.2f us over no encryption)", n, key_lengths[j] * 8,
+          (gdouble) encrypted / BENCH_PACKETS / n,
+          (gdouble) (encrypted - plain) / BENCH_PACKETS / n);
+    }
+  }
+}
+
+#define LOSSY_PACKETS 1000
+
+typedef struct
+{
+  guint delivered;
+  guint32 next_seqnum;
+  gint64 latency_sum;
+  gint64 latency_max;
+  SRT_TRACEBSTATS sink_stats;
+} LossyTransfer;
+
+static void
+_lossy_transfer_receive (LossyTransfer * transfer, SRTSOCKET source)
+{
+  guint8 buf[1500];
+  gint len;
+
+  while ((len = srt_recvmsg (source, (char *) buf, sizeof (buf))) > 0) {
+    guint32 seqnum;
+    gint64 send_time;
+    gint64 latency;
+
+    g_assert_cmpint (len, ==, TS_CHUNK_SIZE);
+
+    /* Packets must arrive complete and in order. */
+    memcpy (&seqnum, buf + 4, sizeof (seqnum));
+    g_assert_cmpuint (seqnum, ==, transfer->next_seqnum);
+    transfer->next_seqnum = seqnum + 1;
+
+    memcpy (&send_time, buf + 8, sizeof (send_time));
+    latency = g_get_monotonic_time () - send_time;
+
+    ++transfer->delivered;
+    transfer->latency_sum += latency;
+    transfer->latency_max = MAX (transfer->latency_max, latency);
+  }
+}
+
+static void
+_lossy_transfer_run (LossyTransfer * transfer, SRTSOCKET sink,
+    SRTSOCKET source)
+{
+  guint8 chunk[TS_CHUNK_SIZE];
+  gint64 deadline;
+  gint no = 0;
+  guint32 i;
+
+  memset (transfer, 0, sizeof (*transfer));
+
+  srt_setsockflag (source, SRTO_RCVSYN, &no, sizeof (no));
+
+  _fill_null_packets (chunk, sizeof (chunk));
+
+  for (i = 0; i != LOSSY_PACKETS; ++i) {
+    gint64 now = g_get_monotonic_time ();
+
+    /* Sequence number and send time go into the null packet payload. */
+    memcpy (chunk + 4, &i, sizeof (i));
+    memcpy (chunk + 8, &now, sizeof (now));
+
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+
+    _lossy_transfer_receive (transfer, source);
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  deadline = g_get_monotonic_time () + 2 * G_TIME_SPAN_SECOND;
+  while (transfer->delivered != LOSSY_PACKETS &&
+      g_get_monotonic_time () < deadline) {
+    _lossy_transfer_receive (transfer, source);
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  srt_bstats (sink, &transfer->sink_stats, 0);
+}
+
+static void
+_run_lossy_transfer (const gchar * packet_filter, gdouble loss,
+    LossyTransfer * transfer)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (LossyProxy) proxy = lossy_proxy_new (SINK_PORT, loss, 42);
+  SRTSOCKET sink;
+  SRTSOCKET source;
+
+  if (packet_filter) {
+    GVariantBuilder builder;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+    g_variant_builder_add (&builder, "{ss}", "lossy", packet_filter);
+    g_object_set (relay, "stream-packet-filters",
+        g_variant_builder_end (&builder), NULL);
+  }
+
+  sink = _srt_connect (lossy_proxy_get_port (proxy), "#!::u=lossy");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "lossy", 0);
+  source = _srt_connect (SOURCE_PORT, "#!::r=lossy");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "lossy", 1);
+
+  _lossy_transfer_run (transfer, sink, source);
+
+  srt_close (source);
+  srt_close (sink);
+}
+
+static void
+_print_lossy_transfer (const gchar * name, LossyTransfer * transfer)
+{
+  SRT_TRACEBSTATS *stats = &transfer->sink_stats;
+  guint64 payload = (guint64) LOSSY_PACKETS * TS_CHUNK_SIZE;
+
+  g_test_message ("%s: delivered %u/%u, latency avg %.1f ms max %.1f ms, "
+      "uplink overhead %.1f%% (%d retransmitted, %d FEC packets)", name,
+      transfer->delivered, LOSSY_PACKETS,
+      transfer->latency_sum / 1000.0 / MAX (transfer->delivered, 1),
+      transfer->latency_max / 1000.0,
+      ((gint64) stats->byteSentTotal - (gint64) payload) * 100.0 / payload,
+      stats->pktRetransTotal, stats->pktSndFilterExtraTotal);
+}
+
+static void
+test_hwangsae_relay_fec (void)
+{
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 0)
+  LossyTransfer arq;
+  LossyTransfer fec;
+
+  _run_lossy_transfer (NULL, 0.05, &arq);
+  _run_lossy_transfer ("fec,cols:10,rows:5", 0.05, &fec);
+
+  _print_lossy_transfer ("ARQ only", &arq);
+  _print_lossy_transfer ("FEC+ARQ", &fec);
+
+  g_assert_cmpuint (arq.delivered, ==, LOSSY_PACKETS);
+  g_assert_cmpuint (fec.delivered, ==, LOSSY_PACKETS);
+
+  g_assert_cmpint (arq.sink_stats.pktSndFilterExtraTotal, ==, 0);
+  g_assert_cmpint (fec.sink_stats.pktSndFilterExtraTotal, >, 0);
+  /* Part of the losses got repaired without retransmission. */
+  g_assert_cmpint (fec.sink_stats.pktRetransTotal, <,
+      arq.sink_stats.pktRetransTotal);
+#else
+  g_test_skip ("SRT packet filters need SRT 1.4.0 or newer");
+#endif
+}
+
+static void
+test_hwangsae_relay_bonding (void)
+{
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 5, 0)
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (LossyProxy) link1 = lossy_proxy_new (SINK_PORT, 0.1, 1);
+  g_autoptr (LossyProxy) link2 = lossy_proxy_new (SINK_PORT, 0.1, 2);
+  g_autoptr (GVariant) stream_stats = NULL;
+  const gchar stream_id[] = "#!::u=bonded";
+  SRT_SOCKGROUPCONFIG links[2];
+  struct sockaddr_in sa[2] = { 0 };
+  LossyTransfer transfer;
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  gboolean bonded;
+  guint n_links = 0;
+  gint64 deadline;
+  guint i;
+
+  sink = srt_create_group (SRT_GTYPE_BROADCAST);
+  if (sink == SRT_INVALID_SOCK) {
+    g_test_skip ("libsrt was built without bonding support");
+    return;
+  }
+
+  srt_setsockflag (sink, SRTO_STREAMID, stream_id, strlen (stream_id));
+
+  for (i = 0; i != G_N_ELEMENTS (links); ++i) {
+    LossyProxy *proxy = i == 0 ? link1 : link2;
+
+    sa[i].sin_family = AF_INET;
+    sa[i].sin_port = htons (lossy_proxy_get_port (proxy));
+    inet_pton (AF_INET, "127.0.0.1", &sa[i].sin_addr);
+
+    links[i] = srt_prepare_endpoint (NULL, (struct sockaddr *) &sa[i],
+        sizeof (sa[i]));
+  }
+
+  g_assert_cmpint (srt_connect_group (sink, links, G_N_ELEMENTS (links)), !=,
+      SRT_ERROR);
+  _wait_for_subscribers (relay, "bonded", 0);
+
+  /* Both links end up in a single bonded sink. */
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  while (n_links != 2) {
+    g_clear_pointer (&stream_stats, g_variant_unref);
+    stream_stats = _lookup_stream_stats (relay, "bonded");
+
+    g_assert_true (g_variant_lookup (stream_stats, "bonded", "b", &bonded));
+    g_assert_true (bonded);
+    g_variant_lookup (stream_stats, "links", "u", &n_links);
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=bonded");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "bonded", 1);
+
+  /* Each link alone loses 10% of packets. */
+  _lossy_transfer_run (&transfer, sink, source);
+  g_test_message ("Bonded transfer: delivered %u/%u, latency avg %.1f ms "
+      "max %.1f ms", transfer.delivered, LOSSY_PACKETS,
+      transfer.latency_sum / 1000.0 / MAX (transfer.delivered, 1),
+      transfer.latency_max / 1000.0);
+
+  g_assert_cmpuint (transfer.delivered, ==, LOSSY_PACKETS);
+
+  srt_close (source);
+  srt_close (sink);
+#else
+  g_test_skip ("Bonding needs SRT 1.5.0 or newer");
+#endif
+}
+
+static void
+test_hwangsae_relay_adaptive_latency (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  guint8 chunk[TS_CHUNK_SIZE];
+  SRTSOCKET sink;
+  SRTSOCKET first;
+  SRTSOCKET second;
+  gint latency;
+  gint len = sizeof (latency);
+  gint i;
+
+  g_object_set (relay, "adaptive-latency", TRUE, "latency-min", 300,
+      "latency-max", 1000, NULL);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=adaptive");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "adaptive", 0);
+
+  /* Nothing is known about the first subscriber's path yet. */
+  first = _srt_connect (SOURCE_PORT, "#!::r=adaptive");
+  g_assert_cmpint (first, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "adaptive", 1);
+
+  g_assert_cmpint (srt_getsockflag (first, SRTO_RCVLATENCY, &latency, &len),
+      ==, 0);
+  g_assert_cmpint (latency, ==, 120);
+
+  /* Keep data flowing so that the relay gets to measure the RTT. */
+  _fill_null_packets (chunk, sizeof (chunk));
+  for (i = 0; i != 150; ++i) {
+    srt_send (sink, (char *) chunk, sizeof (chunk));
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  /* Loopback RTT is way below the floor. */
+  second = _srt_connect (SOURCE_PORT, "#!::r=adaptive");
+  g_assert_cmpint (second, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "adaptive", 2);
+
+  g_assert_cmpint (srt_getsockflag (second, SRTO_RCVLATENCY, &latency, &len),
+      ==, 0);
+  g_assert_cmpint (latency, ==, 300);
+
+  srt_close (second);
+  srt_close (first);
+  srt_close (sink);
+}
+
+static void
+test_hwangsae_relay_user_quota (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GVariant) user_stats = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  SRTSOCKET sources[3];
+  guint streams;
+  guint subscribers;
+  guint64 bytes_in;
+  guint64 bytes_out;
+  gint i;
+
+  g_object_set (relay, "max-streams-per-user", 1,
+      "max-subscribers-per-user", 2, NULL);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=alice,r=alice-cam1");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "alice-cam1", 0);
+
+  /* alice may publish only one stream at a time. */
+  g_assert_cmpint (_srt_connect (SINK_PORT, "#!::u=alice,r=alice-cam2"), ==,
+      SRT_INVALID_SOCK);
+
+  for (i = 0; i != 2; ++i) {
+    sources[i] = _srt_connect (SOURCE_PORT, "#!::r=alice-cam1");
+    g_assert_cmpint (sources[i], !=, SRT_INVALID_SOCK);
+  }
+  _wait_for_subscribers (relay, "alice-cam1", 2);
+
+  sources[2] = _srt_connect (SOURCE_PORT, "#!::r=alice-cam1");
+  g_assert_cmpint (sources[2], ==, SRT_INVALID_SOCK);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+      sizeof (chunk));
+  for (i = 0; i != 2; ++i) {
+    g_assert_cmpint (srt_recvmsg (sources[i], (char *) buf, sizeof (buf)), ==,
+        sizeof (chunk));
+  }
+
+  user_stats = _lookup_user_stats (relay, "alice");
+  g_assert_nonnull (user_stats);
+  g_assert_true (g_variant_lookup (user_stats, "streams", "u", &streams));
+  g_assert_cmpuint (streams, ==, 1);
+  g_assert_true (g_variant_lookup (user_stats, "subscribers", "u",
+          &subscribers));
+  g_assert_cmpuint (subscribers, ==, 2);
+  g_assert_true (g_variant_lookup (user_stats, "bytes-in", "t", &bytes_in));
+  g_assert_cmpuint (bytes_in, ==, sizeof (chunk));
+  g_assert_true (g_variant_lookup (user_stats, "bytes-out", "t", &bytes_out));
+  g_assert_cmpuint (bytes_out, ==, 2 * sizeof (chunk));
+
+  for (i = 0; i != 2; ++i) {
+    srt_close (sources[i]);
+  }
+  srt_close (sink);
+}
+
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 2)
+static void
+test_hwangsae_relay_subscriber_limits (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  const gchar *alternates[] = { "srt://relay2:9999", "srt://relay3:9999",
+    NULL
+  };
+  g_autoptr (GVariant) stats = NULL;
+  g_autofree const gchar **published = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  SRTSOCKET sinks[2];
+  SRTSOCKET sources[3];
+  gint64 deadline;
+  gint i;
+
+  g_object_set (relay, "max-subscribers-per-stream", 2, "max-subscribers", 3,
+      NULL);
+
+  sinks[0] = _srt_connect (SINK_PORT, "#!::u=limit1");
+  g_assert_cmpint (sinks[0], !=, SRT_INVALID_SOCK);
+  sinks[1] = _srt_connect (SINK_PORT, "#!::u=limit2");
+  g_assert_cmpint (sinks[1], !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "limit1", 0);
+  _wait_for_subscribers (relay, "limit2", 0);
+
+  for (i = 0; i != 2; ++i) {
+    sources[i] = _srt_connect (SOURCE_PORT, "#!::r=limit1");
+    g_assert_cmpint (sources[i], !=, SRT_INVALID_SOCK);
+  }
+  _wait_for_subscribers (relay, "limit1", 2);
+
+  g_assert_cmpint (_srt_connect_rejected (SOURCE_PORT, "#!::r=limit1"), ==,
+      HWANGSAE_REJECT_STREAM_FULL);
+
+  sources[2] = _srt_connect (SOURCE_PORT, "#!::r=limit2");
+  g_assert_cmpint (sources[2], !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "limit2", 1);
+
+  g_assert_cmpint (_srt_connect_rejected (SOURCE_PORT, "#!::r=limit2"), ==,
+      HWANGSAE_REJECT_RELAY_FULL);
+
+  /* With alternates configured, overflowing subscribers get spread across
+   * them. */
+  g_object_set (relay, "alternate-relays", alternates, NULL);
+
+  g_assert_cmpint (_srt_connect_rejected (SOURCE_PORT, "#!::r=limit1"), ==,
+      HWANGSAE_REJECT_REDIRECT);
+  g_assert_cmpint (_srt_connect_rejected (SOURCE_PORT, "#!::r=limit2"), ==,
+      HWANGSAE_REJECT_REDIRECT + 1);
+
+  /* Clients look the redirect target up in the stats. */
+  stats = hwangsae_relay_get_stats (relay);
+  g_assert_true (g_variant_lookup (stats, "alternate-relays", "^a&s",
+          &published));
+  g_assert_cmpuint (g_strv_length ((gchar **) published), ==, 2);
+  g_assert_cmpstr (published[0], ==, alternates[0]);
+  g_assert_cmpstr (published[1], ==, alternates[1]);
+
+  /* A leaving subscriber makes room for another one. The relay notices it
+   * is gone when forwarding to it. */
+  srt_close (sources[2]);
+  _fill_null_packets (chunk, sizeof (chunk));
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  for (;;) {
+    g_autoptr (GVariant) stream_stats = _lookup_stream_stats (relay, "limit2");
+    guint n;
+
+    g_assert_true (g_variant_lookup (stream_stats, "subscribers", "u", &n));
+    if (n == 0) {
+      break;
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    srt_send (sinks[1], (char *) chunk, sizeof (chunk));
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  sources[2] = _srt_connect (SOURCE_PORT, "#!::r=limit2");
+  g_assert_cmpint (sources[2], !=, SRT_INVALID_SOCK);
+
+  for (i = 0; i != 3; ++i) {
+    srt_close (sources[i]);
+  }
+  srt_close (sinks[1]);
+  srt_close (sinks[0]);
+}
+#endif
+
+static void
+test_hwangsae_relay_idle_sink (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GVariant) stats = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  SRTSOCKET idle_sink;
+  SRTSOCKET active_sink;
+  SRTSOCKET source;
+  gint64 deadline;
+  guint64 reaped;
+
+  g_object_set (relay, "idle-timeout", 1, NULL);
+
+  idle_sink = _srt_connect (SINK_PORT, "#!::u=idle");
+  g_assert_cmpint (idle_sink, !=, SRT_INVALID_SOCK);
+  active_sink = _srt_connect (SINK_PORT, "#!::u=active");
+  g_assert_cmpint (active_sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "idle", 0);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=idle");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "idle", 1);
+
+  /* The silent publisher gets reaped along with its subscriber while the
+   * other one keeps its stream. */
+  _fill_null_packets (chunk, sizeof (chunk));
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  for (;;) {
+    g_autoptr (GVariant) stream_stats = _lookup_stream_stats (relay, "idle");
+
+    if (!stream_stats) {
+      break;
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    srt_send (active_sink, (char *) chunk, sizeof (chunk));
+    g_usleep (100 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  g_assert_cmpint (srt_recvmsg (source, (char *) chunk, sizeof (chunk)), <, 0);
+
+  stats = hwangsae_relay_get_stats (relay);
+  g_assert_true (g_variant_lookup (stats, "idle-sinks-reaped", "t", &reaped));
+  g_assert_cmpuint (reaped, ==, 1);
+  g_clear_pointer (&stats, g_variant_unref);
+  stats = _lookup_stream_stats (relay, "active");
+  g_assert_nonnull (stats);
+
+  /* The stream name is free again. */
+  srt_close (idle_sink);
+  idle_sink = _srt_connect (SINK_PORT, "#!::u=idle");
+  g_assert_cmpint (idle_sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "idle", 0);
+
+  srt_close (source);
+  srt_close (active_sink);
+  srt_close (idle_sink);
+}
+
+static guint
+_udp_socket_get_port (GSocket * socket)
+{
+  g_autoptr (GSocketAddress) address = g_socket_get_local_address (socket,
+      NULL);
+
+  return g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address));
+}
+
+static void
+_set_udp_outputs (HwangsaeRelay * relay, const gchar * stream,
+    GSocket ** receivers, guint n_receivers)
+{
+  g_autoptr (GString) destinations = g_string_new (NULL);
+  GVariantBuilder builder;
+  guint i;
+
+  for (i = 0; i != n_receivers; ++i) {
+    g_string_append_printf (destinations, "%s127.0.0.1:%u", i ? "," : "",
+        _udp_socket_get_port (receivers[i]));
+  }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+  g_variant_builder_add (&builder, "{ss}", stream, destinations->str);
+  g_object_set (relay, "stream-udp-outputs", g_variant_builder_end (&builder),
+      NULL);
+}
+
+static void
+test_hwangsae_relay_udp_output (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  GSocket *receivers[2] = { _udp_socket_new (), _udp_socket_new () };
+  g_autoptr (GVariant) stream_stats = NULL;
+  guint8 chunks[16][TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  guint64 packets_sent;
+  guint64 send_calls;
+  SRTSOCKET sink;
+  guint i;
+  guint j;
+
+  _set_udp_outputs (relay, "plain", receivers, G_N_ELEMENTS (receivers));
+
+  sink = _srt_connect (SINK_PORT, "#!::u=plain");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "plain", 0);
+
+  for (i = 0; i != G_N_ELEMENTS (chunks); ++i) {
+    _fill_null_packets (chunks[i], TS_CHUNK_SIZE);
+    memcpy (chunks[i] + 4, &i, sizeof (i));
+    g_assert_cmpint (srt_send (sink, (char *) chunks[i], TS_CHUNK_SIZE), ==,
+        TS_CHUNK_SIZE);
+  }
+
+  /* Every receiver gets every packet, in order. */
+  for (i = 0; i != G_N_ELEMENTS (receivers); ++i) {
+    g_socket_set_blocking (receivers[i], TRUE);
+    g_socket_set_timeout (receivers[i], 5);
+
+    for (j = 0; j != G_N_ELEMENTS (chunks); ++j) {
+      g_autoptr (GError) error = NULL;
+      gssize len;
+
+      len = g_socket_receive (receivers[i], (gchar *) buf, sizeof (buf), NULL,
+          &error);
+      g_assert_no_error (error);
+      g_assert_cmpmem (buf, len, chunks[j], TS_CHUNK_SIZE);
+    }
+  }
+
+  stream_stats = _lookup_stream_stats (relay, "plain");
+  g_assert_true (g_variant_lookup (stream_stats, "udp-packets-sent", "t",
+          &packets_sent));
+  g_assert_cmpuint (packets_sent, ==,
+      G_N_ELEMENTS (receivers) * G_N_ELEMENTS (chunks));
+  g_assert_true (g_variant_lookup (stream_stats, "udp-send-calls", "t",
+          &send_calls));
+  g_assert_cmpuint (send_calls, <=, packets_sent);
+
+  srt_close (sink);
+  for (i = 0; i != G_N_ELEMENTS (receivers); ++i) {
+    g_object_unref (receivers[i]);
+  }
+}
+
+#define MULTICAST_GROUP "239.255.42.42"
+
+static GSocket *
+_multicast_receiver_new (guint port, GError ** error)
+{
+  g_autoptr (GSocket) socket = NULL;
+  g_autoptr (GInetAddress) group = NULL;
+  g_autoptr (GSocketAddress) address = NULL;
+
+  socket = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+      G_SOCKET_PROTOCOL_UDP, error);
+  if (!socket) {
+    return NULL;
+  }
+
+  address = g_inet_socket_address_new_from_string ("0.0.0.0", port);
+  group = g_inet_address_new_from_string (MULTICAST_GROUP);
+
+  if (!g_socket_bind (socket, address, TRUE, error) ||
+      !g_socket_join_multicast_group (socket, group, FALSE, NULL, error)) {
+    return NULL;
+  }
+
+  g_socket_set_timeout (socket, 5);
+
+  return g_steal_pointer (&socket);
+}
+
+static void
+test_hwangsae_relay_multicast (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GSocket) first = NULL;
+  g_autoptr (GSocket) second = NULL;
+  g_autoptr (GVariant) stream_stats = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *destination = NULL;
+  GVariantBuilder builder;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  guint64 packets_sent = 0;
+  gint64 deadline;
+  SRTSOCKET sink;
+  gssize len;
+
+  first = _multicast_receiver_new (0, &error);
+  if (first) {
+    second = _multicast_receiver_new (_udp_socket_get_port (first), &error);
+  }
+  if (!second) {
+    g_test_skip (error->message);
+    return;
+  }
+
+  destination = g_strdup_printf (MULTICAST_GROUP ":%u",
+      _udp_socket_get_port (first));
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+  g_variant_builder_add (&builder, "{ss}", "iptv", destination);
+  g_object_set (relay, "stream-udp-outputs", g_variant_builder_end (&builder),
+      NULL);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=iptv");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "iptv", 0);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+      sizeof (chunk));
+
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  while (packets_sent == 0 && g_get_monotonic_time () < deadline) {
+    g_clear_pointer (&stream_stats, g_variant_unref);
+    stream_stats = _lookup_stream_stats (relay, "iptv");
+    g_variant_lookup (stream_stats, "udp-packets-sent", "t", &packets_sent);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  if (packets_sent == 0) {
+    srt_close (sink);
+    g_test_skip ("No multicast route on this host");
+    return;
+  }
+
+  /* The relay sent the packet once and both receivers got it. */
+  g_assert_cmpuint (packets_sent, ==, 1);
+
+  len = g_socket_receive (first, (gchar *) buf, sizeof (buf), NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (buf, len, chunk, sizeof (chunk));
+
+  len = g_socket_receive (second, (gchar *) buf, sizeof (buf), NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (buf, len, chunk, sizeof (chunk));
+
+  srt_close (sink);
+}
+
+#define THINNING_PMT_PID 0x1000
+#define THINNING_VIDEO_PID 0x100
+
+static void
+_write_ts_header (guint8 * packet, guint16 pid, gboolean unit_start, guint8 cc)
+{
+  memset (packet, 0xff, HWANGSAE_MPEGTS_PACKET_SIZE);
+
+  packet[0] = HWANGSAE_MPEGTS_SYNC_BYTE;
+  packet[1] = (unit_start ? 0x40 : 0) | (pid >> 8);
+  packet[2] = pid & 0xff;
+  packet[3] = 0x10 | (cc & 0x0f);
+}
+
+static void
+_write_psi (guint8 * packet)
+{
+  static const guint8 PAT[] = {
+    0x00, 0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00,
+    0x00, 0x01, 0xe0 | (THINNING_PMT_PID >> 8), THINNING_PMT_PID & 0xff,
+    0x00, 0x00, 0x00, 0x00
+  };
+  static const guint8 PMT[] = {
+    0x00, 0x02, 0xb0, 0x12, 0x00, 0x01, 0xc1, 0x00, 0x00,
+    0xe0 | (THINNING_VIDEO_PID >> 8), THINNING_VIDEO_PID & 0xff, 0xf0, 0x00,
+    0x1b, 0xe0 | (THINNING_VIDEO_PID >> 8), THINNING_VIDEO_PID & 0xff,
+    0xf0, 0x00,
+    0x00, 0x00, 0x00, 0x00
+  };
+
+  _write_ts_header (packet, 0, TRUE, 0);
+  memcpy (packet + 4, PAT, sizeof (PAT));
+
+  packet += HWANGSAE_MPEGTS_PACKET_SIZE;
+  _write_ts_header (packet, THINNING_PMT_PID, TRUE, 0);
+  memcpy (packet + 4, PMT, sizeof (PMT));
+}
+
+/* Writes a single-packet access unit starting with an access unit
+ * delimiter. */
+static void
+_write_access_unit (guint8 * packet, guint8 nal_header, guint8 cc)
+{
+  static const guint8 PES_HEADER[] = {
+    0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x80, 0x80, 0x05,
+    0x21, 0x00, 0x01, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x01, 0x09, 0xf0,
+    0x00, 0x00, 0x00, 0x01
+  };
+
+  _write_ts_header (packet, THINNING_VIDEO_PID, TRUE, cc);
+  memcpy (packet + 4, PES_HEADER, sizeof (PES_HEADER));
+  packet[4 + sizeof (PES_HEADER)] = nal_header;
+}
+
+static void
+test_hwangsae_relay_thinning (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GVariant) stream_stats = NULL;
+  g_autoptr (GVariant) sources = NULL;
+  g_autoptr (GVariant) source_stats = NULL;
+  const guint N_CHUNKS = 500;
+  const guint AUS_PER_CHUNK = TS_CHUNK_SIZE / HWANGSAE_MPEGTS_PACKET_SIZE - 2;
+  guint8 buf[TS_CHUNK_SIZE];
+  guint idr_sent = 0;
+  guint idr_received = 0;
+  guint b_sent = 0;
+  guint b_received = 0;
+  guint8 next_cc = 0;
+  gboolean have_cc = FALSE;
+  guint64 packets_thinned;
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  guint8 cc = 0;
+  guint au = 0;
+  guint i;
+  gint len;
+
+  /* Even the packets waiting for an ACK on localhost make a subscriber
+   * look congested. */
+  g_object_set (relay, "thinning-threshold", 1, NULL);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=thin");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "thin", 0);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=thin");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "thin", 1);
+
+  /* Each GOP is an IDR frame followed by P frames with a non-reference
+   * B frame in between each. */
+  for (i = 0; i != N_CHUNKS; ++i) {
+    guint j;
+
+    _write_psi (buf);
+
+    for (j = 0; j != AUS_PER_CHUNK; ++j, ++au) {
+      guint8 nal_header;
+
+      if (au % 16 == 0) {
+        nal_header = 0x65;
+        ++idr_sent;
+      } else if (au % 2 == 1) {
+        nal_header = 0x01;
+        ++b_sent;
+      } else {
+        nal_header = 0x41;
+      }
+
+      _write_access_unit (buf + (2 + j) * HWANGSAE_MPEGTS_PACKET_SIZE,
+          nal_header, cc++);
+    }
+
+    g_assert_cmpint (srt_send (sink, (char *) buf, sizeof (buf)), ==,
+        sizeof (buf));
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  while ((len = srt_recvmsg (source, (char *) buf, sizeof (buf))) > 0) {
+    gint offset;
+
+    g_assert_cmpint (len % HWANGSAE_MPEGTS_PACKET_SIZE, ==, 0);
+
+    for (offset = 0; offset != len; offset += HWANGSAE_MPEGTS_PACKET_SIZE) {
+      guint8 *packet = buf + offset;
+
+      if (hwangsae_mpegts_packet_pid (packet) != THINNING_VIDEO_PID) {
+        continue;
+      }
+
+      /* Dropped packets must not show as discontinuities. */
+      if (have_cc) {
+        g_assert_cmpuint (packet[3] & 0x0f, ==, next_cc);
+      }
+      next_cc = (packet[3] + 1) & 0x0f;
+      have_cc = TRUE;
+
+      switch (packet[4 + 24]) {
+        case 0x65:
+          ++idr_received;
+          break;
+        case 0x01:
+          ++b_received;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  stream_stats = _lookup_stream_stats (relay, "thin");
+  sources = g_variant_lookup_value (stream_stats, "sources",
+      G_VARIANT_TYPE ("aa{sv}"));
+  g_assert_cmpuint (g_variant_n_children (sources), ==, 1);
+  source_stats = g_variant_get_child_value (sources, 0);
+  g_assert_true (g_variant_lookup (source_stats, "packets-thinned", "t",
+          &packets_thinned));
+
+  /* Frames got dropped, but never the IDR ones. */
+  g_assert_cmpuint (packets_thinned, >, 0);
+  g_assert_cmpuint (b_received, <, b_sent);
+  g_assert_cmpuint (idr_received, ==, idr_sent);
+
+  srt_close (source);
+  srt_close (sink);
+}
+
+static void
+test_hwangsae_relay_port_sharding (void)
+{
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 2)
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  g_autoptr (GVariant) listeners = NULL;
+  GVariantIter iter;
+  GVariant *listener;
+  const gchar *address;
+  SRTSOCKET sources[3];
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  guint i;
+
+  g_settings_set_uint (settings, "source-port-count", G_N_ELEMENTS (sources));
+  relay = hwangsae_relay_new ();
+
+  sink = _srt_connect (SINK_PORT, "#!::u=shard");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "shard", 0);
+
+  /* Subscribers to the first port spread over the ones with fewer
+   * connections. */
+  for (i = 0; i != G_N_ELEMENTS (sources); ++i) {
+    g_assert_cmpuint (hwangsae_relay_pick_source_port (relay, NULL), ==,
+        SOURCE_PORT + i);
+
+    if (i != 0) {
+      g_assert_cmpint (_srt_connect_rejected (SOURCE_PORT, "#!::r=shard"), ==,
+          HWANGSAE_REJECT_REDIRECT_PORT + i);
+    }
+
+    sources[i] = _srt_connect (SOURCE_PORT + i, "#!::r=shard");
+    g_assert_cmpint (sources[i], !=, SRT_INVALID_SOCK);
+    _wait_for_subscribers (relay, "shard", i + 1);
+  }
+
+  /* With all ports equally loaded, the first one accepts again. */
+  g_assert_cmpuint (hwangsae_relay_pick_source_port (relay, &address), ==,
+      SOURCE_PORT);
+  g_assert_cmpstr (address, ==, "0.0.0.0");
+
+  stats = hwangsae_relay_get_stats (relay);
+  listeners = g_variant_lookup_value (stats, "listeners",
+      G_VARIANT_TYPE ("aa{sv}"));
+  g_assert_cmpuint (g_variant_n_children (listeners), ==,
+      1 + G_N_ELEMENTS (sources));
+
+  g_variant_iter_init (&iter, listeners);
+  while ((listener = g_variant_iter_next_value (&iter))) {
+    guint connections;
+
+    g_assert_true (g_variant_lookup (listener, "connections", "u",
+            &connections));
+    g_assert_cmpuint (connections, ==, 1);
+    g_variant_unref (listener);
+  }
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+      sizeof (chunk));
+
+  for (i = 0; i != G_N_ELEMENTS (sources); ++i) {
+    g_assert_cmpint (srt_recvmsg (sources[i], (char *) buf, sizeof (buf)), ==,
+        sizeof (chunk));
+    srt_close (sources[i]);
+  }
+
+  srt_close (sink);
+#else
+  g_test_skip ("Redirects need SRT 1.4.2 or newer");
+#endif
+}
+
+static gboolean
+_have_ipv6_loopback (void)
+{
+  g_autoptr (GSocket) socket = NULL;
+  g_autoptr (GSocketAddress) address = NULL;
+
+  socket = g_socket_new (G_SOCKET_FAMILY_IPV6, G_SOCKET_TYPE_DATAGRAM,
+      G_SOCKET_PROTOCOL_UDP, NULL);
+  if (!socket) {
+    return FALSE;
+  }
+
+  address = g_inet_socket_address_new_from_string ("::1", 0);
+
+  return g_socket_bind (socket, address, FALSE, NULL);
+}
+
+static void
+test_hwangsae_relay_bind_addresses (void)
+{
+  const gchar *bind_addresses[] = { "127.0.0.1@0", "::1", NULL };
+  g_autoptr (GSettings) settings = NULL;
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  g_autoptr (GVariant) listeners = NULL;
+  GVariantIter iter;
+  GVariant *listener;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  guint n_ipv6_listeners = 0;
+
+  if (!_have_ipv6_loopback ()) {
+    g_test_skip ("IPv6 loopback isn't available");
+    return;
+  }
+
+  settings = _reset_relay_settings ();
+  g_settings_set_strv (settings, "bind-addresses", bind_addresses);
+  relay = hwangsae_relay_new ();
+
+  g_assert_cmpstr (hwangsae_relay_get_sink_uri (relay), ==,
+      "srt://127.0.0.1:8888");
+
+  /* The relay isn't reachable through addresses it doesn't bind. */
+  g_assert_cmpint (_srt_connect_address ("127.0.0.2", SOURCE_PORT,
+          "#!::r=bind"), ==, SRT_INVALID_SOCK);
+
+  sink = _srt_connect_address ("127.0.0.1", SINK_PORT, "#!::u=v4");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "v4", 0);
+
+  /* Streams are shared among the addresses. */
+  source = _srt_connect_address ("::1", SOURCE_PORT, "#!::r=v4");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "v4", 1);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+      sizeof (chunk));
+  g_assert_cmpint (srt_recvmsg (source, (char *) buf, sizeof (buf)), ==,
+      sizeof (chunk));
+
+  stats = hwangsae_relay_get_stats (relay);
+  listeners = g_variant_lookup_value (stats, "listeners",
+      G_VARIANT_TYPE ("aa{sv}"));
+  g_assert_cmpuint (g_variant_n_children (listeners), ==, 4);
+
+  g_variant_iter_init (&iter, listeners);
+  while ((listener = g_variant_iter_next_value (&iter))) {
+    const gchar *address;
+
+    g_assert_true (g_variant_lookup (listener, "address", "&s", &address));
+    if (g_str_equal (address, "::1")) {
+      ++n_ipv6_listeners;
+    } else {
+      g_assert_cmpstr (address, ==, "127.0.0.1");
+    }
+    g_variant_unref (listener);
+  }
+
+  g_assert_cmpuint (n_ipv6_listeners, ==, 2);
+
+  srt_close (source);
+  srt_close (sink);
+}
+
+static void
+test_hwangsae_relay_worker_placement (void)
+{
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  g_autoptr (GVariant) workers = NULL;
+  g_autoptr (GVariant) worker = NULL;
+  g_autofree gchar *allowed_cpu = NULL;
+  cpu_set_t allowed;
+  gint first_cpu;
+  const gchar *cpus;
+  const gchar *policy;
+  gint nice;
+  gint cpu;
+  SRTSOCKET sink;
+
+  /* The test may be confined to some of the machine's CPUs. */
+  g_assert_cmpint (sched_getaffinity (0, sizeof (allowed), &allowed), ==, 0);
+  for (first_cpu = 0; !CPU_ISSET (first_cpu, &allowed); ++first_cpu);
+  allowed_cpu = g_strdup_printf ("%d", first_cpu);
+
+  g_settings_set_string (settings, "worker-cpus", allowed_cpu);
+  g_settings_set_int (settings, "worker-nice", 5);
+  relay = hwangsae_relay_new ();
+
+  /* Makes sure the worker has started and placed itself. */
+  sink = _srt_connect (SINK_PORT, "#!::u=placement");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "placement", 0);
+
+  stats = hwangsae_relay_get_stats (relay);
+  workers = g_variant_lookup_value (stats, "workers",
+      G_VARIANT_TYPE ("aa{sv}"));
+  g_assert_cmpuint (g_variant_n_children (workers), ==, 1);
+  worker = g_variant_get_child_value (workers, 0);
+
+  if (!g_variant_lookup (worker, "cpus", "&s", &cpus)) {
+    g_test_skip ("Thread placement isn't reported on this system");
+    srt_close (sink);
+    return;
+  }
+
+  g_assert_cmpstr (cpus, ==, allowed_cpu);
+  g_assert_true (g_variant_lookup (worker, "policy", "&s", &policy));
+  g_assert_cmpstr (policy, ==, "other");
+  g_assert_true (g_variant_lookup (worker, "nice", "i", &nice));
+  g_assert_cmpint (nice, ==, 5);
+  g_assert_true (g_variant_lookup (worker, "cpu", "i", &cpu));
+  g_assert_true (cpu == -1 || cpu == first_cpu);
+
+  srt_close (sink);
+}
+
+static gboolean
+_have_element (const gchar * name)
+{
+  g_autoptr (GstElementFactory) factory = gst_element_factory_find (name);
+
+  return factory != NULL;
+}
+
+static void
+_collect_chunk_cb (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    GPtrArray * chunks)
+{
+  g_ptr_array_add (chunks, gst_buffer_ref (buffer));
+}
+
+/* Encodes test video into chunks of MPEG-TS as a camera would send them. */
+static GPtrArray *
+_encode_test_stream (guint width, guint height, guint n_frames)
+{
+  g_autoptr (GstElement) pipeline = NULL;
+  g_autoptr (GstElement) sink = NULL;
+  g_autoptr (GstBus) bus = NULL;
+  g_autoptr (GstMessage) message = NULL;
+  g_autofree gchar *pipeline_str = NULL;
+  g_autoptr (GError) error = NULL;
+  GPtrArray *chunks = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gst_buffer_unref);
+
+  pipeline_str = g_strdup_printf ("videotestsrc num-buffers=%u ! "
+      "video/x-raw,width=%u,height=%u,framerate=30/1 ! "
+      "x264enc tune=zerolatency key-int-max=30 ! mpegtsmux alignment=7 ! "
+      "fakesink name=sink signal-handoffs=true sync=false",
+      n_frames, width, height);
+
+  pipeline = gst_parse_launch (pipeline_str, &error);
+  g_assert_no_error (error);
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_signal_connect (sink, "handoff", G_CALLBACK (_collect_chunk_cb), chunks);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  bus = gst_element_get_bus (pipeline);
+  message = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_EOS);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  return chunks;
+}
+
+static void
+_set_renditions (HwangsaeRelay * relay, const gchar * stream,
+    const gchar * ladder)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ss}"));
+  g_variant_builder_add (&builder, "{ss}", stream, ladder);
+  g_object_set (relay, "stream-renditions", g_variant_builder_end (&builder),
+      NULL);
+}
+
+static void
+test_hwangsae_relay_renditions (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GPtrArray) chunks = NULL;
+  g_autoptr (GstDiscoverer) discoverer = NULL;
+  g_autoptr (GstDiscovererInfo) info = NULL;
+  g_autoptr (GVariant) stream_stats = NULL;
+  g_autoptr (GVariant) sources = NULL;
+  g_autoptr (GVariant) source_stats = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *uri = NULL;
+  const gchar *rendition;
+  GList *video_streams;
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  gsize received = 0;
+  gint64 deadline;
+  gint fd;
+  gint len;
+  guint i;
+
+  if (!_have_element ("x264enc") || !_have_element ("avdec_h264")) {
+    g_test_skip ("Transcoding needs x264enc and avdec_h264");
+    return;
+  }
+
+  chunks = _encode_test_stream (1280, 720, 90);
+
+  _set_renditions (relay, "abr", "480p,240p:300");
+
+  sink = _srt_connect (SINK_PORT, "#!::u=abr");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "abr", 0);
+
+  /* Only renditions of the ladder are available. */
+  g_assert_cmpint (_srt_connect (SOURCE_PORT, "#!::r=abr,q=1080p"), ==,
+      SRT_INVALID_SOCK);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=abr,q=240p");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "abr", 1);
+
+  /* The transcoder starts in the background, it must not miss the first
+   * keyframe. */
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  for (;;) {
+    g_autoptr (GVariant) abr_stats = _lookup_stream_stats (relay, "abr");
+    gboolean transcoding = FALSE;
+
+    g_variant_lookup (abr_stats, "transcoding", "b", &transcoding);
+    if (transcoding) {
+      break;
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  for (i = 0; i != chunks->len; ++i) {
+    GstBuffer *chunk = g_ptr_array_index (chunks, i);
+    GstMapInfo map;
+
+    gst_buffer_map (chunk, &map, GST_MAP_READ);
+    g_assert_cmpint (srt_send (sink, (char *) map.data, map.size), ==,
+        map.size);
+    gst_buffer_unmap (chunk, &map);
+
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  stream_stats = _lookup_stream_stats (relay, "abr");
+  sources = g_variant_lookup_value (stream_stats, "sources",
+      G_VARIANT_TYPE ("aa{sv}"));
+  g_assert_cmpuint (g_variant_n_children (sources), ==, 1);
+  source_stats = g_variant_get_child_value (sources, 0);
+  g_assert_true (g_variant_lookup (source_stats, "rendition", "&s",
+          &rendition));
+  g_assert_cmpstr (rendition, ==, "240p");
+
+  fd = g_file_open_tmp ("hwangsae-rendition-XXXXXX.ts", &path, &error);
+  g_assert_no_error (error);
+
+  while ((len = srt_recvmsg (source, (char *) buf, sizeof (buf))) > 0) {
+    g_assert_cmpint (write (fd, buf, len), ==, len);
+    received += len;
+  }
+  close (fd);
+
+  g_assert_cmpuint (received, >, 0);
+
+  /* The subscriber got the stream scaled down to the rendition's height. */
+  discoverer = gst_discoverer_new (5 * GST_SECOND, &error);
+  g_assert_no_error (error);
+  uri = g_filename_to_uri (path, NULL, &error);
+  g_assert_no_error (error);
+  info = gst_discoverer_discover_uri (discoverer, uri, &error);
+  g_assert_no_error (error);
+
+  video_streams = gst_discoverer_info_get_video_streams (info);
+  g_assert_nonnull (video_streams);
+  g_assert_cmpuint (gst_discoverer_video_info_get_height
+      (video_streams->data), ==, 240);
+  gst_discoverer_stream_info_list_free (video_streams);
+
+  g_unlink (path);
+
+  srt_close (source);
+  srt_close (sink);
+}
+
+/* Compares the CPU cost of fanning a stream out to SRT subscribers and to
+ * plain UDP receivers. */
+static gint64
+_measure_udp_fanout_cpu_time (guint n_receivers, guint64 * send_calls)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GPtrArray) receivers =
+      g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr (GVariant) stream_stats = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  SRTSOCKET sink;
+  gint64 cpu_time;
+  guint i;
+  guint p;
+
+  for (i = 0; i != n_receivers; ++i) {
+    g_ptr_array_add (receivers, _udp_socket_new ());
+  }
+  _set_udp_outputs (relay, "bench", (GSocket **) receivers->pdata,
+      n_receivers);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=bench");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "bench", 0);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+
+  cpu_time = _get_cpu_time ();
+
+  for (p = 0; p != BENCH_PACKETS; ++p) {
+    srt_send (sink, (char *) chunk, sizeof (chunk));
+
+    if (p % 10 == 0) {
+      /* The kernel discards whatever doesn't fit the receive buffers. */
+      g_usleep (1000);
+    }
+  }
+
+  cpu_time = _get_cpu_time () - cpu_time;
+
+  stream_stats = _lookup_stream_stats (relay, "bench");
+  g_assert_true (g_variant_lookup (stream_stats, "udp-send-calls", "t",
+          send_calls));
+
+  srt_close (sink);
+
+  return cpu_time;
+}
+
+static void
+test_hwangsae_relay_udp_egress_cost (void)
+{
+  const guint receiver_counts[] = { 1, 4, 16 };
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (receiver_counts); ++i) {
+    guint n = receiver_counts[i];
+    gint64 srt = _measure_fanout_cpu_time (0, n);
+    guint64 send_calls;
+    gint64 udp = _measure_udp_fanout_cpu_time (n, &send_calls);
+
+    g_test_message ("%2u receivers: SRT %.2f us, UDP %.2f us CPU per packet "
+        "per receiver (%.1f packets per send call)", n,
+        (gdouble) srt / BENCH_PACKETS / n, (gdouble) udp / BENCH_PACKETS / n,
+        (gdouble) BENCH_PACKETS * n / MAX (send_calls, 1));
+  }
+}
+
+#define FAIRNESS_LIGHT_STREAMS 4
+#define FAIRNESS_HEAVY_SUBSCRIBERS 4
+#define FAIRNESS_HEAVY_BURST 48
+#define FAIRNESS_DURATION_US (3 * G_TIME_SPAN_SECOND)
+
+typedef struct
+{
+  SRTSOCKET sink;
+  SRTSOCKET sources[FAIRNESS_HEAVY_SUBSCRIBERS];
+  gint running;
+} HeavyFeed;
+
+/* ~50 Mbps in bursts of FAIRNESS_HEAVY_BURST packets every 10 ms. */
+static gpointer
+_heavy_feed_thread_func (HeavyFeed * feed)
+{
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  guint i;
+
+  _fill_null_packets (chunk, sizeof (chunk));
+
+  while (g_atomic_int_get (&feed->running)) {
+    for (i = 0; i != FAIRNESS_HEAVY_BURST; ++i) {
+      srt_send (feed->sink, (char *) chunk, sizeof (chunk));
+    }
+
+    for (i = 0; i != FAIRNESS_HEAVY_SUBSCRIBERS; ++i) {
+      while (srt_recvmsg (feed->sources[i], (char *) buf, sizeof (buf)) > 0) {
+        /* Just drain the receive buffer. */
+      }
+    }
+
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  return NULL;
+}
+
+/* TSBPD would hold every packet for the whole SRT latency and hide the
+ * relay's own queueing delay. */
+static SRTSOCKET
+_srt_connect_no_tsbpd (guint port, const gchar * stream_id)
+{
+  SRTSOCKET sock = _srt_socket_new (stream_id);
+  gint no = 0;
+
+  srt_setsockflag (sock, SRTO_TSBPDMODE, &no, sizeof (no));
+
+  sock = _srt_socket_connect (sock, port);
+  g_assert_cmpint (sock, !=, SRT_INVALID_SOCK);
+
+  srt_setsockflag (sock, SRTO_RCVSYN, &no, sizeof (no));
+
+  return sock;
+}
+
+static gint
+_compare_latency (gconstpointer a, gconstpointer b)
+{
+  gint64 la = *(const gint64 *) a;
+  gint64 lb = *(const gint64 *) b;
+
+  return (la > lb) - (la < lb);
+}
+
+/* Returns the sorted latencies of packets of low-bitrate streams relayed
+ * alongside a high-bitrate one. */
+static GArray *
+_measure_light_stream_latency (guint recv_budget)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  GArray *latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  SRTSOCKET light_sinks[FAIRNESS_LIGHT_STREAMS];
+  SRTSOCKET light_sources[FAIRNESS_LIGHT_STREAMS];
+  HeavyFeed feed = { 0 };
+  GThread *thread;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  gint64 end_time;
+  guint tick;
+  guint i;
+
+  g_object_set (relay, "recv-budget", recv_budget, NULL);
+
+  feed.sink = _srt_connect (SINK_PORT, "#!::u=heavy");
+  g_assert_cmpint (feed.sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "heavy", 0);
+
+  for (i = 0; i != FAIRNESS_HEAVY_SUBSCRIBERS; ++i) {
+    gint no = 0;
+
+    feed.sources[i] = _srt_connect (SOURCE_PORT, "#!::r=heavy");
+    g_assert_cmpint (feed.sources[i], !=, SRT_INVALID_SOCK);
+    srt_setsockflag (feed.sources[i], SRTO_RCVSYN, &no, sizeof (no));
+  }
+  _wait_for_subscribers (relay, "heavy", FAIRNESS_HEAVY_SUBSCRIBERS);
+
+  for (i = 0; i != FAIRNESS_LIGHT_STREAMS; ++i) {
+    g_autofree gchar *sink_id = g_strdup_printf ("#!::u=light%u", i);
+    g_autofree gchar *source_id = g_strdup_printf ("#!::r=light%u", i);
+    g_autofree gchar *stream = g_strdup_printf ("light%u", i);
+
+    light_sinks[i] = _srt_connect_no_tsbpd (SINK_PORT, sink_id);
+    _wait_for_subscribers (relay, stream, 0);
+    light_sources[i] = _srt_connect_no_tsbpd (SOURCE_PORT, source_id);
+    _wait_for_subscribers (relay, stream, 1);
+  }
+
+  feed.running = TRUE;
+  thread = g_thread_new ("heavy-feed", (GThreadFunc) _heavy_feed_thread_func,
+      &feed);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  end_time = g_get_monotonic_time () + FAIRNESS_DURATION_US;
+
+  for (tick = 0; g_get_monotonic_time () < end_time; ++tick) {
+    /* ~1 Mbps per light stream. */
+    if (tick % 10 == 0) {
+      for (i = 0; i != FAIRNESS_LIGHT_STREAMS; ++i) {
+        gint64 now = g_get_monotonic_time ();
+
+        memcpy (chunk + 8, &now, sizeof (now));
+        srt_send (light_sinks[i], (char *) chunk, sizeof (chunk));
+      }
+    }
+
+    for (i = 0; i != FAIRNESS_LIGHT_STREAMS; ++i) {
+      while (srt_recvmsg (light_sources[i], (char *) buf, sizeof (buf)) > 0) {
+        gint64 send_time;
+        gint64 latency;
+
+        memcpy (&send_time, buf + 8, sizeof (send_time));
+        latency = g_get_monotonic_time () - send_time;
+        g_array_append_val (latencies, latency);
+      }
+    }
+
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  g_atomic_int_set (&feed.running, FALSE);
+  g_thread_join (thread);
+
+  for (i = 0; i != FAIRNESS_LIGHT_STREAMS; ++i) {
+    srt_close (light_sources[i]);
+    srt_close (light_sinks[i]);
+  }
+  for (i = 0; i != FAIRNESS_HEAVY_SUBSCRIBERS; ++i) {
+    srt_close (feed.sources[i]);
+  }
+  srt_close (feed.sink);
+
+  g_array_sort (latencies, _compare_latency);
+
+  return latencies;
+}
 
 static void
-test_hwangsae_relay_instance (void)
+_print_light_stream_latency (const gchar * name, GArray * latencies)
 {
-  guint sink_port, source_port;
+  gint64 sum = 0;
+  guint i;
+
+  g_assert_cmpuint (latencies->len, >, 0);
+
+  for (i = 0; i != latencies->len; ++i) {
+    sum += g_array_index (latencies, gint64, i);
+  }
+
+  g_test_message ("%s: %u packets, latency avg %.2f ms p99 %.2f ms "
+      "max %.2f ms", name, latencies->len, sum / 1000.0 / latencies->len,
+      g_array_index (latencies, gint64, latencies->len * 99 / 100) / 1000.0,
+      g_array_index (latencies, gint64, latencies->len - 1) / 1000.0);
+}
+
+static void
+test_hwangsae_relay_fairness (void)
+{
+  g_autoptr (GArray) drain = _measure_light_stream_latency (0);
+  g_autoptr (GArray) budget = _measure_light_stream_latency (8);
+
+  _print_light_stream_latency ("Drain each publisher", drain);
+  _print_light_stream_latency ("Round robin, 8 packets per turn", budget);
+}
+
+#define REBALANCE_STREAMS 3
+
+typedef struct
+{
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  guint64 sent;
+  guint64 received;
+} SequencedFeed;
+
+static void
+_sequenced_feed_send (SequencedFeed * feed, guint n_chunks)
+{
+  guint8 chunk[TS_CHUNK_SIZE];
+
+  _fill_null_packets (chunk, sizeof (chunk));
+
+  for (; n_chunks != 0; --n_chunks) {
+    memcpy (chunk + 8, &feed->sent, sizeof (feed->sent));
+    g_assert_cmpint (srt_send (feed->sink, (char *) chunk, sizeof (chunk)),
+        ==, sizeof (chunk));
+    ++feed->sent;
+  }
+}
+
+/* Every chunk must arrive exactly once and in order. */
+static void
+_sequenced_feed_receive (SequencedFeed * feed)
+{
+  guint8 buf[1500];
+
+  while (srt_recvmsg (feed->source, (char *) buf, sizeof (buf)) > 0) {
+    guint64 seqnum;
+
+    memcpy (&seqnum, buf + 8, sizeof (seqnum));
+    g_assert_cmpuint (seqnum, ==, feed->received);
+    ++feed->received;
+  }
+}
+
+static guint
+_get_stream_worker (HwangsaeRelay * relay, const gchar * stream)
+{
+  g_autoptr (GVariant) stream_stats = _lookup_stream_stats (relay, stream);
+  guint worker;
+
+  g_assert_true (g_variant_lookup (stream_stats, "worker", "u", &worker));
+
+  return worker;
+}
+
+static void
+test_hwangsae_relay_rebalance (void)
+{
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  SequencedFeed feeds[REBALANCE_STREAMS] = { 0 };
+  guint64 moved = 0;
+  gint64 deadline;
+  gint64 moved_time = 0;
+  guint tick;
+  guint i;
+
+  g_settings_set_uint (settings, "workers-per-address", 2);
+  g_settings_set_uint (settings, "rebalance-interval", 100);
+  relay = hwangsae_relay_new ();
+
+  /* Streams go to the workers in turns. */
+  for (i = 0; i != REBALANCE_STREAMS; ++i) {
+    g_autofree gchar *sink_id = g_strdup_printf ("#!::u=balance%u", i);
+    g_autofree gchar *source_id = g_strdup_printf ("#!::r=balance%u", i);
+    g_autofree gchar *stream = g_strdup_printf ("balance%u", i);
+
+    feeds[i].sink = _srt_connect (SINK_PORT, sink_id);
+    g_assert_cmpint (feeds[i].sink, !=, SRT_INVALID_SOCK);
+    _wait_for_subscribers (relay, stream, 0);
+    feeds[i].source = _srt_connect_no_tsbpd (SOURCE_PORT, source_id);
+    _wait_for_subscribers (relay, stream, 1);
+  }
+
+  g_assert_cmpuint (_get_stream_worker (relay, "balance0"), ==,
+      _get_stream_worker (relay, "balance2"));
+
+  deadline = g_get_monotonic_time () + 10 * G_TIME_SPAN_SECOND;
+
+  /* Keeps the streams flowing for a while after the move. */
+  for (tick = 0; moved == 0 ||
+      g_get_monotonic_time () < moved_time + 500 * G_TIME_SPAN_MILLISECOND;
+      ++tick) {
+    _sequenced_feed_send (&feeds[0], 4);
+    _sequenced_feed_send (&feeds[2], 4);
+    if (tick % 10 == 0) {
+      _sequenced_feed_send (&feeds[1], 1);
+    }
+
+    for (i = 0; i != REBALANCE_STREAMS; ++i) {
+      _sequenced_feed_receive (&feeds[i]);
+    }
+
+    if (moved == 0 && tick % 50 == 0) {
+      g_autoptr (GVariant) stats = hwangsae_relay_get_stats (relay);
+
+      g_assert_true (g_variant_lookup (stats, "streams-moved", "t", &moved));
+      moved_time = g_get_monotonic_time ();
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  /* The heavy streams got split among the workers. */
+  g_assert_cmpuint (_get_stream_worker (relay, "balance0"), !=,
+      _get_stream_worker (relay, "balance2"));
+
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+
+  for (i = 0; i != REBALANCE_STREAMS; ++i) {
+    while (feeds[i].received != feeds[i].sent) {
+      g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+      g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+      _sequenced_feed_receive (&feeds[i]);
+    }
+
+    srt_close (feeds[i].source);
+    srt_close (feeds[i].sink);
+  }
+}
+
+/* Never reads, so once its tiny receive buffer is full the relay has to
+ * keep the stream in its send buffer. */
+static SRTSOCKET
+_srt_connect_stalled (guint port, const gchar * stream_id)
+{
+  SRTSOCKET sock = _srt_socket_new (stream_id);
+  gint fc = 32;
+  gint rcvbuf = 32 * 1456;
+
+  srt_setsockflag (sock, SRTO_FC, &fc, sizeof (fc));
+  srt_setsockflag (sock, SRTO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+
+  return _srt_socket_connect (sock, port);
+}
+
+static void
+test_hwangsae_relay_memory_budget (void)
+{
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  SRTSOCKET reader;
+  SRTSOCKET stalled;
+  guint64 shed = 0;
+  guint64 usage;
+  gint64 deadline;
+  guint tick;
+
+  g_settings_set_uint (settings, "memory-budget", 64);
+  relay = hwangsae_relay_new ();
+
+  sink = _srt_connect (SINK_PORT, "#!::u=budget");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "budget", 0);
+
+  reader = _srt_connect_no_tsbpd (SOURCE_PORT, "#!::r=budget");
+  _wait_for_subscribers (relay, "budget", 1);
+
+  stalled = _srt_connect_stalled (SOURCE_PORT, "#!::r=budget");
+  g_assert_cmpint (stalled, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "budget", 2);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+
+  /* ~10 Mbps */
+  for (tick = 0; shed == 0; ++tick) {
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+
+    while (srt_recvmsg (reader, (char *) buf, sizeof (buf)) > 0);
+
+    if (tick % 50 == 0) {
+      g_autoptr (GVariant) tick_stats = hwangsae_relay_get_stats (relay);
+
+      g_assert_true (g_variant_lookup (tick_stats, "subscribers-shed", "t",
+              &shed));
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  /* Only the lagging subscriber got dropped. */
+  g_assert_cmpuint (shed, ==, 1);
+  _wait_for_subscribers (relay, "budget", 1);
+
+  g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+      sizeof (chunk));
+  g_usleep (100 * G_TIME_SPAN_MILLISECOND);
+  g_assert_cmpint (srt_recvmsg (reader, (char *) buf, sizeof (buf)), >, 0);
+
+  stats = hwangsae_relay_get_stats (relay);
+  g_assert_true (g_variant_lookup (stats, "memory-usage", "t", &usage));
+  g_assert_cmpuint (usage, <=, 64 * 1024);
+
+  srt_close (stalled);
+  srt_close (reader);
+  srt_close (sink);
+}
+
+static void
+test_hwangsae_relay_subscriber_classes (void)
+{
+  const gchar *expected_classes[] = { "recorder", "operator", "public" };
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  g_autoptr (GVariant) stream_stats = NULL;
+  g_autoptr (GVariant) sources = NULL;
+  g_autoptr (GVariant) source_stats = NULL;
+  SRTSOCKET subscribers[G_N_ELEMENTS (expected_classes)];
+  guint8 chunk[TS_CHUNK_SIZE];
+  const gchar *class_name;
+  const gchar *pressure;
+  SRTSOCKET sink;
+  guint64 shed = 0;
+  gint64 deadline;
+  guint tick;
+  guint i;
+
+  g_settings_set_uint (settings, "memory-budget", 64);
+  relay = hwangsae_relay_new ();
+
+  sink = _srt_connect (SINK_PORT, "#!::u=classes");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "classes", 0);
+
+  g_assert_cmpint (_srt_connect (SOURCE_PORT, "#!::r=classes,c=vip"), ==,
+      SRT_INVALID_SOCK);
+
+  /* Privileged classes need their token. */
+  g_assert_cmpint (_srt_connect (SOURCE_PORT,
+          "#!::r=classes,c=recorder,s=" RECORDER_TOKEN), ==, SRT_INVALID_SOCK);
+
+  _set_class_tokens (relay);
+
+  g_assert_cmpint (_srt_connect (SOURCE_PORT, "#!::r=classes,c=recorder"), ==,
+      SRT_INVALID_SOCK);
+  g_assert_cmpint (_srt_connect (SOURCE_PORT,
+          "#!::r=classes,c=recorder,s=" OPERATOR_TOKEN), ==, SRT_INVALID_SOCK);
+
+  /* None of them reads. */
+  subscribers[0] = _srt_connect_stalled (SOURCE_PORT, "#!::r=classes");
+  subscribers[1] = _srt_connect_stalled (SOURCE_PORT,
+      "#!::r=classes,c=recorder,s=" RECORDER_TOKEN);
+  subscribers[2] = _srt_connect_stalled (SOURCE_PORT,
+      "#!::r=classes,c=operator,s=" OPERATOR_TOKEN);
+  for (i = 0; i != G_N_ELEMENTS (subscribers); ++i) {
+    g_assert_cmpint (subscribers[i], !=, SRT_INVALID_SOCK);
+  }
+  _wait_for_subscribers (relay, "classes", G_N_ELEMENTS (subscribers));
+
+  /* Fan-out serves the higher classes first. */
+  stream_stats = _lookup_stream_stats (relay, "classes");
+  sources = g_variant_lookup_value (stream_stats, "sources",
+      G_VARIANT_TYPE ("aa{sv}"));
+  for (i = 0; i != G_N_ELEMENTS (expected_classes); ++i) {
+    g_autoptr (GVariant) source = g_variant_get_child_value (sources, i);
+
+    g_assert_true (g_variant_lookup (source, "class", "&s", &class_name));
+    g_assert_cmpstr (class_name, ==, expected_classes[i]);
+  }
+  g_clear_pointer (&sources, g_variant_unref);
+  g_clear_pointer (&stream_stats, g_variant_unref);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+
+  /* Public goes first, then operator; the recorder stays. */
+  for (tick = 0; shed < 2; ++tick) {
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+
+    if (tick % 50 == 0) {
+      g_autoptr (GVariant) stats = hwangsae_relay_get_stats (relay);
+
+      g_assert_true (g_variant_lookup (stats, "subscribers-shed", "t",
+              &shed));
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  /* With only the recorder's backlog left to blame, the relay refuses new
+   * connections instead. */
+  for (; g_get_monotonic_time () < deadline; ++tick) {
+    g_autoptr (GVariant) stats = hwangsae_relay_get_stats (relay);
+
+    g_assert_true (g_variant_lookup (stats, "memory-pressure", "&s",
+            &pressure));
+    if (g_str_equal (pressure, "refuse")) {
+      break;
+    }
+
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  stream_stats = _lookup_stream_stats (relay, "classes");
+  sources = g_variant_lookup_value (stream_stats, "sources",
+      G_VARIANT_TYPE ("aa{sv}"));
+  g_assert_cmpuint (g_variant_n_children (sources), ==, 1);
+  source_stats = g_variant_get_child_value (sources, 0);
+  g_assert_true (g_variant_lookup (source_stats, "class", "&s", &class_name));
+  g_assert_cmpstr (class_name, ==, "recorder");
+  g_assert_cmpstr (pressure, ==, "refuse");
+
+  for (i = 0; i != G_N_ELEMENTS (subscribers); ++i) {
+    srt_close (subscribers[i]);
+  }
+  srt_close (sink);
+}
+
+static void
+test_hwangsae_relay_cpu_admission (void)
+{
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 2)
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  SRTSOCKET sources[2];
+  guint64 refused;
+  guint i;
+
+  /* Sending to a subscriber always takes longer. */
+  g_settings_set_uint (settings, "max-fanout-lag", 1);
+  relay = hwangsae_relay_new ();
+
+  sink = _srt_connect (SINK_PORT, "#!::u=admission");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "admission", 0);
+
+  sources[0] = _srt_connect (SOURCE_PORT, "#!::r=admission");
+  g_assert_cmpint (sources[0], !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "admission", 1);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+  for (i = 0; i != 10; ++i) {
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+    g_assert_cmpint (srt_recvmsg (sources[0], (char *) buf, sizeof (buf)), ==,
+        sizeof (chunk));
+  }
+
+  g_assert_cmpint (_srt_connect_rejected (SOURCE_PORT, "#!::r=admission"), ==,
+      HWANGSAE_REJECT_OVERLOADED);
+
+  stats = hwangsae_relay_get_stats (relay);
+  g_assert_true (g_variant_lookup (stats, "connections-refused", "t",
+          &refused));
+  g_assert_cmpuint (refused, ==, 1);
+
+  /* The subscriber already watching is unaffected. */
+  g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+      sizeof (chunk));
+  g_assert_cmpint (srt_recvmsg (sources[0], (char *) buf, sizeof (buf)), ==,
+      sizeof (chunk));
+
+  g_settings_set_uint (settings, "max-fanout-lag", 0);
+
+  sources[1] = _srt_connect (SOURCE_PORT, "#!::r=admission");
+  g_assert_cmpint (sources[1], !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "admission", 2);
+
+  for (i = 0; i != G_N_ELEMENTS (sources); ++i) {
+    srt_close (sources[i]);
+  }
+  srt_close (sink);
+#else
+  g_test_skip ("Reject reasons need SRT 1.4.2 or newer");
+#endif
+}
+
+static void
+test_hwangsae_relay_sender_threads (void)
+{
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  g_autoptr (GVariant) senders = NULL;
+  g_autoptr (GVariant) stream_stats = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  SRTSOCKET sources[2];
+  guint sender;
+  gint64 deadline;
+  guint i;
+  guint j;
+
+  g_settings_set_uint (settings, "sender-threads", 2);
+  relay = hwangsae_relay_new ();
+
+  stats = hwangsae_relay_get_stats (relay);
+  senders = g_variant_lookup_value (stats, "senders",
+      G_VARIANT_TYPE ("aa{sv}"));
+  g_assert_nonnull (senders);
+  g_assert_cmpuint (g_variant_n_children (senders), ==, 2);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=senders");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "senders", 0);
+
+  for (i = 0; i != G_N_ELEMENTS (sources); ++i) {
+    sources[i] = _srt_connect (SOURCE_PORT, "#!::r=senders");
+    g_assert_cmpint (sources[i], !=, SRT_INVALID_SOCK);
+  }
+  _wait_for_subscribers (relay, "senders", G_N_ELEMENTS (sources));
+
+  stream_stats = _lookup_stream_stats (relay, "senders");
+  g_assert_true (g_variant_lookup (stream_stats, "sender", "u", &sender));
+  g_assert_cmpuint (sender, <, 2);
+
+  /* Packets arrive intact and in order. */
+  for (i = 0; i != 20; ++i) {
+    _fill_null_packets (chunk, sizeof (chunk));
+    chunk[4] = i;
+
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+
+    for (j = 0; j != G_N_ELEMENTS (sources); ++j) {
+      g_assert_cmpint (srt_recvmsg (sources[j], (char *) buf, sizeof (buf)),
+          ==, sizeof (chunk));
+      g_assert_cmpmem (buf, sizeof (chunk), chunk, sizeof (chunk));
+    }
+  }
+
+  /* A subscriber that went away gets removed once sending to it fails. */
+  srt_close (sources[1]);
+
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  for (;;) {
+    g_autoptr (GVariant) current = _lookup_stream_stats (relay, "senders");
+    guint n;
+
+    g_assert_true (g_variant_lookup (current, "subscribers", "u", &n));
+    if (n == 1) {
+      break;
+    }
+
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+    srt_recvmsg (sources[0], (char *) buf, sizeof (buf));
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  srt_close (sources[0]);
+  srt_close (sink);
+}
+
+static void
+test_hwangsae_relay_stats_file (void)
+{
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = NULL;
+  g_autofree gchar *path = g_build_filename (g_get_tmp_dir (),
+      "hwangsae-test-stats", NULL);
+  const HwangsaeStatsPage *page;
+  HwangsaeStatsStream stream = { 0 };
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  gint64 deadline;
+  gint fd;
+
+  g_settings_set_string (settings, "stats-file", path);
+  relay = hwangsae_relay_new ();
+
+  fd = open (path, O_RDONLY);
+  g_assert_cmpint (fd, >=, 0);
+  page = mmap (NULL, sizeof (*page), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  g_assert_true (page != MAP_FAILED);
+  g_assert_cmphex (page->magic, ==, HWANGSAE_STATS_PAGE_MAGIC);
+  g_assert_cmpuint (page->n_workers, ==, 1);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=stats-file");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "stats-file", 0);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=stats-file");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "stats-file", 1);
+
+  _fill_null_packets (chunk, sizeof (chunk));
+
+  /* Housekeeping publishes the counters a few times a second. */
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  while (stream.bytes_out < 10 * sizeof (chunk)) {
+    HwangsaeStatsSummary summary;
+
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+    g_assert_cmpint (srt_recvmsg (source, (char *) buf, sizeof (buf)), ==,
+        sizeof (chunk));
+
+    if (hwangsae_stats_page_read (&page->summary.seq, &page->summary,
+            &summary, sizeof (summary)) && summary.n_streams == 1) {
+      hwangsae_stats_page_read (&page->streams[0].seq, &page->streams[0],
+          &stream, sizeof (stream));
+    }
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  g_assert_cmpstr (stream.stream, ==, "stats-file");
+  g_assert_cmpuint (stream.subscribers, ==, 1);
+  g_assert_cmpuint (stream.bytes_in, >=, stream.bytes_out);
+
+  srt_close (source);
+  srt_close (sink);
+
+  /* The relay removes the file once it's gone. */
+  g_clear_object (&relay);
+  g_assert_false (g_file_test (path, G_FILE_TEST_EXISTS));
+
+  munmap ((gpointer) page, sizeof (*page));
+}
+
+static void
+_set_flag (gpointer instance, gboolean * flag)
+{
+  *flag = TRUE;
+}
+
+static void
+test_hwangsae_relay_drain (void)
+{
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 2)
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
   g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new ();
+  g_autoptr (GVariant) stats = NULL;
+  guint8 chunk[TS_CHUNK_SIZE];
+  guint8 buf[1500];
+  gboolean draining = FALSE;
+  gboolean drained = FALSE;
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  gint64 deadline;
 
-  g_assert_nonnull (relay);
+  g_signal_connect (relay, "drained", G_CALLBACK (_set_flag), &drained);
 
-  g_object_get (relay, "sink-port", &sink_port, "source-port", &source_port,
-      NULL);
+  sink = _srt_connect (SINK_PORT, "#!::u=drain");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "drain", 0);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=drain");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "drain", 1);
+
+  hwangsae_relay_drain (relay, 0);
+
+  stats = hwangsae_relay_get_stats (relay);
+  g_assert_true (g_variant_lookup (stats, "draining", "b", &draining));
+  g_assert_true (draining);
+
+  g_assert_cmpint (_srt_connect_rejected (SOURCE_PORT, "#!::r=drain"), ==,
+      HWANGSAE_REJECT_DRAINING);
+  g_assert_cmpint (_srt_connect_rejected (SINK_PORT, "#!::u=drain2"), ==,
+      HWANGSAE_REJECT_DRAINING);
+
+  /* Clients already connected keep being served. */
+  _fill_null_packets (chunk, sizeof (chunk));
+  g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+      sizeof (chunk));
+  g_assert_cmpint (srt_recvmsg (source, (char *) buf, sizeof (buf)), ==,
+      sizeof (chunk));
+
+  g_main_context_iteration (NULL, FALSE);
+  g_assert_false (drained);
+
+  srt_close (source);
+
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  while (!drained) {
+    g_assert_cmpint (srt_send (sink, (char *) chunk, sizeof (chunk)), ==,
+        sizeof (chunk));
+    g_main_context_iteration (NULL, FALSE);
+
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  srt_close (sink);
+#else
+  g_test_skip ("Reject reasons need SRT 1.4.2 or newer");
+#endif
+}
+
+static void
+test_hwangsae_relay_drain_timeout (void)
+{
+  g_autoptr (GSettings) settings = _reset_relay_settings ();
+  g_autoptr (HwangsaeRelay) relay = hwangsae_relay_new ();
+  g_autoptr (GVariant) stats = NULL;
+  gboolean drained = FALSE;
+  gboolean subscriber_closed = FALSE;
+  guint subscribers;
+  SRTSOCKET sink;
+  SRTSOCKET source;
+  gint64 start_time;
+
+  g_signal_connect (relay, "drained", G_CALLBACK (_set_flag), &drained);
+
+  sink = _srt_connect (SINK_PORT, "#!::u=drain-timeout");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "drain-timeout", 0);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=drain-timeout");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "drain-timeout", 1);
+
+  start_time = g_get_monotonic_time ();
+  hwangsae_relay_drain (relay, 1);
+
+  /* Neither client leaves, the relay closes them one after the other over
+   * the drain's time. */
+  while (!drained) {
+    g_autoptr (GVariant) stream_stats = NULL;
+    guint n;
+
+    g_main_context_iteration (NULL, FALSE);
+
+    stream_stats = _lookup_stream_stats (relay, "drain-timeout");
+    if (stream_stats && g_variant_lookup (stream_stats, "subscribers", "u",
+            &n) && n == 0) {
+      subscriber_closed = TRUE;
+    }
+
+    g_assert_cmpint (g_get_monotonic_time () - start_time, <,
+        5 * G_TIME_SPAN_SECOND);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  g_assert_cmpint (g_get_monotonic_time () - start_time, >=,
+      G_TIME_SPAN_SECOND);
+  g_assert_true (subscriber_closed);
+
+  stats = hwangsae_relay_get_stats (relay);
+  g_assert_true (g_variant_lookup (stats, "subscribers", "u", &subscribers));
+  g_assert_cmpuint (subscribers, ==, 0);
+  g_assert_null (_lookup_stream_stats (relay, "drain-timeout"));
+
+  srt_close (source);
+  srt_close (sink);
+}
+
+/* What a subscriber of an aggregate learned from the PAT and PMTs it got,
+ * indexed by program number. */
+typedef struct
+{
+  guint n_programs;
+  guint16 pmt_pids[3];
+  guint16 video_pids[3];
+  guint video_packets[3];
+} AggregateView;
+
+static void
+_parse_aggregate (const guint8 * data, gint len, AggregateView * view)
+{
+  gint offset;
+
+  for (offset = 0; offset < len; offset += HWANGSAE_MPEGTS_PACKET_SIZE) {
+    const guint8 *packet = data + offset;
+    const guint8 *section = packet + 5;
+    guint16 pid = hwangsae_mpegts_packet_pid (packet);
+    guint program;
+
+    g_assert_true (hwangsae_mpegts_packet_is_valid (packet));
+
+    if (pid == 0) {
+      gsize section_len = 3 + (((section[1] & 0x0f) << 8) | section[2]);
+      gsize i;
+
+      view->n_programs = 0;
+      memset (view->pmt_pids, 0, sizeof (view->pmt_pids));
+
+      for (i = 8; i + 4 <= section_len - 4; i += 4) {
+        program = (section[i] << 8) | section[i + 1];
+        g_assert_cmpuint (program, >=, 1);
+        g_assert_cmpuint (program, <=, 2);
+
+        view->pmt_pids[program] = ((section[i + 2] & 0x1f) << 8) |
+            section[i + 3];
+        ++view->n_programs;
+      }
+      continue;
+    }
 
-  g_assert_cmpint (sink_port, ==, 8888);
-  g_assert_cmpint (source_port, ==, 9999);
+    for (program = 1; program != G_N_ELEMENTS (view->pmt_pids); ++program) {
+      if (view->pmt_pids[program] == pid) {
+        gsize i = 12 + (((section[10] & 0x0f) << 8) | section[11]);
+
+        g_assert_cmpuint ((section[3] << 8) | section[4], ==, program);
+        view->video_pids[program] = ((section[i + 1] & 0x1f) << 8) |
+            section[i + 2];
+      } else if (view->video_pids[program] == pid) {
+        ++view->video_packets[program];
+      }
+    }
+  }
+}
+
+static void
+_send_aggregated_chunk (SRTSOCKET sink, guint8 cc)
+{
+  guint8 buf[TS_CHUNK_SIZE];
+  guint i;
+
+  _write_psi (buf);
+  for (i = 2; i != TS_CHUNK_SIZE / HWANGSAE_MPEGTS_PACKET_SIZE; ++i) {
+    _write_access_unit (buf + i * HWANGSAE_MPEGTS_PACKET_SIZE, 0x65, cc++);
+  }
+
+  g_assert_cmpint (srt_send (sink, (char *) buf, sizeof (buf)), ==,
+      sizeof (buf));
+}
+
+static void
+test_hwangsae_relay_aggregate (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GVariant) stream_stats = NULL;
+  g_autoptr (GVariant) sources = NULL;
+  g_autoptr (GVariant) source_stats = NULL;
+  AggregateView view = { 0 };
+  guint8 buf[TS_CHUNK_SIZE];
+  SRTSOCKET sink1;
+  SRTSOCKET sink2;
+  SRTSOCKET sink3;
+  SRTSOCKET source;
+  guint program;
+  guint8 cc = 0;
+  guint i;
+
+  sink1 = _srt_connect (SINK_PORT, "#!::u=agg1");
+  g_assert_cmpint (sink1, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "agg1", 0);
+
+  sink2 = _srt_connect (SINK_PORT, "#!::u=agg2");
+  g_assert_cmpint (sink2, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "agg2", 0);
+
+  g_assert_cmpint (_srt_connect (SOURCE_PORT, "#!::r=agg1+agg1"), ==,
+      SRT_INVALID_SOCK);
+  g_assert_cmpint (_srt_connect (SOURCE_PORT, "#!::r=agg1+nonexistent"), ==,
+      SRT_INVALID_SOCK);
+
+  /* A stream whose name contains '+' isn't taken for an aggregate. */
+  sink3 = _srt_connect (SINK_PORT, "#!::u=agg1+agg3");
+  g_assert_cmpint (sink3, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "agg1+agg3", 0);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=agg1+agg3");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "agg1+agg3", 1);
+  _wait_for_subscribers (relay, "agg1", 0);
+  srt_close (source);
+  srt_close (sink3);
+
+  source = _srt_connect (SOURCE_PORT, "#!::r=agg1+agg2");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "agg1", 1);
+  _wait_for_subscribers (relay, "agg2", 1);
+
+  stream_stats = _lookup_stream_stats (relay, "agg2");
+  sources = g_variant_lookup_value (stream_stats, "sources",
+      G_VARIANT_TYPE ("aa{sv}"));
+  source_stats = g_variant_get_child_value (sources, 0);
+  g_assert_true (g_variant_lookup (source_stats, "program", "u", &program));
+  g_assert_cmpuint (program, ==, 2);
+
+  /* Both streams use the same PIDs, each chunk comes out as one message. */
+  for (i = 0; view.n_programs != 2 || view.video_packets[1] == 0 ||
+      view.video_packets[2] == 0; ++i, cc += 5) {
+    gint len;
+
+    g_assert_cmpuint (i, <, 50);
+
+    _send_aggregated_chunk (sink1, cc);
+    _send_aggregated_chunk (sink2, cc);
+
+    len = srt_recv (source, (char *) buf, sizeof (buf));
+    g_assert_cmpint (len, >, 0);
+    _parse_aggregate (buf, len, &view);
+
+    len = srt_recv (source, (char *) buf, sizeof (buf));
+    g_assert_cmpint (len, >, 0);
+    _parse_aggregate (buf, len, &view);
+  }
+
+  g_assert_cmpuint (view.pmt_pids[1], !=, view.pmt_pids[2]);
+  g_assert_cmpuint (view.video_pids[1], !=, 0);
+  g_assert_cmpuint (view.video_pids[2], !=, 0);
+  g_assert_cmpuint (view.video_pids[1], !=, view.video_pids[2]);
+
+  /* The subscriber keeps getting the remaining stream. */
+  srt_close (sink2);
+  g_clear_pointer (&stream_stats, g_variant_unref);
+  while ((stream_stats = _lookup_stream_stats (relay, "agg2"))) {
+    g_variant_unref (stream_stats);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  for (i = 0; view.n_programs != 1; ++i, cc += 5) {
+    gint len;
+
+    g_assert_cmpuint (i, <, 50);
+
+    _send_aggregated_chunk (sink1, cc);
+
+    len = srt_recv (source, (char *) buf, sizeof (buf));
+    g_assert_cmpint (len, >, 0);
+    _parse_aggregate (buf, len, &view);
+  }
+
+  g_assert_cmpuint (view.pmt_pids[1], !=, 0);
+  g_assert_cmpuint (view.pmt_pids[2], ==, 0);
+
+  srt_close (source);
+  srt_close (sink1);
+}
+
+#define SPLIT_PMT_PID(program) (0x1000 + (program))
+#define SPLIT_VIDEO_PID(program) (0x100 * (program))
+
+/* Writes a PAT listing programs 1 and 2, their PMTs and two packets of
+ * each program's video. */
+static void
+_write_mpts_chunk (guint8 * buf, guint8 cc)
+{
+  static const guint8 PAT[] = {
+    0x00, 0x00, 0xb0, 0x11, 0x00, 0x01, 0xc1, 0x00, 0x00,
+    0x00, 0x01, 0xe0 | (SPLIT_PMT_PID (1) >> 8), SPLIT_PMT_PID (1) & 0xff,
+    0x00, 0x02, 0xe0 | (SPLIT_PMT_PID (2) >> 8), SPLIT_PMT_PID (2) & 0xff,
+    0x00, 0x00, 0x00, 0x00
+  };
+  guint program;
+
+  _write_ts_header (buf, 0, TRUE, cc);
+  memcpy (buf + 4, PAT, sizeof (PAT));
+  buf += HWANGSAE_MPEGTS_PACKET_SIZE;
+
+  for (program = 1; program <= 2; ++program) {
+    const guint8 PMT[] = {
+      0x00, 0x02, 0xb0, 0x12, 0x00, program, 0xc1, 0x00, 0x00,
+      0xe0 | (SPLIT_VIDEO_PID (program) >> 8),
+      SPLIT_VIDEO_PID (program) & 0xff, 0xf0, 0x00,
+      0x1b, 0xe0 | (SPLIT_VIDEO_PID (program) >> 8),
+      SPLIT_VIDEO_PID (program) & 0xff, 0xf0, 0x00,
+      0x00, 0x00, 0x00, 0x00
+    };
+
+    _write_ts_header (buf, SPLIT_PMT_PID (program), TRUE, cc);
+    memcpy (buf + 4, PMT, sizeof (PMT));
+    buf += HWANGSAE_MPEGTS_PACKET_SIZE;
+  }
+
+  for (program = 1; program <= 2; ++program) {
+    _write_ts_header (buf, SPLIT_VIDEO_PID (program), FALSE, 2 * cc);
+    buf += HWANGSAE_MPEGTS_PACKET_SIZE;
+    _write_ts_header (buf, SPLIT_VIDEO_PID (program), FALSE, 2 * cc + 1);
+    buf += HWANGSAE_MPEGTS_PACKET_SIZE;
+  }
+}
+
+static void
+test_hwangsae_relay_split_programs (void)
+{
+  g_autoptr (HwangsaeRelay) relay = _relay_new ();
+  g_autoptr (GVariant) stream_stats = NULL;
+  g_autoptr (GVariant) sources = NULL;
+  GVariantIter iter;
+  GVariant *source_stats;
+  guint8 buf[TS_CHUNK_SIZE];
+  guint n_split = 0;
+  guint video_packets = 0;
+  SRTSOCKET sink;
+  SRTSOCKET whole;
+  SRTSOCKET source;
+  guint8 cc;
+  gint len;
+
+  sink = _srt_connect (SINK_PORT, "#!::u=edge1");
+  g_assert_cmpint (sink, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "edge1", 0);
+
+  g_assert_cmpint (_srt_connect (SOURCE_PORT, "#!::r=edge1/progx"), ==,
+      SRT_INVALID_SOCK);
+  g_assert_cmpint (_srt_connect (SOURCE_PORT, "#!::r=edge2/prog1"), ==,
+      SRT_INVALID_SOCK);
+  g_assert_cmpint (_srt_connect (SOURCE_PORT, "#!::r=edge1+edge1/prog1"), ==,
+      SRT_INVALID_SOCK);
+  g_assert_cmpint (_srt_connect (SOURCE_PORT,
+          "#!::r=edge1/prog1+edge1/prog1"), ==, SRT_INVALID_SOCK);
+
+  /* Distinct programs of one stream make an aggregate. */
+  source = _srt_connect (SOURCE_PORT, "#!::r=edge1/prog1+edge1/prog2");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "edge1", 2);
+  srt_close (source);
+  _wait_for_subscribers (relay, "edge1", 0);
+
+  whole = _srt_connect (SOURCE_PORT, "#!::r=edge1");
+  g_assert_cmpint (whole, !=, SRT_INVALID_SOCK);
+  source = _srt_connect (SOURCE_PORT, "#!::r=edge1/prog2");
+  g_assert_cmpint (source, !=, SRT_INVALID_SOCK);
+  _wait_for_subscribers (relay, "edge1", 2);
+
+  stream_stats = _lookup_stream_stats (relay, "edge1");
+  sources = g_variant_lookup_value (stream_stats, "sources",
+      G_VARIANT_TYPE ("aa{sv}"));
+  g_variant_iter_init (&iter, sources);
+  while ((source_stats = g_variant_iter_next_value (&iter))) {
+    guint program;
+
+    if (g_variant_lookup (source_stats, "split-program", "u", &program)) {
+      g_assert_cmpuint (program, ==, 2);
+      ++n_split;
+    }
+    g_variant_unref (source_stats);
+  }
+  g_assert_cmpuint (n_split, ==, 1);
+
+  for (cc = 0; cc != 10; ++cc) {
+    gint offset;
+
+    _write_mpts_chunk (buf, cc);
+    g_assert_cmpint (srt_send (sink, (char *) buf, sizeof (buf)), ==,
+        sizeof (buf));
+
+    /* The whole stream passes untouched. */
+    len = srt_recv (whole, (char *) buf, sizeof (buf));
+    g_assert_cmpint (len, ==, sizeof (buf));
+
+    /* The program gets its own PAT, its PMT and its video. */
+    len = srt_recv (source, (char *) buf, sizeof (buf));
+    g_assert_cmpint (len, ==, 4 * HWANGSAE_MPEGTS_PACKET_SIZE);
+
+    for (offset = 0; offset < len; offset += HWANGSAE_MPEGTS_PACKET_SIZE) {
+      const guint8 *packet = buf + offset;
+      guint16 pid = hwangsae_mpegts_packet_pid (packet);
+
+      if (pid == 0) {
+        const guint8 *section = packet + 5;
+
+        g_assert_cmpuint (packet[3] & 0x0f, ==, cc & 0x0f);
+        /* A single program entry */
+        g_assert_cmpuint (section[2], ==, 13);
+        g_assert_cmpuint ((section[8] << 8) | section[9], ==, 2);
+        g_assert_cmpuint (((section[10] & 0x1f) << 8) | section[11], ==,
+            SPLIT_PMT_PID (2));
+      } else if (pid == SPLIT_VIDEO_PID (2)) {
+        ++video_packets;
+      } else {
+        g_assert_cmpuint (pid, ==, SPLIT_PMT_PID (2));
+      }
+    }
+  }
+
+  g_assert_cmpuint (video_packets, ==, 20);
+
+  srt_close (source);
+  srt_close (whole);
+  srt_close (sink);
 }
 
 int
 main (int argc, char *argv[])
 {
+  int result;
+
   g_test_init (&argc, &argv, NULL);
+  gst_init (&argc, &argv);
 
   /* Don't treat warnings as fatal, which is GTest default. */
   g_log_set_always_fatal (G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL);
 
+  srt_startup ();
+
   g_test_add_func ("/hwangsae/relay-instance", test_hwangsae_relay_instance);
+  g_test_add_func ("/hwangsae/relay-latency-probe",
+      test_hwangsae_relay_latency_probe);
+  g_test_add_func ("/hwangsae/relay-encryption",
+      test_hwangsae_relay_encryption);
+  g_test_add_func ("/hwangsae/relay-fec", test_hwangsae_relay_fec);
+  g_test_add_func ("/hwangsae/relay-bonding", test_hwangsae_relay_bonding);
+  g_test_add_func ("/hwangsae/relay-adaptive-latency",
+      test_hwangsae_relay_adaptive_latency);
+  g_test_add_func ("/hwangsae/relay-user-quota",
+      test_hwangsae_relay_user_quota);
+#if SRT_VERSION_VALUE >= SRT_MAKE_VERSION_VALUE (1, 4, 2)
+  g_test_add_func ("/hwangsae/relay-subscriber-limits",
+      test_hwangsae_relay_subscriber_limits);
+#endif
+  g_test_add_func ("/hwangsae/relay-idle-sink", test_hwangsae_relay_idle_sink);
+  g_test_add_func ("/hwangsae/relay-udp-output",
+      test_hwangsae_relay_udp_output);
+  g_test_add_func ("/hwangsae/relay-multicast", test_hwangsae_relay_multicast);
+  g_test_add_func ("/hwangsae/relay-thinning", test_hwangsae_relay_thinning);
+  g_test_add_func ("/hwangsae/relay-renditions",
+      test_hwangsae_relay_renditions);
+  g_test_add_func ("/hwangsae/relay-port-sharding",
+      test_hwangsae_relay_port_sharding);
+  g_test_add_func ("/hwangsae/relay-bind-addresses",
+      test_hwangsae_relay_bind_addresses);
+  g_test_add_func ("/hwangsae/relay-worker-placement",
+      test_hwangsae_relay_worker_placement);
+  g_test_add_func ("/hwangsae/relay-rebalance", test_hwangsae_relay_rebalance);
+  g_test_add_func ("/hwangsae/relay-memory-budget",
+      test_hwangsae_relay_memory_budget);
+  g_test_add_func ("/hwangsae/relay-subscriber-classes",
+      test_hwangsae_relay_subscriber_classes);
+  g_test_add_func ("/hwangsae/relay-cpu-admission",
+      test_hwangsae_relay_cpu_admission);
+  g_test_add_func ("/hwangsae/relay-sender-threads",
+      test_hwangsae_relay_sender_threads);
+  g_test_add_func ("/hwangsae/relay-stats-file",
+      test_hwangsae_relay_stats_file);
+  g_test_add_func ("/hwangsae/relay-drain", test_hwangsae_relay_drain);
+  g_test_add_func ("/hwangsae/relay-drain-timeout",
+      test_hwangsae_relay_drain_timeout);
+  g_test_add_func ("/hwangsae/relay-aggregate", test_hwangsae_relay_aggregate);
+  g_test_add_func ("/hwangsae/relay-split-programs",
+      test_hwangsae_relay_split_programs);
+
+  if (g_test_perf ()) {
+    g_test_add_func ("/hwangsae/relay-encryption-cost",
+        test_hwangsae_relay_encryption_cost);
+    g_test_add_func ("/hwangsae/relay-fairness", test_hwangsae_relay_fairness);
+    g_test_add_func ("/hwangsae/relay-udp-egress-cost",
+        test_hwangsae_relay_udp_egress_cost);
+  }
+
+  result = g_test_run ();
+
+  srt_cleanup ();
 
-  return g_test_run ();
+  return result;
 }
@@ -0,0 +1,272 @@
+/**
+ *  Copyright 2019 SK Telecom, Co., Ltd.
+ *
+ */
+
+#include "hwangsae/stats-page.h"
+
+#include <glib-unix.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Attempts to copy a block before giving up until the next refresh */
+#define MAX_READ_ATTEMPTS 100
+
+typedef struct
+{
+  HwangsaeStatsSummary summary;
+  HwangsaeStatsWorker workers[HWANGSAE_STATS_PAGE_MAX_WORKERS];
+  HwangsaeStatsStream streams[HWANGSAE_STATS_PAGE_MAX_STREAMS];
+  guint n_workers;
+  guint n_streams;
+} Snapshot;
+
+typedef struct
+{
+  guint64 bytes_in;
+  guint64 bytes_out;
+  gint64 time;
+} StreamSample;
+
+static GMainLoop *loop = NULL;
+
+static gboolean
+_read_block (const guint32 * seq, const void *src, void *dst, gsize size)
+{
+  guint i;
+
+  for (i = 0; i != MAX_READ_ATTEMPTS; ++i) {
+    if (hwangsae_stats_page_read (seq, src, dst, size)) {
+      return TRUE;
+    }
+    g_thread_yield ();
+  }
+
+  return FALSE;
+}
+
+static void
+take_snapshot (const HwangsaeStatsPage * page, Snapshot * snapshot)
+{
+  guint i;
+
+  memset (snapshot, 0, sizeof (*snapshot));
+
+  if (!_read_block (&page->summary.seq, &page->summary, &snapshot->summary,
+          sizeof (snapshot->summary))) {
+    return;
+  }
+
+  snapshot->n_workers = MIN (page->n_workers, HWANGSAE_STATS_PAGE_MAX_WORKERS);
+  for (i = 0; i != snapshot->n_workers; ++i) {
+    _read_block (&page->workers[i].seq, &page->workers[i],
+        &snapshot->workers[i], sizeof (snapshot->workers[i]));
+  }
+
+  for (i = 0; i != MIN (snapshot->summary.n_streams,
+          HWANGSAE_STATS_PAGE_MAX_STREAMS); ++i) {
+    HwangsaeStatsStream *stream = &snapshot->streams[snapshot->n_streams];
+
+    if (_read_block (&page->streams[i].seq, &page->streams[i], stream,
+            sizeof (*stream))) {
+      stream->stream[sizeof (stream->stream) - 1] = '\0';
+      ++snapshot->n_streams;
+    }
+  }
+}
+
+static gdouble
+_rate_kbps (guint64 bytes, guint64 previous_bytes, gint64 elapsed_us)
+{
+  if (elapsed_us <= 0 || bytes < previous_bytes) {
+    return 0;
+  }
+
+  return (bytes - previous_bytes) * 8000.0 / elapsed_us;
+}
+
+static void
+print_snapshot (Snapshot * snapshot, GHashTable * samples)
+{
+  g_autoptr (GHashTable) new_samples = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, g_free);
+  GHashTableIter iter;
+  gpointer name;
+  gpointer value;
+  guint i;
+
+  /* Clear the terminal. */
+  g_print ("\033[H\033[2J");
+
+  g_print ("%u streams, %u subscribers, %.1f KiB queued\n\n",
+      snapshot->n_streams, snapshot->summary.subscribers,
+      snapshot->summary.memory_usage / 1024.0);
+
+  g_print ("%-6s %8s %6s %14s\n", "WORKER", "STREAMS", "UTIL", "FAN-OUT LAG");
+  for (i = 0; i != snapshot->n_workers; ++i) {
+    HwangsaeStatsWorker *worker = &snapshot->workers[i];
+
+    g_print ("%6u %8u %5u%% %11u us\n", i, worker->streams,
+        worker->utilization, worker->fanout_lag);
+  }
+
+  g_print ("\n%-24s %5s %6s %12s %12s %10s %10s\n", "STREAM", "SUBS",
+      "WORKER", "IN kbit/s", "OUT kbit/s", "THINNED", "DROPPED");
+
+  for (i = 0; i != snapshot->n_streams; ++i) {
+    HwangsaeStatsStream *stream = &snapshot->streams[i];
+    StreamSample *previous = g_hash_table_lookup (samples, stream->stream);
+    StreamSample *sample = g_new0 (StreamSample, 1);
+    gdouble in_kbps = 0;
+    gdouble out_kbps = 0;
+
+    sample->bytes_in = stream->bytes_in;
+    sample->bytes_out = stream->bytes_out;
+    sample->time = snapshot->summary.update_time;
+
+    if (previous) {
+      gint64 elapsed = sample->time - previous->time;
+
+      in_kbps = _rate_kbps (sample->bytes_in, previous->bytes_in, elapsed);
+      out_kbps = _rate_kbps (sample->bytes_out, previous->bytes_out, elapsed);
+    }
+
+    g_print ("%-24s %5u %6u %12.1f %12.1f %10" G_GUINT64_FORMAT " %10"
+        G_GUINT64_FORMAT "\n", stream->stream, stream->subscribers,
+        stream->worker, in_kbps, out_kbps, stream->packets_thinned,
+        stream->packets_dropped);
+
+    g_hash_table_insert (new_samples, g_strdup (stream->stream), sample);
+  }
+
+  /* Only streams that still exist are worth remembering. */
+  g_hash_table_remove_all (samples);
+  g_hash_table_iter_init (&iter, new_samples);
+  while (g_hash_table_iter_next (&iter, &name, &value)) {
+    g_hash_table_iter_steal (&iter);
+    g_hash_table_insert (samples, name, value);
+  }
+}
+
+static const HwangsaeStatsPage *
+map_stats_page (const gchar * path, GError ** error)
+{
+  const HwangsaeStatsPage *page;
+  struct stat st;
+  gint fd;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "%s", g_strerror (errno));
+    return NULL;
+  }
+
+  if (fstat (fd, &st) < 0 || (gsize) st.st_size < sizeof (HwangsaeStatsPage)) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Not a relay stats file");
+    close (fd);
+    return NULL;
+  }
+
+  page = mmap (NULL, sizeof (HwangsaeStatsPage), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (page == MAP_FAILED) {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "%s", g_strerror (errno));
+    return NULL;
+  }
+
+  if (__atomic_load_n (&page->magic, __ATOMIC_ACQUIRE) !=
+      HWANGSAE_STATS_PAGE_MAGIC ||
+      page->version != HWANGSAE_STATS_PAGE_VERSION) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Not a relay stats file or of an unsupported version");
+    munmap ((gpointer) page, sizeof (HwangsaeStatsPage));
+    return NULL;
+  }
+
+  return page;
+}
+
+typedef struct
+{
+  const HwangsaeStatsPage *page;
+  GHashTable *samples;
+} TopData;
+
+static gboolean
+refresh (TopData * data)
+{
+  Snapshot snapshot;
+
+  take_snapshot (data->page, &snapshot);
+  print_snapshot (&snapshot, data->samples);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+intr_handler (gpointer unused)
+{
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GOptionContext) context = NULL;
+  g_autoptr (GHashTable) samples = NULL;
+  gint interval = 1;
+  GOptionEntry entries[] = {
+    {"interval", 'i', 0, G_OPTION_ARG_INT, &interval,
+        "Seconds between refreshes (default: 1)", "SECONDS"},
+    {NULL}
+  };
+  TopData data;
+
+  context = g_option_context_new ("STATS-FILE");
+  g_option_context_set_summary (context,
+      "Shows live bitrates, subscriber counts, drops and worker load of a "
+      "relay.\nThe relay must run with stats-file set to STATS-FILE.");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+
+  if (argc < 2) {
+    g_printerr ("You must specify the stats file\n");
+    return 1;
+  }
+
+  data.page = map_stats_page (argv[1], &error);
+  if (!data.page) {
+    g_printerr ("Couldn't open %s: %s\n", argv[1], error->message);
+    return 1;
+  }
+
+  samples = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  data.samples = samples;
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  g_unix_signal_add (SIGINT, intr_handler, NULL);
+  g_timeout_add_seconds (MAX (interval, 1), (GSourceFunc) refresh, &data);
+
+  refresh (&data);
+  g_main_loop_run (loop);
+
+  g_main_loop_unref (loop);
+  munmap ((gpointer) data.page, sizeof (HwangsaeStatsPage));
+
+  return 0;
+}
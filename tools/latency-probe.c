@@ -0,0 +1,267 @@
+/**
+ *  Copyright 2019 SK Telecom, Co., Ltd.
+ *
+ */
+
+#include "hwangsae/mpegts.h"
+
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <srt/srt.h>
+#include <string.h>
+
+/* Upper bounds of the histogram buckets in milliseconds. */
+static const guint HISTOGRAM_BUCKETS_MS[] = {
+  1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, G_MAXUINT
+};
+
+#define N_BUCKETS G_N_ELEMENTS (HISTOGRAM_BUCKETS_MS)
+
+typedef struct
+{
+  const gchar *name;
+  guint64 buckets[N_BUCKETS];
+  guint64 count;
+  gint64 sum;
+  gint64 min;
+  gint64 max;
+} Histogram;
+
+typedef struct
+{
+  gchar *uri;
+  gchar *stream_id;
+  gint duration;
+} ProbeOptions;
+
+static gboolean running = TRUE;
+
+static void
+histogram_add (Histogram * histogram, gint64 latency_us)
+{
+  guint i;
+
+  if (latency_us < 0) {
+    /* Clocks of the machines aren't in sync. */
+    latency_us = 0;
+  }
+
+  for (i = 0; i < N_BUCKETS - 1; ++i) {
+    if (latency_us < (gint64) HISTOGRAM_BUCKETS_MS[i] * 1000) {
+      break;
+    }
+  }
+
+  ++histogram->buckets[i];
+
+  if (histogram->count == 0 || latency_us < histogram->min) {
+    histogram->min = latency_us;
+  }
+  if (latency_us > histogram->max) {
+    histogram->max = latency_us;
+  }
+
+  ++histogram->count;
+  histogram->sum += latency_us;
+}
+
+static void
+histogram_print (Histogram * histogram)
+{
+  guint i;
+
+  if (histogram->count == 0) {
+    g_print ("%s: no samples\n\n", histogram->name);
+    return;
+  }
+
+  g_print ("%s: %" G_GUINT64_FORMAT " samples, min %.2f ms, avg %.2f ms, "
+      "max %.2f ms\n", histogram->name, histogram->count,
+      histogram->min / 1000.0, histogram->sum / 1000.0 / histogram->count,
+      histogram->max / 1000.0);
+
+  for (i = 0; i < N_BUCKETS; ++i) {
+    guint percent = histogram->buckets[i] * 100 / histogram->count;
+    g_autofree gchar *bar = g_strnfill (percent / 2, '#');
+
+    if (HISTOGRAM_BUCKETS_MS[i] == G_MAXUINT) {
+      g_print ("  >= %4u ms", HISTOGRAM_BUCKETS_MS[i - 1]);
+    } else {
+      g_print ("   < %4u ms", HISTOGRAM_BUCKETS_MS[i]);
+    }
+
+    g_print (" %8" G_GUINT64_FORMAT " %3u%% %s\n", histogram->buckets[i],
+        percent, bar);
+  }
+
+  g_print ("\n");
+}
+
+static gboolean
+intr_handler (gpointer unused)
+{
+  running = FALSE;
+
+  return G_SOURCE_REMOVE;
+}
+
+static SRTSOCKET
+connect_to_relay (ProbeOptions * options, GError ** error)
+{
+  g_autoptr (GSocketConnectable) connectable = NULL;
+  g_autoptr (GSocketAddressEnumerator) enumerator = NULL;
+  g_autoptr (GSocketAddress) sockaddr = NULL;
+  SRTSOCKET sock;
+  gsize sockaddr_len;
+  gpointer sa;
+  gint timeout = 100;
+
+  connectable = g_network_address_parse_uri (options->uri, 0, error);
+  if (!connectable) {
+    return SRT_INVALID_SOCK;
+  }
+
+  enumerator = g_socket_connectable_enumerate (connectable);
+  sockaddr = g_socket_address_enumerator_next (enumerator, NULL, error);
+  if (!sockaddr) {
+    return SRT_INVALID_SOCK;
+  }
+
+  sockaddr_len = g_socket_address_get_native_size (sockaddr);
+  sa = g_alloca (sockaddr_len);
+
+  if (!g_socket_address_to_native (sockaddr, sa, sockaddr_len, error)) {
+    return SRT_INVALID_SOCK;
+  }
+
+  sock = srt_socket (g_socket_address_get_family (sockaddr), SOCK_DGRAM, 0);
+
+  srt_setsockflag (sock, SRTO_RCVTIMEO, &timeout, sizeof (timeout));
+  if (options->stream_id) {
+    srt_setsockflag (sock, SRTO_STREAMID, options->stream_id,
+        strlen (options->stream_id));
+  }
+
+  if (srt_connect (sock, sa, sockaddr_len) == SRT_ERROR) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED,
+        "%s", srt_getlasterror_str ());
+    srt_close (sock);
+    return SRT_INVALID_SOCK;
+  }
+
+  return sock;
+}
+
+int
+main (int argc, char *argv[])
+{
+  ProbeOptions options = { 0 };
+  Histogram delivery = {.name = "Relay to subscriber" };
+  Histogram end_to_end = {.name = "Edge to subscriber" };
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GOptionContext) context = NULL;
+  GOptionEntry entries[] = {
+    {"stream-id", 's', 0, G_OPTION_ARG_STRING, &options.stream_id,
+        "SRT Stream ID to subscribe with", "ID"},
+    {"duration", 'd', 0, G_OPTION_ARG_INT, &options.duration,
+        "Stop after the given number of seconds (default: until Ctrl+C)",
+        "SECONDS"},
+    {NULL}
+  };
+  SRTSOCKET sock;
+  gint64 end_time;
+  guint64 lost = 0;
+  gboolean have_seqnum = FALSE;
+  guint32 next_seqnum = 0;
+
+  context = g_option_context_new ("srt://HOST:PORT");
+  g_option_context_set_summary (context,
+      "Subscribes to a relayed stream and reports the latency measured from "
+      "in-band timing markers.\nThe relay must run with latency-probe "
+      "enabled and the clocks of all machines should be synchronized.");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+
+  if (argc < 2) {
+    g_printerr ("You must specify the relay URI\n");
+    return 1;
+  }
+
+  options.uri = argv[1];
+
+  srt_startup ();
+
+  sock = connect_to_relay (&options, &error);
+  if (sock == SRT_INVALID_SOCK) {
+    g_printerr ("Couldn't connect to %s: %s\n", options.uri, error->message);
+    srt_cleanup ();
+    return 1;
+  }
+
+  g_unix_signal_add (SIGINT, intr_handler, NULL);
+
+  end_time = options.duration > 0 ?
+      g_get_monotonic_time () + options.duration * G_TIME_SPAN_SECOND : -1;
+
+  while (running && (end_time < 0 || g_get_monotonic_time () < end_time)) {
+    guint8 buf[1500];
+    gint len;
+    gint offset;
+
+    g_main_context_iteration (NULL, FALSE);
+
+    len = srt_recvmsg (sock, (char *) buf, sizeof (buf));
+    if (len < 0) {
+      gint error = srt_getlasterror (NULL);
+
+      /* The receive timeout only bounds how long signals wait */
+      if (error == SRT_EASYNCRCV || error == SRT_ETIMEOUT) {
+        continue;
+      }
+      g_printerr ("Connection lost: %s\n", srt_getlasterror_str ());
+      break;
+    }
+
+    for (offset = 0; offset + HWANGSAE_MPEGTS_PACKET_SIZE <= len;
+        offset += HWANGSAE_MPEGTS_PACKET_SIZE) {
+      HwangsaeProbeMarker marker;
+      gint64 now;
+
+      if (!hwangsae_mpegts_probe_read (buf + offset, &marker)) {
+        continue;
+      }
+
+      now = g_get_real_time ();
+
+      /* A sequence number going backwards means the relay restarted or
+       * the stream got republished; resynchronize without counting the
+       * jump as loss. */
+      if (have_seqnum && (gint32) (marker.seqnum - next_seqnum) > 0) {
+        lost += marker.seqnum - next_seqnum;
+      }
+      next_seqnum = marker.seqnum + 1;
+      have_seqnum = TRUE;
+
+      if (marker.relay_time >= 0) {
+        histogram_add (&delivery, now - marker.relay_time);
+      }
+      if (marker.edge_time >= 0) {
+        histogram_add (&end_to_end, now - marker.edge_time);
+      }
+    }
+  }
+
+  srt_close (sock);
+  srt_cleanup ();
+
+  g_print ("\n");
+  histogram_print (&delivery);
+  histogram_print (&end_to_end);
+  g_print ("Markers lost: %" G_GUINT64_FORMAT "\n", lost);
+
+  return 0;
+}